@@ -28,6 +28,8 @@
 #define map_assuan_err(a) \
         map_assuan_err_with_source (GPG_ERR_SOURCE_DEFAULT, (a))
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <gcrypt.h>
 #include "../common/util.h"
@@ -84,6 +86,9 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* Keep unprotected private keys along with cached passphrases.  */
+  int cache_private_keys;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
   /* The require minmum length of a passphrase. */
@@ -99,6 +104,10 @@ struct
      passphrase change.  */
   int enable_passhrase_history;
 
+  /* Maximum number of private key operations running at the same
+     time or 0 for no limit.  */
+  unsigned int max_crypto_ops;
+
   int running_detached; /* We are running detached from the tty. */
 
   int ignore_cache_for_signing;
@@ -219,6 +228,8 @@ const char *get_agent_ssh_socket_name (void);
 void *get_agent_scd_notify_event (void);
 #endif
 void agent_sighup_action (void);
+gpg_error_t agent_crypto_op_begin (void);
+void agent_crypto_op_end (void);
 
 /*-- command.c --*/
 gpg_error_t agent_inq_pinentry_launched (ctrl_t ctrl, unsigned long pid);
@@ -226,6 +237,8 @@ gpg_error_t agent_write_status (ctrl_t ctrl, const char *keyword, ...)
      GNUPG_GCC_A_SENTINEL(0);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+unsigned int get_key_eventcounter (void);
+unsigned int get_card_eventcounter (void);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 #ifdef HAVE_W32_SYSTEM
 int serve_mmapped_ssh_request (ctrl_t ctrl,
@@ -292,6 +305,14 @@ int agent_put_cache (const char *key, cache_mode_t cache_mode,
 const char *agent_get_cache (const char *key, cache_mode_t cache_mode,
                              void **cache_id);
 void agent_unlock_cache_entry (void **cache_id);
+void agent_cache_stats (unsigned int *r_items, unsigned int *r_passphrases,
+                        unsigned int *r_keys,
+                        unsigned long *r_hits, unsigned long *r_misses);
+void agent_put_cache_skey (const char *key, const unsigned char *keybuf,
+                           size_t keylen, const struct stat *st);
+int agent_get_cache_skey (const char *key, cache_mode_t cache_mode,
+                          const struct stat *st, gcry_sexp_t *result);
+void agent_forget_cache_skey (const char *key);
 
 
 /*-- pksign.c --*/
@@ -24,6 +24,8 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "agent.h"
 
@@ -33,20 +35,59 @@ struct secret_data_s {
   char data[1];
 };
 
+/* The number of buckets of the hash table; must be a power of 2.  */
+#define CACHE_HASH_SIZE 1024
+
+/* The number of slots of the timer wheel, each covering one second;
+   must be a power of 2.  Items expiring later than the wheel covers
+   are looked at once per revolution.  */
+#define WHEEL_SIZE 256
+
+/* Items without a passphrase are removed after this many seconds.  */
+#define UNUSED_ITEM_TTL (30*60)
+
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;   /* Next item in the same hash bucket.  */
+  ITEM wnext;  /* Next item in the same timer wheel slot.  */
+  ITEM wprev;  /* Previous item in the same timer wheel slot.  */
+  int wslot;   /* The timer wheel slot or -1 if not scheduled.  */
   time_t created;
   time_t accessed;
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   int lockcount;
   struct secret_data_s *pw;
   cache_mode_t cache_mode;
+  /* The unprotected private key in canonical S-expression format
+     for the keygrip KEY or NULL; see --cache-private-keys.  The
+     remaining fields describe the key file it has been read from.  */
+  struct secret_data_s *skey;
+  time_t skey_mtime;
+  unsigned long skey_size;
+  unsigned long skey_ino;
   char key[1];
 };
 
 
-static ITEM thecache;
+/* The cache items hashed by their key.  New items are inserted at
+   the head of a bucket; thus for equal keys the newest comes first.
+   Note that the cache mode is not part of the hash because a lookup
+   does not care about the mode.  */
+static ITEM cache_table[CACHE_HASH_SIZE];
+
+/* The timer wheel.  Each item with an expiration time T is linked
+   into slot T % WHEEL_SIZE.  The actual time is computed again when
+   the slot is processed; thus an access, which only extends the
+   lifetime, does not need to move the item.  */
+static ITEM wheel[WHEEL_SIZE];
+
+/* The time up to which the timer wheel has been processed.  */
+static time_t wheel_time;
+
+/* Statistics for GETINFO.  */
+static unsigned int cache_items;
+static unsigned long cache_hits;
+static unsigned long cache_misses;
 
 
 static void
@@ -55,6 +96,16 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Release the passphrase and the private key stored with item R.  */
+static void
+release_secrets (ITEM r)
+{
+  release_data (r->pw);
+  r->pw = NULL;
+  release_data (r->skey);
+  r->skey = NULL;
+}
+
 static struct secret_data_s *
 new_data (const void *data, size_t length)
 {
@@ -78,83 +129,187 @@ new_data (const void *data, size_t length)
 }
 
 
+/* Return the hash bucket for KEY.  */
+static ITEM *
+bucket_of (const char *key)
+{
+  unsigned int h = 0;
 
-/* check whether there are items to expire */
-static void
-housekeeping (void)
+  for (; *key; key++)
+    h = (h << 5) - h + *(const unsigned char *)key;
+  return &cache_table[h & (CACHE_HASH_SIZE - 1)];
+}
+
+
+/* Return the time at which item R needs to be looked at again by the
+   housekeeping or 0 if it will never expire.  */
+static time_t
+expiry_time (ITEM r)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  time_t t;
+  unsigned long maxttl;
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  if (r->pw)
     {
-      if (!r->lockcount && r->pw
-	  && r->ttl >= 0 && r->accessed + r->ttl < current)
+      switch (r->cache_mode)
         {
-          if (DBG_CACHE)
-            log_debug ("  expired `%s' (%ds after last access)\n",
-                       r->key, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
+        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
+        default: maxttl = opt.max_cache_ttl; break;
         }
+      t = r->created + maxttl + 1;
+      if (r->ttl >= 0 && r->accessed + r->ttl + 1 < t)
+        t = r->accessed + r->ttl + 1;
+    }
+  else if (r->ttl >= 0)
+    t = r->accessed + UNUSED_ITEM_TTL + 1;
+  else
+    t = 0;
+  return t;
+}
+
+
+/* Remove item R from the timer wheel.  */
+static void
+unschedule_item (ITEM r)
+{
+  if (r->wslot < 0)
+    return;
+  if (r->wprev)
+    r->wprev->wnext = r->wnext;
+  else
+    wheel[r->wslot] = r->wnext;
+  if (r->wnext)
+    r->wnext->wprev = r->wprev;
+  r->wnext = r->wprev = NULL;
+  r->wslot = -1;
+}
+
+
+/* Put item R into the timer wheel slot for its expiration time.
+   This needs to be called whenever that time may have decreased.  */
+static void
+schedule_item (ITEM r)
+{
+  time_t t = expiry_time (r);
+
+  unschedule_item (r);
+  if (!t)
+    return;
+  if (t <= wheel_time)
+    t = wheel_time + 1;  /* Look at it with the next housekeeping.  */
+  r->wslot = (unsigned long)t & (WHEEL_SIZE - 1);
+  r->wnext = wheel[r->wslot];
+  if (r->wnext)
+    r->wnext->wprev = r;
+  wheel[r->wslot] = r;
+}
+
+
+/* Remove item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  unschedule_item (r);
+  for (rp = bucket_of (r->key); *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  release_secrets (r);
+  xfree (r);
+  cache_items--;
+}
+
+
+/* Expire the passphrase of item R or remove it from the cache as
+   required at time CURRENT and schedule it again.  */
+static void
+expire_item (ITEM r, time_t current)
+{
+  unsigned long maxttl;
+
+  /* First expire the actual data */
+  if (!r->lockcount && r->pw
+      && r->ttl >= 0 && r->accessed + r->ttl < current)
+    {
+      if (DBG_CACHE)
+        log_debug ("  expired `%s' (%ds after last access)\n",
+                   r->key, r->ttl);
+      release_secrets (r);
+      r->accessed = current;
     }
 
   /* Second, make sure that we also remove them based on the created stamp so
      that the user has to enter it from time to time. */
-  for (r=thecache; r; r = r->next)
+  switch (r->cache_mode)
     {
-      unsigned long maxttl;
-      
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (!r->lockcount && r->pw && r->created + maxttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired `%s' (%lus after creation)\n",
-                       r->key, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+    case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
+    default: maxttl = opt.max_cache_ttl; break;
+    }
+  if (!r->lockcount && r->pw && r->created + maxttl < current)
+    {
+      if (DBG_CACHE)
+        log_debug ("  expired `%s' (%lus after creation)\n",
+                   r->key, opt.max_cache_ttl);
+      release_secrets (r);
+      r->accessed = current;
     }
 
   /* Third, make sure that we don't have too many items in the list.
      Expire old and unused entries after 30 minutes */
-  for (rprev=NULL, r=thecache; r; )
+  if (!r->pw && r->ttl >= 0 && r->accessed + UNUSED_ITEM_TTL < current)
     {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      if (r->lockcount)
         {
-          if (r->lockcount)
-            {
-              log_error ("can't remove unused cache entry `%s' due to"
-                         " lockcount=%d\n",
-                         r->key, r->lockcount);
-              r->accessed += 60*10; /* next error message in 10 minutes */
-              rprev = r;
-              r = r->next;
-            }
-          else
-            {
-              ITEM r2 = r->next;
-              if (DBG_CACHE)
-                log_debug ("  removed `%s' (slot not used for 30m)\n", r->key);
-              xfree (r);
-              if (!rprev)
-                thecache = r2;
-              else
-                rprev->next = r2;
-              r = r2;
-            }
+          log_error ("can't remove unused cache entry `%s' due to"
+                     " lockcount=%d\n",
+                     r->key, r->lockcount);
+          r->accessed += 60*10; /* next error message in 10 minutes */
         }
       else
         {
-          rprev = r;
-          r = r->next;
+          if (DBG_CACHE)
+            log_debug ("  removed `%s' (slot not used for 30m)\n", r->key);
+          remove_item (r);
+          return;
+        }
+    }
+
+  schedule_item (r);
+}
+
+
+/* Check whether there are items to expire.  Only the timer wheel
+   slots for the seconds passed since the last call are processed.  */
+static void
+housekeeping (void)
+{
+  time_t current = gnupg_get_time ();
+  time_t t, last;
+  ITEM r, list;
+
+  if (!wheel_time || current < wheel_time)
+    {
+      /* First call or the clock went backwards.  */
+      wheel_time = current;
+      return;
+    }
+
+  last = wheel_time;
+  wheel_time = current;
+  for (t = last + 1; t <= current && t <= last + WHEEL_SIZE; t++)
+    {
+      list = wheel[(unsigned long)t & (WHEEL_SIZE - 1)];
+      wheel[(unsigned long)t & (WHEEL_SIZE - 1)] = NULL;
+      while ((r = list))
+        {
+          list = r->wnext;
+          r->wnext = r->wprev = NULL;
+          r->wslot = -1;
+          expire_item (r, current);
         }
     }
 }
@@ -164,28 +319,33 @@ void
 agent_flush_cache (void)
 {
   ITEM r;
+  int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache\n");
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (!r->lockcount && r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing `%s'\n", r->key);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-      else if (r->lockcount && r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("    marked `%s' for flushing\n", r->key);
-          r->accessed = 0;
-          r->ttl = 0;
-        }
-    }
+  for (i=0; i < CACHE_HASH_SIZE; i++)
+    for (r=cache_table[i]; r; r = r->next)
+      {
+        if (!r->lockcount && r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing `%s'\n", r->key);
+            release_secrets (r);
+            r->accessed = 0;
+            schedule_item (r);
+          }
+        else if (r->lockcount && r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("    marked `%s' for flushing\n", r->key);
+            release_data (r->skey);
+            r->skey = NULL;
+            r->accessed = 0;
+            r->ttl = 0;
+            schedule_item (r);
+          }
+      }
 }
 
 
@@ -200,7 +360,7 @@ int
 agent_put_cache (const char *key, cache_mode_t cache_mode,
                  const char *data, int ttl)
 {
-  ITEM r;
+  ITEM r, *bucket;
 
   if (DBG_CACHE)
     log_debug ("agent_put_cache `%s' requested ttl=%d mode=%d\n",
@@ -218,18 +378,15 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
   if (!ttl || cache_mode == CACHE_MODE_IGNORE)
     return 0;
 
-  for (r=thecache; r; r = r->next)
+  bucket = bucket_of (key);
+  for (r=*bucket; r; r = r->next)
     {
       if (!r->lockcount && !strcmp (r->key, key))
         break;
     }
   if (r)
     { /* replace */
-      if (r->pw)
-        {
-          release_data (r->pw);
-          r->pw = NULL;
-        }
+      release_secrets (r);
       if (data)
         {
           r->created = r->accessed = gnupg_get_time (); 
@@ -239,6 +396,7 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           if (!r->pw)
             log_error ("out of core while allocating new cache item\n");
         }
+      schedule_item (r);
     }
   else if (data)
     { /* simply insert */
@@ -251,6 +409,7 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time (); 
           r->ttl = ttl;
           r->cache_mode = cache_mode;
+          r->wslot = -1;
           r->pw = new_data (data, strlen (data)+1);
           if (!r->pw)
             {
@@ -259,8 +418,10 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
             }
           else
             {
-              r->next = thecache;
-              thecache = r;
+              r->next = *bucket;
+              *bucket = r;
+              cache_items++;
+              schedule_item (r);
             }
         }
     }
@@ -273,7 +434,7 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
 const char *
 agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
 {
-  ITEM r;
+  ITEM r, *bucket;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
@@ -285,7 +446,8 @@ agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
   /* first try to find one with no locks - this is an updated cache
      entry: We might have entries with a lockcount and without a
      lockcount. */
-  for (r=thecache; r; r = r->next)
+  bucket = bucket_of (key);
+  for (r=*bucket; r; r = r->next)
     {
       if (!r->lockcount && r->pw && !strcmp (r->key, key))
         {
@@ -296,11 +458,12 @@ agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
             log_debug ("... hit\n");
           r->lockcount++;
           *cache_id = r;
+          cache_hits++;
           return r->pw->data;
         }
     }
   /* again, but this time get even one with a lockcount set */
-  for (r=thecache; r; r = r->next)
+  for (r=*bucket; r; r = r->next)
     {
       if (r->pw && !strcmp (r->key, key))
         {
@@ -309,6 +472,7 @@ agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
             log_debug ("... hit (locked)\n");
           r->lockcount++;
           *cache_id = r;
+          cache_hits++;
           return r->pw->data;
         }
     }
@@ -316,6 +480,7 @@ agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
     log_debug ("... miss\n");
 
   *cache_id = NULL;
+  cache_misses++;
   return NULL;
 }
 
@@ -323,18 +488,153 @@ agent_get_cache (const char *key, cache_mode_t cache_mode, void **cache_id)
 void
 agent_unlock_cache_entry (void **cache_id)
 {
-  ITEM r;
+  ITEM r = *cache_id;
+  time_t current, t;
 
-  for (r=thecache; r; r = r->next)
+  if (!r)
+    return;
+  for (r=*bucket_of (r->key); r; r = r->next)
     {
       if (r == *cache_id)
         {
           if (!r->lockcount)
             log_error ("trying to unlock non-locked cache entry `%s'\n",
                        r->key);
-          else
-            r->lockcount--;
+          else if (!--r->lockcount)
+            {
+              /* The expiration may have been deferred due to the
+                 lock.  */
+              current = gnupg_get_time ();
+              t = expiry_time (r);
+              if (t && t <= current)
+                expire_item (r, current);
+            }
           return;
         }
     }
 }
+
+
+/* Return statistics about the cache for GETINFO.  */
+void
+agent_cache_stats (unsigned int *r_items, unsigned int *r_passphrases,
+                   unsigned int *r_keys,
+                   unsigned long *r_hits, unsigned long *r_misses)
+{
+  ITEM r;
+  int i;
+
+  *r_passphrases = *r_keys = 0;
+  for (i=0; i < CACHE_HASH_SIZE; i++)
+    for (r=cache_table[i]; r; r = r->next)
+      {
+        if (r->pw)
+          ++*r_passphrases;
+        if (r->skey)
+          ++*r_keys;
+      }
+  *r_items = cache_items;
+  *r_hits = cache_hits;
+  *r_misses = cache_misses;
+}
+
+
+/* Store the unprotected private key KEYBUF of length KEYLEN with the
+   cache item KEY, which is the hex encoded keygrip of that key.  This
+   is only done if the passphrase for KEY is currently cached; thus the
+   key expires along with the passphrase.  ST describes the key file
+   and is used to detect changes of that file.  */
+void
+agent_put_cache_skey (const char *key, const unsigned char *keybuf,
+                      size_t keylen, const struct stat *st)
+{
+  ITEM r;
+
+  if (!opt.cache_private_keys)
+    return;
+
+  for (r=*bucket_of (key); r; r = r->next)
+    if (r->pw && r->ttl && !strcmp (r->key, key))
+      break;
+  if (!r)
+    return;
+
+  if (DBG_CACHE)
+    log_debug ("agent_put_cache_skey `%s'\n", key);
+  release_data (r->skey);
+  r->skey = new_data (keybuf, keylen);
+  if (!r->skey)
+    {
+      log_error ("out of core while allocating new cache item\n");
+      return;
+    }
+  r->skey_mtime = st->st_mtime;
+  r->skey_size = st->st_size;
+  r->skey_ino = st->st_ino;
+}
+
+
+/* Try to find the private key for KEY in the cache.  On success the
+   key is returned as a new S-expression at RESULT and true is
+   returned.  ST describes the current key file; if it does not match
+   the one the key has been read from, the cached key is dropped.
+   Using the cached key counts as an access to the passphrase.  */
+int
+agent_get_cache_skey (const char *key, cache_mode_t cache_mode,
+                      const struct stat *st, gcry_sexp_t *result)
+{
+  ITEM r;
+  gpg_error_t err;
+
+  *result = NULL;
+  if (!opt.cache_private_keys || cache_mode == CACHE_MODE_IGNORE)
+    return 0;
+
+  housekeeping ();
+
+  for (r=*bucket_of (key); r; r = r->next)
+    if (r->skey && !strcmp (r->key, key))
+      break;
+  if (!r)
+    return 0;
+
+  if (r->skey_mtime != st->st_mtime
+      || r->skey_size != (unsigned long)st->st_size
+      || r->skey_ino != (unsigned long)st->st_ino)
+    {
+      if (DBG_CACHE)
+        log_debug ("agent_get_cache_skey `%s'... file changed\n", key);
+      release_data (r->skey);
+      r->skey = NULL;
+      return 0;
+    }
+
+  err = gcry_sexp_sscan (result, NULL, r->skey->data, r->skey->datalen);
+  if (err)
+    {
+      log_error ("failed to build S-Exp from cached key: %s\n",
+                 gpg_strerror (err));
+      *result = NULL;
+      return 0;
+    }
+  r->accessed = gnupg_get_time ();
+  if (DBG_CACHE)
+    log_debug ("agent_get_cache_skey `%s'... hit\n", key);
+  return 1;
+}
+
+
+/* Remove the private key for KEY from the cache.  This needs to be
+   called whenever the key file is written.  */
+void
+agent_forget_cache_skey (const char *key)
+{
+  ITEM r;
+
+  for (r=*bucket_of (key); r; r = r->next)
+    if (r->skey && !strcmp (r->key, key))
+      {
+        release_data (r->skey);
+        r->skey = NULL;
+      }
+}
@@ -204,6 +204,51 @@ struct ssh_control_file_s
 };
 
 
+/* The state of a file used to detect modifications.  */
+struct file_state_s
+{
+  int missing;      /* The file could not be stat-ed.  */
+  time_t mtime;
+  time_t ctime;
+  off_t size;
+  ino_t ino;
+};
+
+/* An item of the list of key files used for the identity cache.  */
+struct identity_file_s
+{
+  char hexgrip[40+1];
+  struct file_state_s state;
+};
+
+/* The cached identities from the sshcontrol file.  The public keys
+   are stored in the wire format as returned to the ssh client.  The
+   cache is valid as long as the sshcontrol file, the key files and
+   the key event counter did not change.  */
+static struct
+{
+  int valid;
+  unsigned int eventcounter;      /* Value of the key event counter.  */
+  struct file_state_s cf_state;   /* State of the sshcontrol file.  */
+  struct identity_file_s *files;  /* The enabled keys.  */
+  int nfiles;
+  u32 count;                      /* Number of keys in BLOBS.  */
+  void *blobs;
+  size_t blobslen;
+} file_identities;
+
+/* The cached identity of the card.  This is valid as long as the
+   card event counter did not change.  */
+static struct
+{
+  int valid;
+  unsigned int eventcounter;      /* Value of the card event counter.  */
+  u32 count;                      /* 0 or 1.  */
+  void *blob;
+  size_t bloblen;
+} card_identity;
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -991,6 +1036,7 @@ add_control_entry (ctrl_t ctrl, const char *hexgrip, const char *fmtfpr,
                tp->tm_hour, tp->tm_min, tp->tm_sec,
                fmtfpr, hexgrip, ttl, confirm? " confirm":"");
 
+      file_identities.valid = 0;
     }
   close_control_file (cf);
   return 0;
@@ -2242,68 +2288,172 @@ card_key_available (ctrl_t ctrl, gcry_sexp_t *r_pk, char **cardsn)
 }
 
 
-
+/* Store the state of the file FNAME at R_STATE.  */
+static void
+get_file_state (const char *fname, struct file_state_s *r_state)
+{
+  struct stat st;
 
-/*
+  memset (r_state, 0, sizeof *r_state);
+  if (stat (fname, &st))
+    r_state->missing = 1;
+  else
+    {
+      r_state->mtime = st.st_mtime;
+      r_state->ctime = st.st_ctime;
+      r_state->size = st.st_size;
+      r_state->ino = st.st_ino;
+    }
+}
 
-  Request handler.  Each handler is provided with a CTRL context, a
-  REQUEST object and a RESPONSE object.  The actual request is to be
-  read from REQUEST, the response needs to be written to RESPONSE.
 
-*/
+/* Return true if the file states A and B are equal.  */
+static int
+same_file_state (const struct file_state_s *a, const struct file_state_s *b)
+{
+  return (a->missing == b->missing
+          && a->mtime == b->mtime
+          && a->ctime == b->ctime
+          && a->size == b->size
+          && a->ino == b->ino);
+}
+
+
+/* Return true if the file with STATE may have been modified at or
+   after NOW without that being visible in its time stamps.  */
+static int
+racy_file_state (const struct file_state_s *state, time_t now)
+{
+  return !state->missing && (state->mtime >= now || state->ctime >= now);
+}
 
 
-/* Handler for the "request_identities" command.  */
+/* Make sure that the cached card identity is up to date.  Reading
+   the key from the card requires several round trips to the
+   scdaemon and is thus only done after a card event.  Without event
+   signals from the scdaemon the card is asked each time.  */
 static gpg_error_t
-ssh_handler_request_identities (ctrl_t ctrl,
-                                estream_t request, estream_t response)
+update_card_identity (ctrl_t ctrl)
 {
-  ssh_key_type_spec_t spec;
-  char *key_fname = NULL;
-  char *fnameptr;
-  u32 key_counter;
-  estream_t key_blobs;
-  gcry_sexp_t key_secret;
-  gcry_sexp_t key_public;
   gpg_error_t err;
-  int ret;
-  ssh_control_file_t cf = NULL;
+  unsigned int eventcounter;
+  gcry_sexp_t key_public;
   char *cardsn;
-  gpg_error_t ret_err;
-
-  (void)request;
-
-  /* Prepare buffer stream.  */
+  estream_t stream;
+  void *blob = NULL;
+  size_t bloblen = 0;
+  u32 count = 0;
+  int cacheable = opt.sigusr2_enabled;
 
-  key_secret = NULL;
-  key_public = NULL;
-  key_counter = 0;
-  err = 0;
+  eventcounter = get_card_eventcounter ();
+  if (card_identity.valid && card_identity.eventcounter == eventcounter)
+    return 0;
 
-  key_blobs = es_mopen (NULL, 0, 0, 1, NULL, NULL, "r+b");
-  if (! key_blobs)
+  err = card_key_available (ctrl, &key_public, &cardsn);
+  if (err)
     {
-      err = gpg_error_from_syserror ();
-      goto out;
+      /* No usable card key.  Only the absence of a card or of a
+         suitable key is known to persist until the next card event;
+         any other error (e.g. the scdaemon is not running or the
+         card is in use) may go away without an event and thus we
+         need to try again next time.  */
+      switch (gpg_err_code (err))
+        {
+        case GPG_ERR_CARD_NOT_PRESENT:
+        case GPG_ERR_CARD_REMOVED:
+        case GPG_ERR_NOT_SUPPORTED:
+          break;
+        default:
+          cacheable = 0;
+          break;
+        }
+      err = 0;
     }
-
-  /* First check whether a key is currently available in the card
-     reader - this should be allowed even without being listed in
-     sshcontrol. */
-
-  if (!opt.disable_scdaemon
-      && !card_key_available (ctrl, &key_public, &cardsn))
+  else
     {
-      err = ssh_send_key_public (key_blobs, key_public, cardsn);
+      stream = es_fopenmem (0, "w+b");
+      if (!stream)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = ssh_send_key_public (stream, key_public, cardsn);
+          if (err)
+            es_fclose (stream);
+          else if (es_fclose_snatch (stream, &blob, &bloblen))
+            err = gpg_error_from_syserror ();
+        }
       gcry_sexp_release (key_public);
-      key_public = NULL;
       xfree (cardsn);
       if (err)
-        goto out;
+        return err;
+      count = 1;
+    }
 
-      key_counter++;
+  es_free (card_identity.blob);
+  card_identity.blob = blob;
+  card_identity.bloblen = bloblen;
+  card_identity.count = count;
+  card_identity.eventcounter = eventcounter;
+  card_identity.valid = cacheable;
+  return 0;
+}
+
+
+/* Return true if the cached identities of the sshcontrol file are
+   still valid.  KEY_FNAME is a buffer for the names of the key files
+   with FNAMEPTR pointing to the place where the keygrip is to be
+   stored.  */
+static int
+file_identities_valid (const char *cf_fname, char *key_fname, char *fnameptr)
+{
+  struct file_state_s state;
+  int i;
+
+  if (!file_identities.valid
+      || file_identities.eventcounter != get_key_eventcounter ())
+    return 0;
+
+  get_file_state (cf_fname, &state);
+  if (!same_file_state (&state, &file_identities.cf_state))
+    return 0;
+
+  for (i=0; i < file_identities.nfiles; i++)
+    {
+      stpcpy (stpcpy (fnameptr, file_identities.files[i].hexgrip), ".key");
+      get_file_state (key_fname, &state);
+      if (!same_file_state (&state, &file_identities.files[i].state))
+        return 0;
     }
 
+  return 1;
+}
+
+
+/* Make sure that the cached identities of the keys listed in the
+   sshcontrol file are up to date.  */
+static gpg_error_t
+update_file_identities (void)
+{
+  ssh_key_type_spec_t spec;
+  char *cf_fname = NULL;
+  char *key_fname = NULL;
+  char *fnameptr;
+  u32 key_counter;
+  estream_t key_blobs = NULL;
+  gcry_sexp_t key_secret = NULL;
+  gcry_sexp_t key_public = NULL;
+  gpg_error_t err;
+  ssh_control_file_t cf = NULL;
+  unsigned int eventcounter;
+  struct file_state_s cf_state;
+  struct identity_file_s *files = NULL;
+  int nfiles = 0;
+  int nfiles_allocated = 0;
+  void *blobs;
+  size_t blobslen;
+  time_t now;
+  int racy;
+  int i;
 
   /* Prepare buffer for key name construction.  */
   {
@@ -2327,10 +2477,40 @@ ssh_handler_request_identities (ctrl_t ctrl,
     xfree (dname);
   }
 
-  /* Then look at all the registered and non-disabled keys. */
+  cf_fname = make_filename_try (opt.homedir, SSH_CONTROL_FILE_NAME, NULL);
+  if (!cf_fname)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (file_identities_valid (cf_fname, key_fname, fnameptr))
+    {
+      err = 0;
+      goto out;
+    }
+
+  /* Take the states before reading the files so that a concurrent
+     modification invalidates the cache.  */
+  eventcounter = get_key_eventcounter ();
+  now = time (NULL);
+  get_file_state (cf_fname, &cf_state);
+
+  key_counter = 0;
+  key_blobs = es_fopenmem (0, "w+b");
+  if (!key_blobs)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  /* Look at all the registered and non-disabled keys. */
   err = open_control_file (&cf, 0);
   if (err)
     goto out;
+  /* The file may just have been created.  */
+  if (cf_state.missing)
+    get_file_state (cf_fname, &cf_state);
 
   while (!read_control_file_item (cf))
     {
@@ -2342,6 +2522,23 @@ ssh_handler_request_identities (ctrl_t ctrl,
 
       stpcpy (stpcpy (fnameptr, cf->item.hexgrip), ".key");
 
+      if (nfiles == nfiles_allocated)
+        {
+          struct identity_file_s *tmp;
+
+          nfiles_allocated += 16;
+          tmp = xtryrealloc (files, nfiles_allocated * sizeof *files);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto out;
+            }
+          files = tmp;
+        }
+      strcpy (files[nfiles].hexgrip, cf->item.hexgrip);
+      get_file_state (key_fname, &files[nfiles].state);
+      nfiles++;
+
       /* Read file content.  */
       {
         unsigned char *buffer;
@@ -2393,36 +2590,100 @@ ssh_handler_request_identities (ctrl_t ctrl,
     }
   err = 0;
 
-  ret = es_fseek (key_blobs, 0, SEEK_SET);
-  if (ret)
+  if (es_fclose_snatch (key_blobs, &blobs, &blobslen))
     {
       err = gpg_error_from_syserror ();
       goto out;
     }
+  key_blobs = NULL;
+
+  /* The time stamps have a resolution of one second; thus a file
+     modified in the current second may be modified again without
+     notice.  Do not use the cache in this case.  */
+  racy = racy_file_state (&cf_state, now);
+  for (i=0; i < nfiles && !racy; i++)
+    racy = racy_file_state (&files[i].state, now);
+
+  /* Replace the cache.  */
+  xfree (file_identities.files);
+  es_free (file_identities.blobs);
+  file_identities.files = files;
+  files = NULL;
+  file_identities.nfiles = nfiles;
+  file_identities.cf_state = cf_state;
+  file_identities.eventcounter = eventcounter;
+  file_identities.count = key_counter;
+  file_identities.blobs = blobs;
+  file_identities.blobslen = blobslen;
+  file_identities.valid = !racy;
 
  out:
-  /* Send response.  */
-
   gcry_sexp_release (key_secret);
   gcry_sexp_release (key_public);
+  es_fclose (key_blobs);
+  close_control_file (cf);
+  xfree (files);
+  xfree (cf_fname);
+  xfree (key_fname);
+  return err;
+}
+
+
+
+
+/*
+
+  Request handler.  Each handler is provided with a CTRL context, a
+  REQUEST object and a RESPONSE object.  The actual request is to be
+  read from REQUEST, the response needs to be written to RESPONSE.
+
+*/
+
+
+/* Handler for the "request_identities" command.  The list of
+   identities is cached and only rebuilt if the sshcontrol file, one
+   of the listed key files or the card changed.  */
+static gpg_error_t
+ssh_handler_request_identities (ctrl_t ctrl,
+                                estream_t request, estream_t response)
+{
+  int use_card = !opt.disable_scdaemon;
+  gpg_error_t err;
+  gpg_error_t ret_err;
 
+  (void)request;
+
+  /* First check whether a key is currently available in the card
+     reader - this should be allowed even without being listed in
+     sshcontrol. */
+  err = use_card? update_card_identity (ctrl) : 0;
+
+  /* Then look at all the registered and non-disabled keys.  Note
+     that there must not be any context switch between updating the
+     file identities and writing the response.  */
+  if (!err)
+    err = update_file_identities ();
+
+  /* Send response.  */
   if (!err)
     {
       ret_err = stream_write_byte (response, SSH_RESPONSE_IDENTITIES_ANSWER);
       if (!ret_err)
-        ret_err = stream_write_uint32 (response, key_counter);
-      if (!ret_err)
-        ret_err = stream_copy (response, key_blobs);
+        ret_err = stream_write_uint32 (response,
+                                       (use_card? card_identity.count : 0)
+                                       + file_identities.count);
+      if (!ret_err && use_card && card_identity.bloblen)
+        ret_err = stream_write_data (response, card_identity.blob,
+                                     card_identity.bloblen);
+      if (!ret_err && file_identities.blobslen)
+        ret_err = stream_write_data (response, file_identities.blobs,
+                                     file_identities.blobslen);
     }
   else
     {
       ret_err = stream_write_byte (response, SSH_RESPONSE_FAILURE);
     }
 
-  es_fclose (key_blobs);
-  close_control_file (cf);
-  xfree (key_fname);
-
   return ret_err;
 }
 
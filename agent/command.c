@@ -44,6 +44,8 @@
 #define MAXLEN_CIPHERTEXT 4096
 /* maximum allowed size of the key parameters */
 #define MAXLEN_KEYPARAM 1024
+/* maximum allowed size of the inquired list for PKSIGN --multi */
+#define MAXLEN_SIGNLIST 16384
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
 
@@ -398,6 +400,20 @@ bump_card_eventcounter (void)
   eventcounter.any++;
 }
 
+/* Return the current value of the key event counter.  */
+unsigned int
+get_key_eventcounter (void)
+{
+  return eventcounter.key;
+}
+
+/* Return the current value of the card event counter.  */
+unsigned int
+get_card_eventcounter (void)
+{
+  return eventcounter.card;
+}
+
 
 
 
@@ -668,11 +684,100 @@ cmd_sethash (assuan_context_t ctx, char *line)
 }
 
 
+/* Create the signatures for PKSIGN --multi.  The keys and hashes are
+   inquired from the client and the signatures are appended to
+   OUTBUF.  */
+static gpg_error_t
+pksign_multi (assuan_context_t ctx, ctrl_t ctrl, cache_mode_t cache_mode,
+              membuf_t *outbuf)
+{
+  int rc;
+  unsigned char *value;
+  size_t valuelen;
+  char *buffer, *line, *endline, *p, *desc;
+  int count = 0;
+
+  rc = assuan_inquire (ctx, "SIGNLIST", &value, &valuelen, MAXLEN_SIGNLIST);
+  if (rc)
+    return rc;
+  buffer = xtrymalloc (valuelen + 1);
+  if (!buffer)
+    {
+      rc = out_of_core ();
+      xfree (value);
+      return rc;
+    }
+  memcpy (buffer, value, valuelen);
+  buffer[valuelen] = 0;
+  xfree (value);
+
+  for (line = buffer; *line; line = endline)
+    {
+      endline = strchr (line, '\n');
+      if (endline)
+        *endline++ = 0;
+      else
+        endline = line + strlen (line);
+      trim_trailing_spaces (line);
+      if (!*line)
+        continue;
+
+      /* A line consists of the keygrip, the arguments to SETHASH
+         and an optional description as used with SETKEYDESC.  */
+      p = strchr (line, ' ');
+      if (!p)
+        {
+          rc = set_error (GPG_ERR_ASS_PARAMETER, "invalid signlist line");
+          break;
+        }
+      *p++ = 0;
+      rc = parse_keygrip (ctx, line, ctrl->keygrip);
+      if (rc)
+        break;
+      ctrl->have_keygrip = 1;
+
+      desc = strchr (p, ' ');
+      if (desc)
+        desc = strchr (desc + 1, ' ');
+      if (desc)
+        {
+          *desc++ = 0;
+          plus_to_blank (desc);
+        }
+      rc = cmd_sethash (ctx, p);
+      if (rc)
+        break;
+
+      rc = agent_pksign (ctrl, desc, outbuf, cache_mode);
+      if (rc)
+        break;
+      count++;
+    }
+  if (!rc && !count)
+    rc = set_error (GPG_ERR_NO_DATA, "empty signlist");
+
+  ctrl->have_keygrip = 0;
+  xfree (buffer);
+  return rc;
+}
+
+
 static const char hlp_pksign[] =
-  "PKSIGN [options]\n"
+  "PKSIGN [--multi]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --multi several signatures are created by one command.  The\n"
+  "keys and hashes are inquired using the keyword SIGNLIST; each line\n"
+  "of that data has the form\n"
+  "\n"
+  "  <hexkeygrip> <algo> <hexdigest> [<keydesc>]\n"
+  "\n"
+  "where ALGO and HEXDIGEST are as with SETHASH and KEYDESC is as\n"
+  "with SETKEYDESC.  The returned data is the concatenation of the\n"
+  "signatures in the order of the lines.  Afterwards a key needs to\n"
+  "be set again with SIGKEY.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -681,8 +786,6 @@ cmd_pksign (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   membuf_t outbuf;
 
-  (void)line;
-
   if (opt.ignore_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
   else if (!ctrl->server_local->use_cache_for_signing)
@@ -690,8 +793,11 @@ cmd_pksign (assuan_context_t ctx, char *line)
 
   init_membuf (&outbuf, 512);
 
-  rc = agent_pksign (ctrl, ctrl->server_local->keydesc,
-                     &outbuf, cache_mode);
+  if (has_option (line, "--multi"))
+    rc = pksign_multi (ctx, ctrl, cache_mode, &outbuf);
+  else
+    rc = agent_pksign (ctrl, ctrl->server_local->keydesc,
+                       &outbuf, cache_mode);
   if (rc)
     clear_outbuf (&outbuf);
   else
@@ -1787,6 +1893,7 @@ static const char hlp_getinfo[] =
   "  scd_running - Return OK if the SCdaemon is already running.\n"
   "  std_session_env - List the standard session environment.\n"
   "  std_startup_env - List the standard startup environment.\n"
+  "  cache_stats - Return statistics about the passphrase cache.\n"
   "  cmd_has_option\n"
   "              - Returns OK if the command CMD implements the option OPT.";
 static gpg_error_t
@@ -1836,6 +1943,18 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%lu", get_standard_s2k_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char buf[200];
+      unsigned int items, passphrases, keys;
+      unsigned long hits, misses;
+
+      agent_cache_stats (&items, &passphrases, &keys, &hits, &misses);
+      snprintf (buf, sizeof buf,
+                "items=%u passphrases=%u keys=%u hits=%lu misses=%lu",
+                items, passphrases, keys, hits, misses);
+      rc = assuan_send_data (ctx, buf, strlen (buf));
+    }
   else if (!strcmp (line, "std_session_env")
            || !strcmp (line, "std_startup_env"))
     {
@@ -2020,6 +2139,11 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "repeat"))
           return 1;
     }
+  else if (!strcmp (cmd, "PKSIGN"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+          return 1;
+    }
 
   return 0;
 }
@@ -63,6 +63,7 @@ agent_write_private_key (const unsigned char *grip,
   int fd;
 
   bin2hex (grip, 20, hexgrip);
+  agent_forget_cache_skey (hexgrip);
   strcpy (hexgrip+40, ".key");
 
   fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
@@ -438,11 +439,32 @@ unprotect (ctrl_t ctrl, const char *desc_text,
 }
 
 
+/* Store information about the key file for GRIP at R_ST.  Returns 0
+   on success.  */
+static int
+stat_key_file (const unsigned char *grip, struct stat *r_st)
+{
+  char *fname;
+  char hexgrip[40+4+1];
+  int rc;
+
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+
+  fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
+  rc = stat (fname, r_st);
+  xfree (fname);
+  return rc;
+}
+
+
 /* Read the key identified by GRIP from the private key directory and
    return it as an gcrypt S-expression object in RESULT.  On failure
-   returns an error code and stores NULL at RESULT. */
+   returns an error code and stores NULL at RESULT.  If R_ST is not
+   NULL, information about the file is stored there. */
 static gpg_error_t
-read_key_file (const unsigned char *grip, gcry_sexp_t *result)
+read_key_file (const unsigned char *grip, gcry_sexp_t *result,
+               struct stat *r_st)
 {
   int rc;
   char *fname;
@@ -489,6 +511,8 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
       xfree (buf);
       return rc;
     }
+  if (r_st)
+    *r_st = st;
 
   /* Convert the file into a gcrypt S-expression object.  */
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
@@ -527,12 +551,23 @@ agent_key_from_file (ctrl_t ctrl, const char *desc_text,
   size_t len, buflen, erroff;
   gcry_sexp_t s_skey;
   int got_shadow_info = 0;
+  int was_protected = 0;
+  char hexgrip[40+1];
+  struct stat st;
 
   *result = NULL;
   if (shadow_info)
     *shadow_info = NULL;
 
-  rc = read_key_file (grip, &s_skey);
+  /* With --cache-private-keys a protected key may already be
+     available in unprotected form.  */
+  bin2hex (grip, 20, hexgrip);
+  if (opt.cache_private_keys && cache_mode != CACHE_MODE_IGNORE
+      && !stat_key_file (grip, &st)
+      && agent_get_cache_skey (hexgrip, cache_mode, &st, result))
+    return 0;
+
+  rc = read_key_file (grip, &s_skey, &st);
   if (rc)
     return rc;
 
@@ -577,6 +612,8 @@ agent_key_from_file (ctrl_t ctrl, const char *desc_text,
 	    if (rc)
 	      log_error ("failed to unprotect the secret key: %s\n",
 			 gpg_strerror (rc));
+            else
+              was_protected = 1;
 	  }
 
 	xfree (desc_text_final);
@@ -624,6 +661,8 @@ agent_key_from_file (ctrl_t ctrl, const char *desc_text,
 
   buflen = gcry_sexp_canon_len (buf, 0, NULL, NULL);
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+  if (!rc && was_protected && cache_mode != CACHE_MODE_IGNORE)
+    agent_put_cache_skey (hexgrip, buf, buflen, &st);
   wipememory (buf, buflen);
   xfree (buf);
   if (rc)
@@ -653,7 +692,7 @@ agent_raw_key_from_file (ctrl_t ctrl, const unsigned char *grip,
 
   *result = NULL;
 
-  err = read_key_file (grip, &s_skey);
+  err = read_key_file (grip, &s_skey, NULL);
   if (!err)
     *result = s_skey;
   return err;
@@ -690,7 +729,7 @@ agent_public_key_from_file (ctrl_t ctrl,
 
   *result = NULL;
 
-  rc = read_key_file (grip, &s_skey);
+  rc = read_key_file (grip, &s_skey, NULL);
   if (rc)
     return rc;
 
@@ -897,7 +936,7 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   {
     gcry_sexp_t sexp;
 
-    err = read_key_file (grip, &sexp);
+    err = read_key_file (grip, &sexp, NULL);
     if (err)
       {
         if (gpg_err_code (err) == GPG_ERR_ENOENT)
@@ -355,7 +355,12 @@ agent_genkey (ctrl_t ctrl, const char *keyparam, size_t keyparamlen,
       }
   }
 
-  rc = gcry_pk_genkey (&s_key, s_keyparam );
+  rc = agent_crypto_op_begin ();
+  if (!rc)
+    {
+      rc = gcry_pk_genkey (&s_key, s_keyparam );
+      agent_crypto_op_end ();
+    }
   gcry_sexp_release (s_keyparam);
   if (rc)
     {
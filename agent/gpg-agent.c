@@ -100,12 +100,14 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oCachePrivateKeys,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
   oCheckPassphrasePattern,
   oMaxPassphraseDays,
   oEnablePassphraseHistory,
+  oMaxCryptoOps,
   oUseStandardSocket,
   oNoUseStandardSocket,
   oFakedSystemTime,
@@ -175,6 +177,7 @@ static ARGPARSE_OPTS opts[] = {
   { oDefCacheTTLSSH, "default-cache-ttl-ssh", 4, "@" },
   { oMaxCacheTTL, "max-cache-ttl", 4, "@" },
   { oMaxCacheTTLSSH, "max-cache-ttl-ssh", 4, "@" },
+  { oCachePrivateKeys, "cache-private-keys", 0, "@" },
 
   { oEnforcePassphraseConstraints, "enforce-passphrase-constraints", 0, "@"},
   { oMinPassphraseLen, "min-passphrase-len", 4, "@" },
@@ -182,6 +185,7 @@ static ARGPARSE_OPTS opts[] = {
   { oCheckPassphrasePattern, "check-passphrase-pattern", 2, "@" },
   { oMaxPassphraseDays, "max-passphrase-days", 4, "@" },
   { oEnablePassphraseHistory, "enable-passphrase-history", 0, "@" },
+  { oMaxCryptoOps, "max-crypto-ops", 4, "@" },
 
   { oIgnoreCacheForSigning, "ignore-cache-for-signing", 0,
                                N_("do not use the PIN cache when signing")},
@@ -263,6 +267,12 @@ static char *socket_name_ssh;
 static assuan_sock_nonce_t socket_nonce;
 static assuan_sock_nonce_t socket_nonce_ssh;
 
+/* The number of private key operations currently running and the
+   lock and condition variable used to enforce --max-crypto-ops.  */
+static unsigned int crypto_ops_running;
+static pth_mutex_t crypto_ops_lock;
+static pth_cond_t crypto_ops_cond;
+
 
 /* Default values for options passed to the pinentry. */
 static char *default_display;
@@ -500,12 +510,14 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.cache_private_keys = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
       opt.check_passphrase_pattern = NULL;
       opt.max_passphrase_days = MAX_PASSPHRASE_DAYS;
       opt.enable_passhrase_history = 0;
+      opt.max_crypto_ops = 0;
       opt.ignore_cache_for_signing = 0;
       opt.allow_mark_trusted = 1;
       opt.disable_scdaemon = 0;
@@ -546,6 +558,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oCachePrivateKeys: opt.cache_private_keys = 1; break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -563,6 +576,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oEnablePassphraseHistory:
       opt.enable_passhrase_history = 1;
       break;
+    case oMaxCryptoOps: opt.max_crypto_ops = pargs->r.ret_ulong; break;
 
     case oIgnoreCacheForSigning: opt.ignore_cache_for_signing = 1; break;
 
@@ -903,6 +917,8 @@ main (int argc, char **argv )
   initialize_module_call_pinentry ();
   initialize_module_call_scd ();
   initialize_module_trustlist ();
+  if (!pth_mutex_init (&crypto_ops_lock) || !pth_cond_init (&crypto_ops_cond))
+    log_fatal ("error initializing the crypto ops lock\n");
 
   /* Try to create missing directories. */
   create_directories ();
@@ -949,6 +965,8 @@ main (int argc, char **argv )
               GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, MAX_CACHE_TTL );
       printf ("max-cache-ttl-ssh:%lu:%d:\n",
               GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, MAX_CACHE_TTL_SSH );
+      printf ("cache-private-keys:%lu:\n",
+              GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
       printf ("enforce-passphrase-constraints:%lu:\n",
               GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
       printf ("min-passphrase-len:%lu:%d:\n",
@@ -963,6 +981,8 @@ main (int argc, char **argv )
               MAX_PASSPHRASE_DAYS);
       printf ("enable-passphrase-history:%lu:\n",
               GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      printf ("max-crypto-ops:%lu:0:\n",
+              GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME);
       printf ("no-grab:%lu:\n",
               GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
       printf ("ignore-cache-for-signing:%lu:\n",
@@ -1485,6 +1505,57 @@ get_agent_scd_notify_event (void)
 #endif /*HAVE_W32_SYSTEM*/
 
 
+/* Enter a private key operation.  If --max-crypto-ops operations are
+   already running, this waits until one of them has finished.  Our
+   threads are not preemptive; thus before returning we yield once so
+   that pending requests of other connections are served before this
+   thread spends a long time in the computation.  On success the
+   caller needs to call agent_crypto_op_end when done.  */
+gpg_error_t
+agent_crypto_op_begin (void)
+{
+  if (!pth_mutex_acquire (&crypto_ops_lock, 0, NULL))
+    {
+      log_error ("failed to acquire the crypto ops lock\n");
+      return gpg_error (GPG_ERR_INTERNAL);
+    }
+  while (opt.max_crypto_ops && crypto_ops_running >= opt.max_crypto_ops)
+    {
+      if (opt.verbose > 1)
+        log_info ("waiting for one of %u crypto ops to finish\n",
+                  crypto_ops_running);
+      if (!pth_cond_await (&crypto_ops_cond, &crypto_ops_lock, NULL))
+        {
+          pth_mutex_release (&crypto_ops_lock);
+          log_error ("failed to wait for the crypto ops lock\n");
+          return gpg_error (GPG_ERR_INTERNAL);
+        }
+    }
+  crypto_ops_running++;
+  pth_mutex_release (&crypto_ops_lock);
+
+  pth_yield (NULL);
+  return 0;
+}
+
+
+/* Leave a private key operation started by agent_crypto_op_begin
+   and wake up the next waiting thread.  */
+void
+agent_crypto_op_end (void)
+{
+  if (!pth_mutex_acquire (&crypto_ops_lock, 0, NULL))
+    {
+      log_error ("failed to acquire the crypto ops lock\n");
+      return;
+    }
+  if (crypto_ops_running)
+    crypto_ops_running--;
+  pth_cond_notify (&crypto_ops_cond, FALSE);
+  pth_mutex_release (&crypto_ops_lock);
+}
+
+
 
 /* Create a name for the socket.  With USE_STANDARD_SOCKET given as
    true using STANDARD_NAME in the home directory or if given as
@@ -1784,6 +1855,8 @@ handle_signal (int signo)
       pth_ctrl (PTH_CTRL_DUMPSTATE, log_get_stream ());
       agent_query_dump_state ();
       agent_scd_dump_state ();
+      log_info ("crypto ops running: %u (limit %u)\n",
+                crypto_ops_running, opt.max_crypto_ops);
       break;
 
     case SIGUSR2:
@@ -47,10 +47,13 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
   if (!ctrl->have_keygrip)
     {
       log_error ("speculative decryption not yet supported\n");
-      rc = gpg_error (GPG_ERR_NO_SECKEY);
-      goto leave;
+      return gpg_error (GPG_ERR_NO_SECKEY);
     }
 
+  rc = agent_crypto_op_begin ();
+  if (rc)
+    return rc;
+
   rc = gcry_sexp_sscan (&s_cipher, NULL, (char*)ciphertext, ciphertextlen);
   if (rc)
     {
@@ -145,6 +148,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
   gcry_sexp_release (s_cipher);
   xfree (buf);
   xfree (shadow_info);
+  agent_crypto_op_end ();
   return rc;
 }
 
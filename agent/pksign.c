@@ -139,6 +139,10 @@ agent_pksign_do (ctrl_t ctrl, const char *desc_text,
   if (! ctrl->have_keygrip)
     return gpg_error (GPG_ERR_NO_SECKEY);
 
+  rc = agent_crypto_op_begin ();
+  if (rc)
+    return rc;
+
   rc = agent_key_from_file (ctrl, desc_text, ctrl->keygrip,
                             &shadow_info, cache_mode, lookup_ttl,
                             &s_skey);
@@ -226,6 +230,7 @@ agent_pksign_do (ctrl_t ctrl, const char *desc_text,
 
   gcry_sexp_release (s_skey);
   xfree (shadow_info);
+  agent_crypto_op_end ();
 
   return rc;
 }
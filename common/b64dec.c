@@ -104,6 +104,22 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
 
   for (s=d=buffer; length && !state->stop_seen; length--, s++)
     {
+      if (ds == s_b64_0 && length >= 4)
+        {
+          /* Fast path: decode complete groups in one go.  This stops
+             at the first white space or special character which is
+             then handled below.  */
+          size_t used;
+
+          d += radix64_decode_block (d, s, length, &used);
+          if (used)
+            {
+              s += used - 1;
+              length -= used - 1;
+              continue;
+            }
+        }
+
       switch (ds)
         {
         case s_idle:
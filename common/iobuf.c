@@ -46,7 +46,8 @@
 
 /*-- Begin configurable part.  --*/
 
-/* The size of the internal buffers.
+/* The default size of the internal buffers.  This may be changed at
+   runtime using iobuf_set_buffer_size.
    NOTE: If you change this value you MUST also adjust the regression
    test "armored_key_8192" in armor.test! */
 #define IOBUF_BUFFER_SIZE  8192
@@ -183,6 +184,9 @@ typedef struct
 block_filter_ctx_t;
 
 
+/* The size of the buffers allocated for new file and stream iobufs.  */
+static size_t iobuf_buffer_size = IOBUF_BUFFER_SIZE;
+
 /* Global flag to tell whether special file names are enabled.  See
    gpg.c for an explanation of these file names.  FIXME: it does not
    belong into the iobuf subsystem. */
@@ -464,6 +468,13 @@ fd_cache_open (const char *fname, const char *mode)
  * IOBUFCTRL_FLUSH: called by iobuf_flush() to write out the collected stuff.
  *		    *RET_LAN is the number of bytes in BUF.
  *
+ * The buffer passed with IOBUFCTRL_UNDERFLOW and IOBUFCTRL_FLUSH is not
+ * necessarily the buffer of the iobuf: iobuf_read may hand the
+ * caller's buffer down to be filled directly and iobuf_write_pass may
+ * hand the caller's buffer down to be written directly.  The filter
+ * owns the buffer for the duration of the call and may modify it in
+ * place; it must not keep a reference to it.
+ *
  * IOBUFCTRL_CANCEL: send to all filters on behalf of iobuf_cancel.  The
  *		    filter may take appropriate action on this message.
  */
@@ -960,11 +971,15 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 		  iobuf_put (chain, c);
 		  if ((n = a->buflen))
 		    {		/* write stuff from the buffer */
-		      assert (n == OP_MIN_PARTIAL_CHUNK);
+		      /* The buffer may hold less than a minimal chunk if
+		         we got a short flush; the rest of the block is
+		         then taken from BUF.  */
+		      assert (n <= OP_MIN_PARTIAL_CHUNK && n <= blen);
 		      if (iobuf_write (chain, a->buffer, n))
 			rc = gpg_error_from_syserror ();
 		      a->buflen = 0;
 		      nbytes -= n;
+		      blen -= n;
 		    }
 		  if ((n = nbytes) > blen)
 		    n = blen;
@@ -1237,6 +1252,30 @@ iobuf_enable_special_filenames (int yes)
 }
 
 
+/* Set the size of the buffers used for iobufs opened from now on to
+   KILOBYTE.  Filters pushed on an iobuf inherit its buffer size, thus
+   a larger value reduces the number of filter calls for bulk data.
+   Returns 0 on success or -1 if KILOBYTE is not in the range
+   IOBUF_MIN_BUFFER_KB to IOBUF_MAX_BUFFER_KB; the size is then not
+   changed.  */
+int
+iobuf_set_buffer_size (unsigned long kilobyte)
+{
+  if (kilobyte < IOBUF_MIN_BUFFER_KB || kilobyte > IOBUF_MAX_BUFFER_KB)
+    return -1;
+  iobuf_buffer_size = (size_t)kilobyte * 1024;
+  return 0;
+}
+
+
+/* Return the size in bytes of the buffers used for new iobufs.  */
+size_t
+iobuf_get_buffer_size (void)
+{
+  return iobuf_buffer_size;
+}
+
+
 /* See whether the filename has the form "-&nnnn", where n is a
    non-zero number.  Returns this number or -1 if it is not the
    case.  */
@@ -1320,7 +1359,7 @@ iobuf_open (const char *fname)
     return iobuf_fdopen (translate_file_handle (fd, 0), "rb");
   else if ((fp = my_fopen_ro (fname, "rb")) == INVALID_FP)
     return NULL;
-  a = iobuf_alloc (1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (1, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1356,7 +1395,7 @@ iobuf_fdopen (int fd, const char *mode)
 #else
   fp = (fp_or_fd_t) fd;
 #endif
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1380,7 +1419,7 @@ iobuf_sockopen (int fd, const char *mode)
   sock_filter_ctx_t *scx;
   size_t len;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, iobuf_buffer_size);
   scx = xmalloc (sizeof *scx + 25);
   scx->sock = fd;
   scx->print_only_name = 1;
@@ -1424,7 +1463,7 @@ iobuf_create (const char *fname)
     return iobuf_fdopen (translate_file_handle (fd, 1), "wb");
   else if ((fp = my_fopen (fname, "wb")) == INVALID_FP)
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1460,7 +1499,7 @@ iobuf_append (const char *fname)
     return NULL;
   else if (!(fp = my_fopen (fname, "ab")))
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, iobuf_buffer_size);
   fcx = m_alloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   strcpy (fcx->fname, fname);
@@ -1489,7 +1528,7 @@ iobuf_openrw (const char *fname)
     return NULL;
   else if ((fp = my_fopen (fname, "r+b")) == INVALID_FP)
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   strcpy (fcx->fname, fname);
@@ -1773,11 +1812,12 @@ pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
 
 
 /****************
- * read underflow: read more bytes into the buffer and return
- * the first byte or -1 on EOF.
+ * Read up to SIZE bytes from the filter of A into BUF, which is either
+ * the buffer of A or a buffer handed over by the caller.  Returns the
+ * number of bytes read or -1 on EOF.
  */
 static int
-underflow (iobuf_t a)
+underflow_into (iobuf_t a, byte *buf, size_t size)
 {
   size_t len;
   int rc;
@@ -1818,26 +1858,24 @@ underflow (iobuf_t a)
     {
       FILE *fp = a->directfp;
 
-      len = fread (a->d.buf, 1, a->d.size, fp);
-      if (len < a->d.size)
+      len = fread (buf, 1, size, fp);
+      if (len < size)
 	{
 	  if (ferror (fp))
 	    a->error = gpg_error_from_syserror ();
 	}
-      a->d.len = len;
-      a->d.start = 0;
-      return len ? a->d.buf[a->d.start++] : -1;
+      return len ? (int)len : -1;
     }
 
 
   if (a->filter)
     {
-      len = a->d.size;
+      len = size;
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: underflow: req=%lu\n",
 		   a->no, a->subno, (ulong) len);
       rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-		      a->d.buf, &len);
+		      buf, &len);
       if (DBG_IOBUF)
 	{
 	  log_debug ("iobuf-%d.%d: underflow: got=%lu rc=%d\n",
@@ -1884,9 +1922,7 @@ underflow (iobuf_t a)
 	    log_debug ("iobuf-%d.%d: underflow: eof\n", a->no, a->subno);
 	  return -1;
 	}
-      a->d.len = len;
-      a->d.start = 0;
-      return a->d.buf[a->d.start++];
+      return (int)len;
     }
   else
     {
@@ -1898,6 +1934,24 @@ underflow (iobuf_t a)
 }
 
 
+/****************
+ * read underflow: read more bytes into the buffer and return
+ * the first byte or -1 on EOF.
+ */
+static int
+underflow (iobuf_t a)
+{
+  int len;
+
+  len = underflow_into (a, a->d.buf, a->d.size);
+  if (len == -1)
+    return -1;
+  a->d.len = len;
+  a->d.start = 0;
+  return a->d.buf[a->d.start++];
+}
+
+
 int
 iobuf_flush (iobuf_t a)
 {
@@ -1910,7 +1964,12 @@ iobuf_flush (iobuf_t a)
   if (a->use == 3)
     {				/* increase the temp buffer */
       unsigned char *newbuf;
-      size_t newsize = a->d.size + IOBUF_BUFFER_SIZE;
+      size_t newsize;
+
+      /* Grow geometrically so that building a large message in
+         memory does not copy the buffer over and over.  */
+      newsize = a->d.size < IOBUF_BUFFER_SIZE? IOBUF_BUFFER_SIZE
+                                             : 2 * a->d.size;
 
       if (DBG_IOBUF)
 	log_debug ("increasing temp iobuf from %lu to %lu\n",
@@ -2004,7 +2063,24 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 	  if (buf)
 	    buf += size;
 	}
-      if (n < buflen)
+      if (n < buflen && buf && a->use == 1
+          && a->d.start == a->d.len && buflen - n >= a->d.size / 2)
+	{
+          /* Enough room left in the caller's buffer; let the filter
+             fill it directly instead of copying from our buffer.  */
+	  size_t size = buflen - n;
+
+	  if (size > a->d.size)
+	    size = a->d.size;
+	  if ((c = underflow_into (a, buf, size)) == -1)
+	    {
+	      a->nbytes += n;
+	      return n ? n : -1 /*EOF*/;
+	    }
+	  n += c;
+	  buf += c;
+	}
+      else if (n < buflen)
 	{
 	  if ((c = underflow (a)) == -1)
 	    {
@@ -2103,6 +2179,59 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 }
 
 
+/****************
+ * Write BUFLEN bytes from BUFFER to A like iobuf_write but hand BUFFER
+ * directly to the filter of A instead of copying it to the buffer of
+ * A.  This is done in chunks of the buffer size of A; a remaining
+ * tail is copied.  The caller gives up the content of BUFFER; the
+ * filters may modify it in place.  Thus this function should be used
+ * for scratch buffers, for example by filters writing out the
+ * buffer they got with IOBUFCTRL_FLUSH.
+ */
+int
+iobuf_write_pass (iobuf_t a, void *buffer, unsigned int buflen)
+{
+  byte *buf = buffer;
+  size_t len;
+  int rc;
+
+  if (a->directfp)
+    BUG ();
+
+  if (a->use != 2 || !a->filter)
+    return iobuf_write (a, buffer, buflen);
+
+  while (buflen >= a->d.size)
+    {
+      /* Flush pending data first to keep the order.  This may yield
+         a short write but re-aligns the stream, so that all
+         following chunks can be handed down.  */
+      if (a->d.len && (rc = iobuf_flush (a)))
+        return rc;
+
+      len = a->d.size;
+      if (DBG_IOBUF)
+        log_debug ("iobuf-%d.%d: pass %lu bytes\n",
+                   a->no, a->subno, (ulong)len);
+      rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, buf, &len);
+      if (!rc && len != a->d.size)
+        {
+          log_info ("iobuf_write_pass did not write all!\n");
+          rc = GPG_ERR_INTERNAL;
+        }
+      if (rc)
+        {
+          a->error = rc;
+          return rc;
+        }
+      buf += a->d.size;
+      buflen -= a->d.size;
+    }
+
+  return buflen? iobuf_write (a, buf, buflen) : 0;
+}
+
+
 int
 iobuf_writestr (iobuf_t a, const char *buf)
 {
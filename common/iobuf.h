@@ -80,7 +80,14 @@ struct iobuf_struct
 #endif
 EXTERN_UNLESS_MAIN_MODULE int iobuf_debug_mode;
 
+/* The limits for iobuf_set_buffer_size in kilobytes.  They are
+   documented with the option --iobuf-size in doc/gpg.texi.  */
+#define IOBUF_MIN_BUFFER_KB  4
+#define IOBUF_MAX_BUFFER_KB  (16*1024)
+
 void iobuf_enable_special_filenames (int yes);
+int iobuf_set_buffer_size (unsigned long kilobyte);
+size_t iobuf_get_buffer_size (void);
 int  iobuf_is_pipe_filename (const char *fname);
 iobuf_t iobuf_alloc (int use, size_t bufsize);
 iobuf_t iobuf_temp (void);
@@ -120,6 +127,7 @@ unsigned iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
 int iobuf_peek (iobuf_t a, byte * buf, unsigned buflen);
 int iobuf_writebyte (iobuf_t a, unsigned c);
 int iobuf_write (iobuf_t a, const void *buf, unsigned buflen);
+int iobuf_write_pass (iobuf_t a, void *buf, unsigned buflen);
 int iobuf_writestr (iobuf_t a, const char *buf);
 
 void iobuf_flush_temp (iobuf_t temp);
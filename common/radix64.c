@@ -0,0 +1,180 @@
+/* radix64.c - Table driven radix-64 and CRC-24 helpers.
+ * Copyright (C) 2014 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* These functions are the bulk paths used by the armor filter of gpg
+   and the base-64 encoders and decoders of gpgsm and the common code.
+   The callers still handle line breaks, padding and partial groups
+   on their own; the functions here only convert runs of complete
+   groups.
+
+   The CRC-24 is computed four bytes at a time ("slicing-by-4") and
+   the radix-64 conversion uses tables which translate 12 bits to two
+   characters on encoding and a full group of 4 characters to 24 bits
+   with a single combined validity check on decoding.  All tables are
+   built on first use.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define CRC24_POLY 0x1864CFB
+
+/* Flag used in the decode tables to mark an invalid character.  */
+#define BADCHAR 0x01000000
+
+static const char bintoasc[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "abcdefghijklmnopqrstuvwxyz"
+                                 "0123456789+/";
+
+static u32 crc_table[4][256];
+static char enc_table[4096][2];
+static u32 dec_table[4][256];
+static int initialized;
+
+
+static void
+initialize (void)
+{
+  int i, j;
+  u32 c;
+
+  for (i=0; i < 256; i++)
+    {
+      c = (u32)i << 16;
+      for (j=0; j < 8; j++)
+        {
+          c <<= 1;
+          if ((c & 0x1000000))
+            c ^= CRC24_POLY;
+        }
+      crc_table[0][i] = c & 0x00ffffff;
+    }
+  /* crc_table[k][i] is the CRC of byte I followed by K zero bytes.  */
+  for (j=1; j < 4; j++)
+    for (i=0; i < 256; i++)
+      {
+        c = crc_table[j-1][i];
+        crc_table[j][i] = (((c << 8) ^ crc_table[0][(c >> 16) & 0xff])
+                           & 0x00ffffff);
+      }
+
+  for (i=0; i < 4096; i++)
+    {
+      enc_table[i][0] = bintoasc[i >> 6];
+      enc_table[i][1] = bintoasc[i & 077];
+    }
+
+  for (j=0; j < 4; j++)
+    for (i=0; i < 256; i++)
+      dec_table[j][i] = BADCHAR;
+  for (i=0; i < 64; i++)
+    {
+      j = (unsigned char)bintoasc[i];
+      dec_table[0][j] = (u32)i << 18;
+      dec_table[1][j] = (u32)i << 12;
+      dec_table[2][j] = (u32)i << 6;
+      dec_table[3][j] = (u32)i;
+    }
+
+  initialized = 1;
+}
+
+
+/* Update the OpenPGP CRC-24 value CRC with LENGTH bytes from BUFFER
+   and return the new value.  Start with CRC24_INIT.  */
+u32
+crc24_update (u32 crc, const void *buffer, size_t length)
+{
+  const unsigned char *p = buffer;
+
+  if (!initialized)
+    initialize ();
+
+  crc &= 0x00ffffff;
+  for (; length >= 4; p += 4, length -= 4)
+    crc = (crc_table[3][((crc >> 16) & 0xff) ^ p[0]]
+           ^ crc_table[2][((crc >> 8) & 0xff) ^ p[1]]
+           ^ crc_table[1][(crc & 0xff) ^ p[2]]
+           ^ crc_table[0][p[3]]);
+  for (; length; p++, length--)
+    crc = (((crc << 8) ^ crc_table[0][((crc >> 16) & 0xff) ^ *p])
+           & 0x00ffffff);
+  return crc;
+}
+
+
+/* Encode NGROUPS groups of 3 bytes from BUFFER into 4 * NGROUPS
+   radix-64 characters at RESULT.  RESULT is not terminated.  Returns
+   the number of characters stored.  */
+size_t
+radix64_encode_block (char *result, const void *buffer, size_t ngroups)
+{
+  const unsigned char *s = buffer;
+  char *d = result;
+  u32 v;
+
+  if (!initialized)
+    initialize ();
+
+  for (; ngroups; ngroups--, s += 3, d += 4)
+    {
+      v = ((u32)s[0] << 16) | ((u32)s[1] << 8) | s[2];
+      d[0] = enc_table[v >> 12][0];
+      d[1] = enc_table[v >> 12][1];
+      d[2] = enc_table[v & 0xfff][0];
+      d[3] = enc_table[v & 0xfff][1];
+    }
+  return d - result;
+}
+
+
+/* Decode complete groups of 4 radix-64 characters from the LENGTH
+   bytes at BUFFER into RESULT.  Decoding stops at the first group
+   which contains a character not in the radix-64 alphabet, including
+   white space and the pad character, so that the caller can deal
+   with it.  The number of characters consumed is stored at R_USED
+   and the number of bytes stored at RESULT is returned.  RESULT may
+   be the same as BUFFER.  */
+size_t
+radix64_decode_block (void *result, const void *buffer, size_t length,
+                      size_t *r_used)
+{
+  const unsigned char *s = buffer;
+  unsigned char *d = result;
+  u32 v;
+
+  if (!initialized)
+    initialize ();
+
+  for (; length >= 4; s += 4, length -= 4, d += 3)
+    {
+      v = (dec_table[0][s[0]] | dec_table[1][s[1]]
+           | dec_table[2][s[2]] | dec_table[3][s[3]]);
+      if ((v & BADCHAR))
+        break;
+      d[0] = v >> 16;
+      d[1] = v >> 8;
+      d[2] = v;
+    }
+  *r_used = s - (const unsigned char *)buffer;
+  return d - (unsigned char *)result;
+}
@@ -0,0 +1,151 @@
+/* t-radix64.c - Module test for radix64.c
+ *	Copyright (C) 2014 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (int)(a));     \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* The bitwise CRC-24 from RFC-4880, section 6.1.  */
+static u32
+crc24_reference (const unsigned char *octets, size_t len)
+{
+  u32 crc = CRC24_INIT;
+  int i;
+
+  while (len--)
+    {
+      crc ^= (*octets++) << 16;
+      for (i = 0; i < 8; i++)
+        {
+          crc <<= 1;
+          if (crc & 0x1000000)
+            crc ^= 0x1864CFB;
+        }
+    }
+  return crc & 0xFFFFFFL;
+}
+
+
+static void
+test_crc24 (void)
+{
+  unsigned char buffer[1000];
+  size_t i, n;
+  u32 crc;
+
+  for (i=0; i < sizeof buffer; i++)
+    buffer[i] = (i * 7 + (i >> 3)) & 0xff;
+
+  for (n=0; n < 40; n++)
+    if (crc24_update (CRC24_INIT, buffer, n) != crc24_reference (buffer, n))
+      fail (n);
+
+  /* Feeding the data in pieces must give the same result.  */
+  crc = CRC24_INIT;
+  for (i=0, n=1; i < sizeof buffer; i += n, n = (n % 9) + 1)
+    crc = crc24_update (crc, buffer + i,
+                        i + n > sizeof buffer? sizeof buffer - i : n);
+  if (crc != crc24_reference (buffer, sizeof buffer))
+    fail (0);
+}
+
+
+static void
+test_encode (void)
+{
+  static struct {
+    const char *data;
+    const char *expect;
+  } tbl[] = {
+    { "", "" },
+    { "foo", "Zm9v" },
+    { "foobar", "Zm9vYmFy" },
+    { "\xff\xfe\x00\x3e\x3f\x80", "//4APj+A" },
+    { NULL, NULL }
+  };
+  char result[20];
+  size_t n;
+  int idx;
+
+  for (idx=0; tbl[idx].data; idx++)
+    {
+      n = radix64_encode_block (result, tbl[idx].data,
+                                idx == 3? 2 : strlen (tbl[idx].data) / 3);
+      if (n != strlen (tbl[idx].expect)
+          || memcmp (result, tbl[idx].expect, n))
+        fail (idx);
+    }
+}
+
+
+static void
+test_decode (void)
+{
+  unsigned char result[20];
+  char buffer[20];
+  size_t n, used;
+
+  n = radix64_decode_block (result, "Zm9vYmFy", 8, &used);
+  if (n != 6 || used != 8 || memcmp (result, "foobar", 6))
+    fail (1);
+
+  /* Stop at the first incomplete or invalid group.  */
+  n = radix64_decode_block (result, "Zm9vYmFyYg==", 12, &used);
+  if (n != 6 || used != 8)
+    fail (2);
+  n = radix64_decode_block (result, "Zm9vYm\nFy", 9, &used);
+  if (n != 3 || used != 4)
+    fail (3);
+  n = radix64_decode_block (result, "Zm9vYmF", 7, &used);
+  if (n != 3 || used != 4)
+    fail (4);
+  n = radix64_decode_block (result, "Zm\xe9vYmFy", 8, &used);
+  if (n || used)
+    fail (5);
+
+  /* Decoding in place.  */
+  strcpy (buffer, "//4APj+A");
+  n = radix64_decode_block (buffer, buffer, 8, &used);
+  if (n != 6 || used != 8 || memcmp (buffer, "\xff\xfe\x00\x3e\x3f\x80", 6))
+    fail (6);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_crc24 ();
+  test_encode ();
+  test_decode ();
+
+  return 0;
+}
@@ -157,6 +157,15 @@ ssize_t read_line (FILE *fp,
                    size_t *max_length);
 
 
+/*-- radix64.c --*/
+#define CRC24_INIT 0xB704CE
+u32 crc24_update (u32 crc, const void *buffer, size_t length);
+size_t radix64_encode_block (char *result, const void *buffer,
+                             size_t ngroups);
+size_t radix64_decode_block (void *result, const void *buffer,
+                             size_t length, size_t *r_used);
+
+
 /*-- b64enc.c and b64dec.c --*/
 struct b64state
 {
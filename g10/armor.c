@@ -39,13 +39,6 @@
 
 #define MAX_LINELEN 20000
 
-#define CRCINIT 0xB704CE
-#define CRCPOLY 0X864CFB
-#define CRCUPDATE(a,c) do {						    \
-			a = ((a) << 8) ^ crc_table[((a)&0xff >> 16) ^ (c)]; \
-			a &= 0x00ffffff;				    \
-		    } while(0)
-static u32 crc_table[256];
 static byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 			 "abcdefghijklmnopqrstuvwxyz"
 			 "0123456789+/";
@@ -163,25 +156,9 @@ push_armor_filter (armor_filter_context_t *afx, iobuf_t iobuf)
 static void
 initialize(void)
 {
-    int i, j;
-    u32 t;
+    int i;
     byte *s;
 
-    /* init the crc lookup table */
-    crc_table[0] = 0;
-    for(i=j=0; j < 128; j++ ) {
-	t = crc_table[j];
-	if( t & 0x00800000 ) {
-	    t <<= 1;
-	    crc_table[i++] = t ^ CRCPOLY;
-	    crc_table[i++] = t;
-	}
-	else {
-	    t <<= 1;
-	    crc_table[i++] = t;
-	    crc_table[i++] = t ^ CRCPOLY;
-	}
-    }
     /* build the helptable for radix64 to bin conversion */
     for(i=0; i < 256; i++ )
 	asctobin[i] = 255; /* used to detect invalid characters */
@@ -548,7 +525,7 @@ check_input( armor_filter_context_t *afx, IOBUF a )
 	afx->faked = 1;
     else {
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -724,7 +701,7 @@ fake_packet( armor_filter_context_t *afx, IOBUF a,
 	    }
 	}
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -753,7 +730,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     int checkcrc=0;
     int rc = 0;
     size_t n = 0;
-    int  idx, i, onlypad=0;
+    int  idx, onlypad=0;
     u32 crc;
 
     crc = afx->crc;
@@ -761,6 +738,23 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     val = afx->radbuf[0];
     for( n=0; n < size; ) {
 
+	if( !idx && size - n >= 3
+	    && afx->buffer_len - afx->buffer_pos >= 4 ) {
+	    /* Fast path: decode complete groups up to the next
+	     * special character in one go. */
+	    size_t avail = afx->buffer_len - afx->buffer_pos;
+	    size_t used;
+
+	    if( avail / 4 > (size - n) / 3 )
+		avail = (size - n) / 3 * 4;
+	    n += radix64_decode_block (buf + n,
+				       afx->buffer + afx->buffer_pos,
+				       avail, &used);
+	    afx->buffer_pos += used;
+	    if( used )
+		continue;
+	}
+
 	if( afx->buffer_pos < afx->buffer_len )
 	    c = afx->buffer[afx->buffer_pos++];
 	else { /* read the next line */
@@ -819,9 +813,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	idx = (idx+1) % 4;
     }
 
-    for(i=0; i < n; i++ )
-	crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-    crc &= 0x00ffffff;
+    crc = crc24_update (crc, buf, n);
     afx->crc = crc;
     afx->idx = idx;
     afx->radbuf[0] = val;
@@ -1130,7 +1122,7 @@ armor_filter( void *opaque, int control,
 	    afx->status++;
 	    afx->idx = 0;
 	    afx->idx2 = 0;
-	    afx->crc = CRCINIT;
+	    afx->crc = CRC24_INIT;
 
 	}
 	crc = afx->crc;
@@ -1139,28 +1131,38 @@ armor_filter( void *opaque, int control,
 	for(i=0; i < idx; i++ )
 	    radbuf[i] = afx->radbuf[i];
 
-	for(i=0; i < size; i++ )
-	    crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-	crc &= 0x00ffffff;
+	crc = crc24_update (crc, buf, size);
+
+	while( size ) {
+	    char line[64];
+	    size_t ngroups;
 
-	for( ; size; buf++, size-- ) {
-	    radbuf[idx++] = *buf;
-	    if( idx > 2 ) {
+	    if( idx || size < 3 ) {
+		/* Collect the bytes of an incomplete group.  */
+		radbuf[idx++] = *buf++;
+		size--;
+		if( idx < 3 )
+		    continue;
+		radix64_encode_block (line, radbuf, 1);
+		ngroups = 1;
 		idx = 0;
-		c = bintoasc[(*radbuf >> 2) & 077];
-		iobuf_put(a, c);
-		c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-		iobuf_put(a, c);
-		c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-		iobuf_put(a, c);
-		c = bintoasc[radbuf[2]&077];
-		iobuf_put(a, c);
-		if( ++idx2 >= (64/4) )
-		  { /* pgp doesn't like 72 here */
-		    iobuf_writestr(a,afx->eol);
-		    idx2=0;
-		  }
 	    }
+	    else {
+		/* Encode as much as fits on the current line.  */
+		ngroups = (64/4) - idx2;
+		if( ngroups > size / 3 )
+		    ngroups = size / 3;
+		radix64_encode_block (line, buf, ngroups);
+		buf += 3 * ngroups;
+		size -= 3 * ngroups;
+	    }
+	    iobuf_write (a, line, 4 * ngroups);
+	    idx2 += ngroups;
+	    if( idx2 >= (64/4) )
+	      { /* pgp doesn't like 72 here */
+		iobuf_writestr(a,afx->eol);
+		idx2=0;
+	      }
 	}
 	for(i=0; i < idx; i++ )
 	    afx->radbuf[i] = radbuf[i];
@@ -1403,7 +1405,7 @@ unarmor_pump (UnarmorPump x, int c)
         /* i.e. wait for one empty line */
         if ( c == '\n' ) {
             x->state = STA_read_data;
-            x->crc = CRCINIT;
+            x->crc = CRC24_INIT;
             x->val = 0;
             x->pos = 0;
         }
@@ -1504,8 +1506,9 @@ unarmor_pump (UnarmorPump x, int c)
     }
 
     if ( !(rval & ~255) ) { /* compute the CRC */
-        x->crc = (x->crc << 8) ^ crc_table[((x->crc >> 16)&0xff) ^ rval];
-        x->crc &= 0x00ffffff;
+        byte b = rval;
+
+        x->crc = crc24_update (x->crc, &b, 1);
     }
 
     return rval;
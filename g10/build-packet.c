@@ -520,7 +520,8 @@ do_plaintext( IOBUF out, int ctb, PKT_plaintext *pt )
 {
     int i, rc = 0;
     u32 n;
-    byte buf[1000]; /* this buffer has the plaintext! */
+    byte *buf; /* this buffer has the plaintext! */
+    size_t bufsize;
     int nbytes;
 
     write_header(out, ctb, calc_plaintext( pt ) );
@@ -532,14 +533,19 @@ do_plaintext( IOBUF out, int ctb, PKT_plaintext *pt )
     if (rc)
       return rc;
 
+    /* Use a buffer matching the iobuf size so that full blocks can
+       be passed down the filter chain without copying.  */
+    bufsize = iobuf_get_buffer_size ();
+    buf = xmalloc (bufsize);
     n = 0;
-    while( (nbytes=iobuf_read(pt->buf, buf, 1000)) != -1 ) {
-      rc = iobuf_write (out, buf, nbytes);
+    while( (nbytes=iobuf_read(pt->buf, buf, bufsize)) != -1 ) {
+      rc = iobuf_write_pass (out, buf, nbytes);
       if (rc)
         break;
       n += nbytes;
     }
-    wipememory(buf,1000); /* burn the buffer */
+    wipememory(buf,bufsize); /* burn the buffer */
+    xfree (buf);
     if( (ctb&0x40) && !pt->len )
       iobuf_set_partial_block_mode(out, 0 ); /* turn off partial */
     if( pt->len && n != pt->len )
@@ -1145,8 +1151,14 @@ do_signature( IOBUF out, int ctb, PKT_signature *sig )
   iobuf_put(a, sig->digest_start[0] );
   iobuf_put(a, sig->digest_start[1] );
   n = pubkey_get_nsig( sig->pubkey_algo );
-  if ( !n )
-    write_fake_data( a, sig->data[0] );
+  if ( !n || (sig->data[0]
+              && gcry_mpi_get_flag (sig->data[0], GCRYMPI_FLAG_OPAQUE)))
+    {
+      /* Unknown algorithm or values not yet decoded; see
+         parse_sig_data.  */
+      write_fake_data( a, sig->data[0] );
+      n = 0;
+    }
   for (i=0; i < n && !rc ; i++ )
     rc = mpi_write(a, sig->data[i] );
 
@@ -130,7 +130,7 @@ cipher_filter( void *opaque, int control,
 	if (cfx->mdc_hash)
 	    gcry_md_write (cfx->mdc_hash, buf, size);
 	gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
-	rc = iobuf_write( a, buf, size );
+	rc = iobuf_write_pass( a, buf, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( cfx->mdc_hash ) {
@@ -54,7 +54,7 @@ init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzCompressInit(bzs,level,0,0))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->outbufsize = 8192;
+  zfx->outbufsize = iobuf_get_buffer_size ();
   zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -85,7 +85,7 @@ do_compress(compress_filter_context_t *zfx, bz_stream *bzs, int flush, IOBUF a)
 		  (unsigned)bzs->avail_in, (unsigned)bzs->avail_out,
 		  (unsigned)n, zrc );
 
-      if( (rc=iobuf_write( a, zfx->outbuf, n )) )
+      if( (rc=iobuf_write_pass( a, zfx->outbuf, n )) )
 	{
 	  log_debug("bzCompress: iobuf_write failed\n");
 	  return rc;
@@ -104,7 +104,7 @@ init_uncompress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzDecompressInit(bzs,0,opt.bz2_decompress_lowmem))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->inbufsize = 2048;
+  zfx->inbufsize = iobuf_get_buffer_size ();
   zfx->inbuf = xmalloc( zfx->inbufsize );
   bzs->avail_in = 0;
 }
@@ -50,6 +50,12 @@
 #define BYTEF_CAST(a) (a)
 #endif
 
+/* With --compress-chunk-size a chunk saving less than 1/32 of its
+   size is considered incompressible.  The following chunks are then
+   stored and only every STORED_CHUNK_PROBE-th chunk is compressed
+   again to see whether the data has changed.  */
+#define STORED_CHUNK_PROBE 8
+
 
 
 int compress_filter_bz2( void *opaque, int control,
@@ -76,6 +82,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 	log_error("invalid compression level; using default level\n");
 	level = Z_DEFAULT_COMPRESSION;
     }
+    zfx->level = level;
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -87,7 +94,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->outbufsize = 8192;
+    zfx->outbufsize = iobuf_get_buffer_size ();
     zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -120,14 +127,86 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
 		(unsigned)zs->avail_in, (unsigned)zs->avail_out,
 					       (unsigned)n, zrc );
 
-	if( (rc=iobuf_write( a, zfx->outbuf, n )) ) {
+	if( (rc=iobuf_write_pass( a, zfx->outbuf, n )) ) {
 	    log_debug("deflate: iobuf_write failed\n");
 	    return rc;
 	}
-    } while( zs->avail_in || (flush == Z_FINISH && zrc != Z_STREAM_END) );
+    } while( zs->avail_in || (flush == Z_FINISH && zrc != Z_STREAM_END)
+	     || (flush == Z_FULL_FLUSH && !zs->avail_out) );
     return 0;
 }
 
+
+/* Finish the current chunk so that the next one can be decompressed
+ * without the history of this one and select the compression level
+ * for the next chunk.  */
+static int
+end_chunk( compress_filter_context_t *zfx, z_stream *zs, IOBUF a )
+{
+    int rc, zrc;
+    int level;
+    unsigned long nout;
+
+    rc = do_compress( zfx, zs, Z_FULL_FLUSH, a );
+    if( rc )
+	return rc;
+    nout = zs->total_out - zfx->chunk_out;
+
+    level = zfx->level;
+    if( zfx->chunk_stored ) {
+	if( ++zfx->chunk_stored == STORED_CHUNK_PROBE )
+	    zfx->chunk_stored = 0;
+	else
+	    level = 0;
+    }
+    else if( nout + nout/32 >= zfx->chunk_in ) {
+	level = 0;
+	zfx->chunk_stored = 1;
+    }
+
+    if( DBG_FILTER )
+	log_debug("deflate: chunk of %lu bytes compressed to %lu;"
+		  " next level %d\n", (ulong)zfx->chunk_in, nout, level );
+
+    /* This is a no-op if the level does not change.  */
+    zs->next_out = BYTEF_CAST (zfx->outbuf);
+    zs->avail_out = zfx->outbufsize;
+    zrc = deflateParams( zs, level, Z_DEFAULT_STRATEGY );
+    if( zrc != Z_OK )
+	log_fatal("zlib deflateParams problem: rc=%d\n", zrc );
+    rc = iobuf_write( a, zfx->outbuf, zfx->outbufsize - zs->avail_out );
+    zfx->chunk_in = 0;
+    zfx->chunk_out = zs->total_out;
+    return rc;
+}
+
+
+/* Compress the pending input in chunks of opt.compress_chunk_size
+ * bytes.  */
+static int
+do_compress_chunked( compress_filter_context_t *zfx, z_stream *zs, IOBUF a )
+{
+    int rc = 0;
+    Bytef *p = zs->next_in;
+    size_t left = zs->avail_in;
+    size_t n;
+
+    while( left && !rc ) {
+	n = opt.compress_chunk_size - zfx->chunk_in;
+	if( n > left )
+	    n = left;
+	zs->next_in = p;
+	zs->avail_in = n;
+	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	p += n;
+	left -= n;
+	zfx->chunk_in += n;
+	if( !rc && zfx->chunk_in == opt.compress_chunk_size )
+	    rc = end_chunk( zfx, zs, a );
+    }
+    return rc;
+}
+
 static void
 init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -151,7 +230,7 @@ init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->inbufsize = 2048;
+    zfx->inbufsize = iobuf_get_buffer_size ();
     zfx->inbuf = xmalloc( zfx->inbufsize );
     zs->avail_in = 0;
 }
@@ -260,7 +339,10 @@ compress_filter( void *opaque, int control,
 
 	zs->next_in = BYTEF_CAST (buf);
 	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( opt.compress_chunk_size )
+	    rc = do_compress_chunked( zfx, zs, a );
+	else
+	    rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
@@ -34,6 +34,7 @@
 #include "main.h"
 #include "i18n.h"
 #include "cipher.h" /* for progress functions */
+#include "membuf.h"
 
 #define CONTROL_D ('D' - 'A' + 1)
 
@@ -41,6 +42,12 @@
 
 static FILE *statusfp;
 
+/* If set, status lines are passed to this function instead of being
+   written to STATUSFP.  */
+static void (*status_cb) (void *opaque, const char *keyword,
+                          const char *args);
+static void *status_cb_value;
+
 
 static void
 progress_cb (void *ctx, const char *what, int printchar,
@@ -120,10 +127,23 @@ set_status_fd ( int fd )
     gcry_set_progress_handler ( progress_cb, NULL );
 }
 
+/* Divert all status lines to the function CB until this is called
+   again with CB set to NULL.  CB is called with OPAQUE, the keyword
+   of the status line and its arguments.  This is used by the server
+   mode to send the status lines to the client.  */
+void
+set_status_callback (void (*cb)(void *opaque, const char *keyword,
+                                const char *args),
+                     void *opaque)
+{
+  status_cb = cb;
+  status_cb_value = opaque;
+}
+
 int
 is_status_enabled()
 {
-    return !!statusfp;
+    return statusfp || status_cb;
 }
 
 void
@@ -141,9 +161,35 @@ write_status_strings (int no, const char *text, ...)
   va_list arg_ptr;
   const char *s;
 
-  if (!statusfp || !status_currently_allowed (no) )
+  if (!is_status_enabled () || !status_currently_allowed (no) )
     return;  /* Not enabled or allowed. */
 
+  if (status_cb)
+    {
+      membuf_t mb;
+      char *args;
+
+      init_membuf (&mb, 256);
+      va_start (arg_ptr, text);
+      for (s = text; s; s = va_arg (arg_ptr, const char*))
+        for (; *s; s++)
+          {
+            if (*s == '\n')
+              put_membuf_str (&mb, "\\n");
+            else if (*s == '\r')
+              put_membuf_str (&mb, "\\r");
+            else
+              put_membuf (&mb, s, 1);
+          }
+      va_end (arg_ptr);
+      put_membuf (&mb, "", 1);
+      args = get_membuf (&mb, NULL);
+      if (args)
+        status_cb (status_cb_value, get_status_string (no), args);
+      xfree (args);
+      return;
+    }
+
   fputs ("[GNUPG:] ", statusfp);
   fputs (get_status_string (no), statusfp);
   if ( text )
@@ -182,9 +228,18 @@ write_status_text (int no, const char *text)
 void
 write_status_error (const char *where, int errcode)
 {
-  if (!statusfp || !status_currently_allowed (STATUS_ERROR))
+  if (!is_status_enabled () || !status_currently_allowed (STATUS_ERROR))
     return;  /* Not enabled or allowed. */
 
+  if (status_cb)
+    {
+      char buf[50];
+
+      snprintf (buf, sizeof buf, "%u", gpg_err_code (errcode));
+      write_status_strings (STATUS_ERROR, where, " ", buf, NULL);
+      return;
+    }
+
   fprintf (statusfp, "[GNUPG:] %s %s %u\n",
            get_status_string (STATUS_ERROR), where, gpg_err_code (errcode));
   if (fflush (statusfp) && opt.exit_on_status_write_error)
@@ -207,7 +262,7 @@ write_status_text_and_buffer ( int no, const char *string,
     int lower_limit = ' ';
     size_t n, count, dowrap;
 
-    if( !statusfp || !status_currently_allowed (no) )
+    if( !is_status_enabled () || !status_currently_allowed (no) )
 	return;  /* Not enabled or allowed. */
 
     if (wrap == -1) {
@@ -215,6 +270,36 @@ write_status_text_and_buffer ( int no, const char *string,
         wrap = 0;
     }
 
+    if (status_cb) {
+        /* The status lines are not wrapped here; the callback is
+           expected to cope with long lines.  */
+        membuf_t mb;
+        char numbuf[5];
+        char *args;
+
+        init_membuf (&mb, len + 100);
+        if (string) {
+            put_membuf_str (&mb, string);
+            if (*string && string[strlen (string)-1] != ' ')
+                put_membuf (&mb, " ", 1);
+        }
+        for (s=buffer, n=len; n; s++, n--) {
+            if ( *s == '%' || *(const byte*)s <= lower_limit
+                           || *(const byte*)s == 127 ) {
+                snprintf (numbuf, sizeof numbuf, "%%%02X", *(const byte*)s);
+                put_membuf_str (&mb, numbuf);
+            }
+            else
+                put_membuf (&mb, s, 1);
+        }
+        put_membuf (&mb, "", 1);
+        args = get_membuf (&mb, NULL);
+        if (args)
+            status_cb (status_cb_value, get_status_string (no), args);
+        xfree (args);
+        return;
+    }
+
     text = get_status_string (no);
     count = dowrap = first = 1;
     do {
@@ -779,7 +779,7 @@ encrypt_filter( void *opaque, int control,
 
 	    efx->header_okay = 1;
 	}
-	rc = iobuf_write( a, buf, size );
+	rc = iobuf_write_pass( a, buf, size );
 
     }
     else if( control == IOBUFCTRL_FREE )
@@ -265,7 +265,7 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   size_t n, size = *ret_len;
   int rc = 0;
-  int c;
+  int nread;
 
   if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
     {
@@ -278,12 +278,8 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
       assert ( size > 44 );
 
       /* Get at least 22 bytes and put it somewhere ahead in the buffer. */
-      for (n=22; n < 44 ; n++ )
-        {
-          if( (c = iobuf_get(a)) == -1 )
-            break;
-          buf[n] = c;
-	}
+      nread = iobuf_read (a, buf+22, 22);
+      n = 22 + (nread == -1? 0 : nread);
       if ( n == 44 )
         {
           /* We have enough stuff - flush the deferred stuff.  */
@@ -298,12 +294,9 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
               memcpy (buf, dfx->defer, 22 );
 	    }
           /* Now fill up. */
-          for (; n < size; n++ )
-            {
-              if ( (c = iobuf_get(a)) == -1 )
-                break;
-              buf[n] = c;
-	    }
+          nread = iobuf_read (a, buf+n, size-n);
+          if (nread != -1)
+            n += nread;
           /* Move the last 22 bytes back to the defer buffer. */
 	  /* (right, we are wasting 22 bytes of the supplied buffer.) */
           n -= 22;
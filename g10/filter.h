@@ -84,6 +84,10 @@ struct compress_filter_context_s {
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    int level;                /* Compression level in use.  */
+    size_t chunk_in;          /* Input bytes of the current chunk.  */
+    unsigned long chunk_out;  /* Value of total_out at chunk start.  */
+    int chunk_stored;         /* Number of chunks stored in a row.  */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -32,6 +32,108 @@
 #include "options.h" 
 
 
+/* Freed PACKET, PKT_signature and PKT_public_key structures are kept
+   in small pools and handed out again by the alloc functions below.
+   A keyring listing or an import releases the nodes of one keyblock
+   before reading the next one, so most of the structures of a new
+   keyblock are taken from the pools instead of the heap.  The pooled
+   items are plain heap blocks: Anything allocated from a pool may
+   still be released with xfree and items may be put back which have
+   been allocated with xmalloc.  */
+#define PACKET_POOL_SIZE 256
+
+struct packet_pool
+{
+  const char *name;
+  size_t size;
+  unsigned int n;
+  void *items[PACKET_POOL_SIZE];
+  unsigned long allocated;   /* Number of calls to pool_alloc.  */
+  unsigned long reused;      /* ... of which were served from the pool.  */
+};
+
+static struct packet_pool packet_pool = { "packet", sizeof (PACKET) };
+static struct packet_pool sig_pool = { "signature", sizeof (PKT_signature) };
+static struct packet_pool pk_pool = { "public key", sizeof (PKT_public_key) };
+
+
+static void *
+pool_alloc (struct packet_pool *pool)
+{
+  void *p;
+
+  pool->allocated++;
+  if (pool->n)
+    {
+      pool->reused++;
+      p = pool->items[--pool->n];
+      memset (p, 0, pool->size);
+      return p;
+    }
+  return xmalloc_clear (pool->size);
+}
+
+
+static void
+pool_free (struct packet_pool *pool, void *p)
+{
+  if (!p)
+    return;
+  if (pool->n < PACKET_POOL_SIZE)
+    pool->items[pool->n++] = p;
+  else
+    xfree (p);
+}
+
+
+/* Return a new zeroed PACKET structure.  */
+PACKET *
+alloc_packet (void)
+{
+  return pool_alloc (&packet_pool);
+}
+
+
+/* Free the content of PKT and PKT itself.  */
+void
+release_packet (PACKET *pkt)
+{
+  if (pkt)
+    {
+      free_packet (pkt);
+      pool_free (&packet_pool, pkt);
+    }
+}
+
+
+/* Return a new zeroed signature packet.  */
+PKT_signature *
+alloc_signature (void)
+{
+  return pool_alloc (&sig_pool);
+}
+
+
+/* Return a new zeroed public key packet.  */
+PKT_public_key *
+alloc_public_key (void)
+{
+  return pool_alloc (&pk_pool);
+}
+
+
+void
+packet_pool_print_stats (void)
+{
+  struct packet_pool *pools[3] = { &packet_pool, &sig_pool, &pk_pool };
+  int i;
+
+  for (i=0; i < DIM (pools); i++)
+    log_info ("packet pool: %lu %s structures allocated, %lu reused\n",
+              pools[i]->allocated, pools[i]->name, pools[i]->reused);
+}
+
+
 void
 free_symkey_enc( PKT_symkey_enc *enc )
 {
@@ -71,7 +173,7 @@ free_seckey_enc( PKT_signature *sig )
       xfree (sig->pka_info);
     }
 
-  xfree(sig);
+  pool_free (&sig_pool, sig);
 }
 
 
@@ -106,7 +208,7 @@ void
 free_public_key( PKT_public_key *pk )
 {
     release_public_key_parts( pk );
-    xfree(pk);
+    pool_free (&pk_pool, pk);
 }
 
 
@@ -156,7 +258,7 @@ copy_public_key ( PKT_public_key *d, PKT_public_key *s)
     int n, i;
 
     if( !d )
-	d = xmalloc(sizeof *d);
+	d = alloc_public_key ();
     memcpy( d, s, sizeof *d );
     d->user_id = scopy_user_id (s->user_id);
     d->prefs = copy_prefs (s->prefs);
@@ -221,7 +323,7 @@ copy_signature( PKT_signature *d, PKT_signature *s )
     int n, i;
 
     if( !d )
-	d = xmalloc(sizeof *d);
+	d = alloc_signature ();
     memcpy( d, s, sizeof *d );
     n = pubkey_get_nsig( s->pubkey_algo );
     if( !n )
@@ -531,6 +633,8 @@ cmp_signatures( PKT_signature *a, PKT_signature *b )
     n = pubkey_get_nsig( a->pubkey_algo );
     if( !n )
 	return -1; /* can't compare due to unknown algorithm */
+    if( parse_sig_data (a) || parse_sig_data (b) )
+	return -1;
     for(i=0; i < n; i++ ) {
 	if( mpi_cmp( a->data[i] , b->data[i] ) )
 	    return -1;
@@ -58,63 +58,196 @@ struct getkey_ctx_s {
     KEYDB_SEARCH_DESC items[1];
 };
 
-#if 0
-static struct {
-    int any;
-    int okay_count;
-    int nokey_count;
-    int error_count;
-} lkup_stats[21];
-#endif
-
 typedef struct keyid_list {
     struct keyid_list *next;
+    struct keyid_list *hnext;  /* Next in the hash chain of the uid cache. */
+    struct user_id_db *owner;  /* The uid cache entry of this key ID.  */
     u32 keyid[2];
 } *keyid_list_t;
 
 
+/* The public key cache and the user ID cache are hash tables indexed
+   by the key ID.  All entries of a cache are additionally kept on a
+   list ordered by their last use so that the least recently used
+   entry can be dropped when the cache is full.  The number of entries
+   in each cache is limited to KEY_CACHE_SIZE.  */
+static unsigned int key_cache_size = PK_UID_CACHE_SIZE;
+
+/* The limits for KEY_CACHE_SIZE.  */
+#define MIN_KEY_CACHE_SIZE  5
+#define MAX_KEY_CACHE_SIZE  (1 << 20)
+
+/* The low word of a key ID is random enough to be used directly.  */
+#define KEYID_HASH(k,mask)  ((k)[1] & (mask))
+
+struct cache_stats_s
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
 #if MAX_PK_CACHE_ENTRIES
   typedef struct pk_cache_entry {
-      struct pk_cache_entry *next;
+      struct pk_cache_entry *next;	/* Next in the hash chain.  */
+      struct pk_cache_entry *lru_prev;
+      struct pk_cache_entry *lru_next;
       u32 keyid[2];
       PKT_public_key *pk;
   } *pk_cache_entry_t;
-  static pk_cache_entry_t pk_cache;
-  static int pk_cache_entries;	 /* number of entries in pk cache */
+  static pk_cache_entry_t *pk_cache;	 /* The hash table.  */
+  static unsigned int pk_cache_mask;
+  static pk_cache_entry_t pk_cache_mru; /* Most recently used entry.  */
+  static pk_cache_entry_t pk_cache_lru; /* Least recently used entry.  */
+  static unsigned int pk_cache_entries; /* number of entries in pk cache */
   static int pk_cache_disabled;
+  static struct cache_stats_s pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
 #error we really need the userid cache
 #endif
 typedef struct user_id_db {
-    struct user_id_db *next;
+    struct user_id_db *lru_prev;
+    struct user_id_db *lru_next;
     keyid_list_t keyids;
     int len;
     char name[1];
 } *user_id_db_t;
-static user_id_db_t user_id_db;
-static int uid_cache_entries;	/* number of entries in uid cache */
+static keyid_list_t *uid_cache;		/* The hash table.  */
+static unsigned int uid_cache_mask;
+static user_id_db_t uid_cache_mru;
+static user_id_db_t uid_cache_lru;
+static unsigned int uid_cache_entries; /* number of entries in uid cache */
+static struct cache_stats_s uid_cache_stats;
 
 static void merge_selfsigs( KBNODE keyblock );
 static int lookup( GETKEY_CTX ctx, KBNODE *ret_keyblock, int secmode );
 
-#if 0
+
+/* Set the maximum number of entries of the public key cache and of
+   the user ID cache to NENTRIES and return the old value.  NENTRIES
+   is clamped to the range MIN_KEY_CACHE_SIZE to MAX_KEY_CACHE_SIZE.
+   This should be called before the first key lookup.  */
+unsigned int
+getkey_set_cache_size (unsigned long nentries)
+{
+  unsigned int old = key_cache_size;
+
+  if (nentries < MIN_KEY_CACHE_SIZE)
+    nentries = MIN_KEY_CACHE_SIZE;
+  else if (nentries > MAX_KEY_CACHE_SIZE)
+    nentries = MAX_KEY_CACHE_SIZE;
+  key_cache_size = nentries;
+  return old;
+}
+
+
+/* Print the hit and miss counters of the key caches.  */
+void
+getkey_print_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk cache: %u entries, %lu hits, %lu misses, %lu evicted\n",
+            pk_cache_entries, pk_cache_stats.hits,
+            pk_cache_stats.misses, pk_cache_stats.evictions);
+#endif
+  log_info ("uid cache: %u entries, %lu hits, %lu misses, %lu evicted\n",
+            uid_cache_entries, uid_cache_stats.hits,
+            uid_cache_stats.misses, uid_cache_stats.evictions);
+}
+
+
+/* Return the number of hash buckets to use for a key cache.  */
+static unsigned int
+cache_table_size (void)
+{
+  unsigned int n;
+
+  for (n = 32; n < key_cache_size / 2 && n < MAX_KEY_CACHE_SIZE; n <<= 1)
+    ;
+  return n;
+}
+
+
+#if MAX_PK_CACHE_ENTRIES
 static void
-print_stats()
+pk_cache_unlink (pk_cache_entry_t ce)
 {
-    int i;
-    for(i=0; i < DIM(lkup_stats); i++ ) {
-	if( lkup_stats[i].any )
-	    fprintf(stderr,
-		    "lookup stats: mode=%-2d  ok=%-6d  nokey=%-6d  err=%-6d\n",
-		    i,
-		    lkup_stats[i].okay_count,
-		    lkup_stats[i].nokey_count,
-		    lkup_stats[i].error_count );
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_mru = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru = ce->lru_prev;
+}
+
+static void
+pk_cache_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_mru;
+  if (pk_cache_mru)
+    pk_cache_mru->lru_prev = ce;
+  else
+    pk_cache_lru = ce;
+  pk_cache_mru = ce;
+}
+
+static pk_cache_entry_t
+pk_cache_find (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache)
+    return NULL;
+  for (ce = pk_cache[KEYID_HASH (keyid, pk_cache_mask)]; ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      return ce;
+  return NULL;
+}
+
+/* Return the cached public key with KEYID or NULL if it is not in the
+   cache.  The entry is marked as the most recently used one.  */
+static PKT_public_key *
+pk_cache_lookup (u32 *keyid)
+{
+  pk_cache_entry_t ce = pk_cache_find (keyid);
+
+  if (!ce)
+    {
+      pk_cache_stats.misses++;
+      return NULL;
+    }
+  pk_cache_stats.hits++;
+  if (ce != pk_cache_mru)
+    {
+      pk_cache_unlink (ce);
+      pk_cache_push (ce);
     }
+  return ce->pk;
 }
-#endif
+
+/* Drop the least recently used entry from the pk cache.  */
+static void
+pk_cache_evict (void)
+{
+  pk_cache_entry_t ce = pk_cache_lru;
+  pk_cache_entry_t *pp;
+
+  pk_cache_unlink (ce);
+  for (pp = &pk_cache[KEYID_HASH (ce->keyid, pk_cache_mask)];
+       *pp != ce; pp = &(*pp)->next)
+    ;
+  *pp = ce->next;
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+  pk_cache_stats.evictions++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
 
 
 void
@@ -123,6 +256,7 @@ cache_public_key( PKT_public_key *pk )
 #if MAX_PK_CACHE_ENTRIES
     pk_cache_entry_t ce;
     u32 keyid[2];
+    unsigned int idx;
 
     if( pk_cache_disabled )
 	return;
@@ -138,27 +272,29 @@ cache_public_key( PKT_public_key *pk )
     else
 	return; /* don't know how to get the keyid */
 
-    for( ce = pk_cache; ce; ce = ce->next )
-	if( ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1] ) {
-	    if( DBG_CACHE )
-		log_debug("cache_public_key: already in cache\n");
-	    return;
-	}
-
-    if( pk_cache_entries >= MAX_PK_CACHE_ENTRIES ) {
-	/* fixme: use another algorithm to free some cache slots */
-	pk_cache_disabled=1;
-	if( opt.verbose > 1 )
-	    log_info(_("too many entries in pk cache - disabled\n"));
+    if( pk_cache_find( keyid ) ) {
+	if( DBG_CACHE )
+	    log_debug("cache_public_key: already in cache\n");
 	return;
     }
-    pk_cache_entries++;
+
+    if( !pk_cache ) {
+	idx = cache_table_size ();
+	pk_cache = xcalloc( idx, sizeof *pk_cache );
+	pk_cache_mask = idx - 1;
+    }
+    while( pk_cache_entries >= key_cache_size )
+	pk_cache_evict ();
+
     ce = xmalloc( sizeof *ce );
-    ce->next = pk_cache;
-    pk_cache = ce;
     ce->pk = copy_public_key( NULL, pk );
     ce->keyid[0] = keyid[0];
     ce->keyid[1] = keyid[1];
+    idx = KEYID_HASH (keyid, pk_cache_mask);
+    ce->next = pk_cache[idx];
+    pk_cache[idx] = ce;
+    pk_cache_push (ce);
+    pk_cache_entries++;
 #endif
 }
 
@@ -214,6 +350,88 @@ release_keyid_list ( keyid_list_t k )
     }
 }
 
+
+static void
+uid_cache_unlink (user_id_db_t r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    uid_cache_mru = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    uid_cache_lru = r->lru_prev;
+}
+
+static void
+uid_cache_push (user_id_db_t r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = uid_cache_mru;
+  if (uid_cache_mru)
+    uid_cache_mru->lru_prev = r;
+  else
+    uid_cache_lru = r;
+  uid_cache_mru = r;
+}
+
+static keyid_list_t
+uid_cache_find (u32 *keyid)
+{
+  keyid_list_t a;
+
+  if (!uid_cache)
+    return NULL;
+  for (a = uid_cache[KEYID_HASH (keyid, uid_cache_mask)]; a; a = a->hnext)
+    if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
+      return a;
+  return NULL;
+}
+
+/* Return the user ID cache entry for KEYID or NULL if it is not in
+   the cache.  The entry is marked as the most recently used one.  */
+static user_id_db_t
+uid_cache_lookup (u32 *keyid)
+{
+  keyid_list_t a = uid_cache_find (keyid);
+
+  if (!a)
+    {
+      uid_cache_stats.misses++;
+      return NULL;
+    }
+  uid_cache_stats.hits++;
+  if (a->owner != uid_cache_mru)
+    {
+      uid_cache_unlink (a->owner);
+      uid_cache_push (a->owner);
+    }
+  return a->owner;
+}
+
+/* Drop the least recently used entry from the user ID cache.  */
+static void
+uid_cache_evict (void)
+{
+  user_id_db_t r = uid_cache_lru;
+  keyid_list_t a, *pp;
+
+  uid_cache_unlink (r);
+  for (a = r->keyids; a; a = a->next)
+    {
+      for (pp = &uid_cache[KEYID_HASH (a->keyid, uid_cache_mask)];
+           *pp != a; pp = &(*pp)->hnext)
+        ;
+      *pp = a->hnext;
+    }
+  release_keyid_list (r->keyids);
+  xfree (r);
+  uid_cache_entries--;
+  uid_cache_stats.evictions++;
+}
+
+
 /****************
  * Store the association of keyid and userid
  * Feed only public keys to this function.
@@ -224,29 +442,22 @@ cache_user_id( KBNODE keyblock )
     user_id_db_t r;
     const char *uid;
     size_t uidlen;
-    keyid_list_t keyids = NULL;
+    keyid_list_t a, keyids = NULL;
+    unsigned int idx;
     KBNODE k;
 
     for (k=keyblock; k; k = k->next ) {
         if ( k->pkt->pkttype == PKT_PUBLIC_KEY
              || k->pkt->pkttype == PKT_PUBLIC_SUBKEY ) {
-            keyid_list_t a = xmalloc_clear ( sizeof *a );
-            /* Hmmm: For a long list of keyids it might be an advantage
-             * to append the keys */
+            a = xmalloc_clear ( sizeof *a );
             keyid_from_pk( k->pkt->pkt.public_key, a->keyid );
             /* first check for duplicates */
-            for(r=user_id_db; r; r = r->next ) {
-                keyid_list_t b = r->keyids;
-                for ( b = r->keyids; b; b = b->next ) {
-                    if( b->keyid[0] == a->keyid[0]
-                        && b->keyid[1] == a->keyid[1] ) {
-                        if( DBG_CACHE )
-                            log_debug("cache_user_id: already in cache\n");
-                        release_keyid_list ( keyids );
-                        xfree ( a );
-                        return;
-                    }
-                }
+            if ( uid_cache_find ( a->keyid ) ) {
+                if( DBG_CACHE )
+                    log_debug("cache_user_id: already in cache\n");
+                release_keyid_list ( keyids );
+                xfree ( a );
+                return;
             }
             /* now put it into the cache */
             a->next = keyids;
@@ -259,24 +470,41 @@ cache_user_id( KBNODE keyblock )
 
     uid = get_primary_uid ( keyblock, &uidlen );
 
-    if( uid_cache_entries >= MAX_UID_CACHE_ENTRIES ) {
-	/* fixme: use another algorithm to free some cache slots */
-	r = user_id_db;
-	user_id_db = r->next;
-        release_keyid_list ( r->keyids );
-	xfree(r);
-	uid_cache_entries--;
+    if( !uid_cache ) {
+	idx = cache_table_size ();
+	uid_cache = xcalloc( idx, sizeof *uid_cache );
+	uid_cache_mask = idx - 1;
     }
+    while( uid_cache_entries >= key_cache_size )
+	uid_cache_evict ();
+
     r = xmalloc( sizeof *r + uidlen-1 );
     r->keyids = keyids;
     r->len = uidlen;
     memcpy(r->name, uid, r->len);
-    r->next = user_id_db;
-    user_id_db = r;
+    for (a = keyids; a; a = a->next ) {
+        a->owner = r;
+        idx = KEYID_HASH (a->keyid, uid_cache_mask);
+        a->hnext = uid_cache[idx];
+        uid_cache[idx] = a;
+    }
+    uid_cache_push (r);
     uid_cache_entries++;
 }
 
 
+/* Store the primary user ID of the public KEYBLOCK in the user ID
+   cache.  This is used by the bulk import for keyblocks which have not
+   yet been written to the keyring.  Note that the self-signatures of
+   KEYBLOCK are merged.  */
+void
+cache_keyblock_user_id (KBNODE keyblock)
+{
+  merge_keys_and_selfsig (keyblock);
+  cache_user_id (keyblock);
+}
+
+
 void
 getkey_disable_caches()
 {
@@ -284,13 +512,15 @@ getkey_disable_caches()
     {
 	pk_cache_entry_t ce, ce2;
 
-	for( ce = pk_cache; ce; ce = ce2 ) {
-	    ce2 = ce->next;
+	for( ce = pk_cache_mru; ce; ce = ce2 ) {
+	    ce2 = ce->lru_next;
 	    free_public_key( ce->pk );
 	    xfree( ce );
 	}
 	pk_cache_disabled=1;
 	pk_cache_entries = 0;
+	pk_cache_mru = pk_cache_lru = NULL;
+	xfree (pk_cache);
 	pk_cache = NULL;
     }
 #endif
@@ -339,14 +569,11 @@ get_pubkey( PKT_public_key *pk, u32 *keyid )
 	/* Try to get it from the cache.  We don't do this when pk is
 	   NULL as it does not guarantee that the user IDs are
 	   cached. */
-	pk_cache_entry_t ce;
-	for( ce = pk_cache; ce; ce = ce->next )
+	PKT_public_key *cached = pk_cache_lookup (keyid);
+	if (cached)
 	  {
-	    if( ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1] )
-	      {
-		copy_public_key( pk, ce->pk );
-		return 0;
-	      }
+	    copy_public_key (pk, cached);
+	    return 0;
 	  }
       }
 #endif
@@ -406,16 +633,12 @@ get_pubkey_fast (PKT_public_key *pk, u32 *keyid)
   assert (pk);
 #if MAX_PK_CACHE_ENTRIES
   { /* Try to get it from the cache */
-    pk_cache_entry_t ce;
+    PKT_public_key *cached = pk_cache_lookup (keyid);
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    if (cached)
       {
-        if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-          {
-            if (pk)
-              copy_public_key (pk, ce->pk);
-            return 0;
-          }
+        copy_public_key (pk, cached);
+        return 0;
       }
   }
 #endif
@@ -670,7 +893,21 @@ classify_user_id( const char *name, KEYDB_SEARCH_DESC *desc )
             break;
 
 	case '&':  /* keygrip */
-          return 0; /* Not yet implememted. */
+            {
+                int i;
+
+                s++;
+                for (i=0; i < 20; i++, s+=2) {
+                    int c = hextobyte(s);
+                    if (c == -1)
+                        return 0;
+                    desc->u.grip[i] = c;
+                }
+                if (*s && !spacep (s))
+                    return 0; /* invalid length of keygrip */
+                mode = KEYDB_SEARCH_MODE_KEYGRIP;
+            }
+            break;
 
 	default:
 	    if (s[0] == '0' && s[1] == 'x') {
@@ -865,7 +1102,8 @@ key_byname( GETKEY_CTX *retctx, strlist_t namelist,
 	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_LONG_KID
 	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_FPR16
 	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_FPR20
-	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_FPR)
+	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_FPR
+	       && ctx->items[n].mode!=KEYDB_SEARCH_MODE_KEYGRIP)
 	      ctx->items[n].skipfnc=skip_unusable;
 	  }
       }
@@ -2976,18 +3214,12 @@ get_user_id_string( u32 *keyid )
   /* try it two times; second pass reads from key resources */
   do
     {
-      for(r=user_id_db; r; r = r->next )
-	{
-	  keyid_list_t a;
-	  for (a=r->keyids; a; a= a->next )
-	    {
-	      if( a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1] )
-		{
-		  p = xmalloc( keystrlen() + 1 + r->len + 1 );
-		  sprintf(p, "%s %.*s", keystr(keyid), r->len, r->name );
-		  return p;
-		}
-	    }
+      r = uid_cache_lookup (keyid);
+      if (r)
+        {
+          p = xmalloc( keystrlen() + 1 + r->len + 1 );
+          sprintf(p, "%s %.*s", keystr(keyid), r->len, r->name );
+          return p;
         }
     } while( ++pass < 2 && !get_pubkey( NULL, keyid ) );
   p = xmalloc( keystrlen() + 5 );
@@ -3014,17 +3246,13 @@ get_long_user_id_string( u32 *keyid )
     int pass=0;
     /* try it two times; second pass reads from key resources */
     do {
-	for(r=user_id_db; r; r = r->next ) {
-            keyid_list_t a;
-            for (a=r->keyids; a; a= a->next ) {
-                if( a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1] ) {
-                    p = xmalloc( r->len + 20 );
-                    sprintf(p, "%08lX%08lX %.*s",
-                            (ulong)keyid[0], (ulong)keyid[1],
-                            r->len, r->name );
-                    return p;
-                }
-            }
+	r = uid_cache_lookup (keyid);
+	if (r) {
+            p = xmalloc( r->len + 20 );
+            sprintf(p, "%08lX%08lX %.*s",
+                    (ulong)keyid[0], (ulong)keyid[1],
+                    r->len, r->name );
+            return p;
         }
     } while( ++pass < 2 && !get_pubkey( NULL, keyid ) );
     p = xmalloc( 25 );
@@ -3042,22 +3270,15 @@ get_user_id( u32 *keyid, size_t *rn )
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
+      r = uid_cache_lookup (keyid);
+      if (r)
 	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-                  /* An empty string as user id is possible.  Make
-                     sure that the malloc allocates one byte and does
-                     not bail out.  */
-		  p = xmalloc (r->len? r->len : 1);
-		  memcpy (p, r->name, r->len);
-		  *rn = r->len;
-		  return p;
-		}
-	    }
+          /* An empty string as user id is possible.  Make sure that
+             the malloc allocates one byte and does not bail out.  */
+          p = xmalloc (r->len? r->len : 1);
+          memcpy (p, r->name, r->len);
+          *rn = r->len;
+          return p;
 	}
     }
   while (++pass < 2 && !get_pubkey (NULL, keyid));
@@ -48,6 +48,7 @@
 #include "options.h"
 #include "keydb.h"
 #include "trustdb.h"
+#include "tdbio.h"
 #include "cipher.h"
 #include "filter.h"
 #include "ttyio.h"
@@ -211,6 +212,7 @@ enum cmd_and_opt_values
     oCompressAlgo,
     oCompressLevel,
     oBZ2CompressLevel,
+    oCompressChunkSize,
     oBZ2DecompressLowmem,
     oPassphrase,
     oPassphraseFD,
@@ -330,6 +332,16 @@ enum cmd_and_opt_values
     oNoExpensiveTrustChecks,
     oFixedListMode,
     oNoSigCache,
+    oKeyringIndex,
+    oNoKeyringIndex,
+    oTrustDBMmap,
+    oNoTrustDBMmap,
+    oIOBufSize,
+    oKeyCacheSize,
+    oTrustDBCacheSize,
+    oSigCacheSize,
+    oBulkImportSize,
+    oImportJobs,
     oNoSigCreateCheck,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
@@ -467,6 +479,7 @@ static ARGPARSE_OPTS opts[] = {
                 N_("|N|set compress level to N (0 disables)")),
   ARGPARSE_s_i (oCompressLevel, "compress-level", "@"),
   ARGPARSE_s_i (oBZ2CompressLevel, "bzip2-compress-level", "@"),
+  ARGPARSE_s_u (oCompressChunkSize, "compress-chunk-size", "@"),
   ARGPARSE_s_n (oBZ2DecompressLowmem, "bzip2-decompress-lowmem", "@"),
 
   ARGPARSE_s_n (oTextmodeShort, NULL, "@"),
@@ -696,6 +709,16 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oAutoKeyRetrieve, "auto-key-retrieve", "@"),
   ARGPARSE_s_n (oNoAutoKeyRetrieve, "no-auto-key-retrieve", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_n (oKeyringIndex,       "keyring-index", "@"),
+  ARGPARSE_s_n (oNoKeyringIndex,     "no-keyring-index", "@"),
+  ARGPARSE_s_n (oTrustDBMmap,        "trustdb-mmap", "@"),
+  ARGPARSE_s_n (oNoTrustDBMmap,      "no-trustdb-mmap", "@"),
+  ARGPARSE_s_u (oIOBufSize,          "iobuf-size", "@"),
+  ARGPARSE_s_u (oKeyCacheSize,       "key-cache-size", "@"),
+  ARGPARSE_s_u (oTrustDBCacheSize,   "trustdb-cache-size", "@"),
+  ARGPARSE_s_u (oSigCacheSize,       "sig-cache-size", "@"),
+  ARGPARSE_s_u (oBulkImportSize,     "bulk-import-size", "@"),
+  ARGPARSE_s_u (oImportJobs,         "import-jobs", "@"),
   ARGPARSE_s_n (oNoSigCreateCheck,   "no-sig-create-check", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
   ARGPARSE_s_n (oNoAutoCheckTrustDB, "no-auto-check-trustdb", "@"),
@@ -2569,6 +2592,14 @@ main (int argc, char **argv)
 	    break;
 	  case oCompressLevel: opt.compress_level = pargs.r.ret_int; break;
 	  case oBZ2CompressLevel: opt.bz2_compress_level = pargs.r.ret_int; break;
+	  case oCompressChunkSize:
+            if (pargs.r.ret_ulong
+                && (pargs.r.ret_ulong < 16 || pargs.r.ret_ulong > 1024*1024))
+              log_error (_("compress-chunk-size must be in the range"
+                           " from %d to %d\n"), 16, 1024*1024);
+            else
+              opt.compress_chunk_size = pargs.r.ret_ulong * 1024;
+            break;
 	  case oBZ2DecompressLowmem: opt.bz2_decompress_lowmem=1; break;
 	  case oPassphrase:
 	    set_passphrase_from_string(pargs.r.ret_str);
@@ -2786,6 +2817,35 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oKeyringIndex: opt.keyring_index = 1; break;
+          case oNoKeyringIndex: opt.keyring_index = 0; break;
+          case oTrustDBMmap: opt.trustdb_mmap = 1; break;
+          case oNoTrustDBMmap: opt.trustdb_mmap = 0; break;
+          case oIOBufSize:
+            if (iobuf_set_buffer_size (pargs.r.ret_ulong))
+              log_error (_("iobuf-size must be in the range from %d to %d\n"),
+                         IOBUF_MIN_BUFFER_KB, IOBUF_MAX_BUFFER_KB);
+            break;
+          case oKeyCacheSize:
+            getkey_set_cache_size (pargs.r.ret_ulong);
+            break;
+          case oTrustDBCacheSize:
+            tdbio_set_cache_size (pargs.r.ret_ulong);
+            break;
+          case oSigCacheSize:
+            sig_cache_set_size (pargs.r.ret_ulong);
+            break;
+          case oBulkImportSize:
+            keydb_set_bulk_size (pargs.r.ret_ulong);
+            break;
+          case oImportJobs:
+            if (!pargs.r.ret_ulong)
+              opt.import_jobs = 1;
+            else if (pargs.r.ret_ulong > 64)
+              opt.import_jobs = 64;
+            else
+              opt.import_jobs = pargs.r.ret_ulong;
+            break;
           case oNoSigCreateCheck: opt.no_sig_create_check = 1; break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
@@ -3352,6 +3412,15 @@ main (int argc, char **argv)
 	xfree(p);
     }
 
+    /* Keep the results of key signature checks.  */
+    if (!opt.no_sig_cache)
+      {
+        char *p = make_filename (opt.homedir, "sigcache" EXTSEP_S "gpg",
+                                 NULL);
+        sig_cache_open (p);
+        xfree (p);
+      }
+
     /* If there is no command but the --fingerprint is given, default
        to the --list-keys command.  */
     if (!cmd && fpr_maybe_cmd)
@@ -4081,13 +4150,21 @@ void
 g10_exit( int rc )
 {
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
+  sig_cache_close ();
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
+      kbnode_print_stats ();
     }
   if (opt.debug)
     gcry_control (GCRYCTL_DUMP_SECMEM_STATS );
+  if ( (opt.debug & DBG_CACHE_VALUE) )
+    {
+      getkey_print_stats ();
+      tdbio_print_stats ();
+      sig_cache_print_stats ();
+    }
 
   emergency_cleanup ();
 
@@ -270,6 +270,13 @@ check_trustdb_stale(void)
 {
 }
 
+void
+trustdb_journal_change (KBNODE keyblock, const byte *oldstamp)
+{
+  (void)keyblock;
+  (void)oldstamp;
+}
+
 int
 get_validity_info (PKT_public_key *pk, PKT_user_id *uid)
 {
@@ -38,6 +38,9 @@
 #include "status.h"
 #include "keyserver-internal.h"
 
+/* Number of keyblocks read ahead per process with --import-jobs.  */
+#define IMPORT_JOB_BATCH 50
+
 struct stats_s {
     ulong count;
     ulong no_user_id;
@@ -63,6 +66,7 @@ static int import( IOBUF inp, const char* fname,struct stats_s *stats,
 		   import_filter_t filter, void *filter_arg );
 static int read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root );
 static void revocation_present(KBNODE keyblock);
+static void print_bulk_progress (ulong count, ulong n, u32 start);
 static int import_one(const char *fname, KBNODE keyblock,struct stats_s *stats,
 		      unsigned char **fpr,size_t *fpr_len,
 		      unsigned int options,int from_sk,
@@ -107,6 +111,8 @@ parse_import_options(char *str,unsigned int *options,int noisy)
        N_("remove unusable parts from key after import")},
       {"import-minimal",IMPORT_MINIMAL|IMPORT_CLEAN,NULL,
        N_("remove as much as possible from key after import")},
+      {"bulk-import",IMPORT_BULK,NULL,
+       N_("collect imported keys and write them in batches")},
       /* Aliases for backward compatibility */
       {"allow-local-sigs",IMPORT_LOCAL_SIGS,NULL,NULL},
       {"repair-hkp-subkey-bug",IMPORT_REPAIR_PKS_SUBKEY_BUG,NULL,NULL},
@@ -175,6 +181,13 @@ import_keys_internal( IOBUF inp, char **fnames, int nnames,
     if (!stats)
         stats = import_new_stats_handle ();
 
+    if ((options & IMPORT_BULK) && (rc = keydb_bulk_begin ()))
+      {
+        log_error (_("can't start bulk import: %s\n"), g10_errstr (rc));
+        options &= ~IMPORT_BULK;
+        rc = 0;
+      }
+
     if (inp) {
         rc = import (inp, "[stream]", stats, fpr, fpr_len, options,
                      filter, filter_arg);
@@ -208,6 +221,17 @@ import_keys_internal( IOBUF inp, char **fnames, int nnames,
 	      }
 	}
     }
+    if ((options & IMPORT_BULK))
+      {
+        int rc2 = keydb_bulk_end ();
+
+        if (rc2)
+          {
+            log_error (_("error writing keyring: %s\n"), g10_errstr (rc2));
+            if (!rc)
+              rc = rc2;
+          }
+      }
     if (!stats_handle) {
         import_print_stats (stats);
         import_release_stats_handle (stats);
@@ -250,7 +274,12 @@ import (IOBUF inp, const char* fname,struct stats_s *stats,
 {
     PACKET *pending_pkt = NULL;
     KBNODE keyblock = NULL;
+    KBNODE *batch;
     int rc = 0;
+    int err = 0;
+    int i, n, batchsize;
+    ulong start_count = stats->count;
+    u32 start_time = make_timestamp ();
 
     getkey_disable_caches();
 
@@ -263,28 +292,51 @@ import (IOBUF inp, const char* fname,struct stats_s *stats,
         release_armor_context (afx);
     }
 
-    while( !(rc = read_block( inp, &pending_pkt, &keyblock) )) {
-	if( keyblock->pkt->pkttype == PKT_PUBLIC_KEY )
-	    rc = import_one (fname, keyblock, stats, fpr, fpr_len, options, 0,
-                             filter, filter_arg);
-        else if( keyblock->pkt->pkttype == PKT_SECRET_KEY )
-            rc = import_secret_one (fname, keyblock, stats, options,
-                                    filter, filter_arg);
-	else if( keyblock->pkt->pkttype == PKT_SIGNATURE
-		 && keyblock->pkt->pkt.signature->sig_class == 0x20 )
-	    rc = import_revoke_cert( fname, keyblock, stats );
-	else {
-	    log_info( _("skipping block of type %d\n"),
-					    keyblock->pkt->pkttype );
+    /* With --import-jobs we read ahead a batch of keyblocks and have
+       their self-signatures checked in parallel before importing them
+       one after the other.  */
+    batchsize = opt.import_jobs > 1? IMPORT_JOB_BATCH * opt.import_jobs : 1;
+    batch = xmalloc (batchsize * sizeof *batch);
+    while (!rc) {
+	for (n=0; n < batchsize; n++)
+	    if ((rc = read_block (inp, &pending_pkt, &batch[n])))
+		break;
+	if (n > 1)
+	    check_keyblock_sigs_parallel (batch, n, opt.import_jobs);
+	for (i=0; i < n; i++) {
+	    keyblock = batch[i];
+	    if (err)
+		;
+	    else if( keyblock->pkt->pkttype == PKT_PUBLIC_KEY )
+		err = import_one (fname, keyblock, stats, fpr, fpr_len,
+				  options, 0, filter, filter_arg);
+	    else if( keyblock->pkt->pkttype == PKT_SECRET_KEY )
+		err = import_secret_one (fname, keyblock, stats, options,
+					 filter, filter_arg);
+	    else if( keyblock->pkt->pkttype == PKT_SIGNATURE
+		     && keyblock->pkt->pkt.signature->sig_class == 0x20 )
+		err = import_revoke_cert( fname, keyblock, stats );
+	    else {
+		log_info( _("skipping block of type %d\n"),
+			  keyblock->pkt->pkttype );
+	    }
+	    release_kbnode(keyblock);
+	    /* fixme: we should increment the not imported counter but
+	       this does only make sense if we keep on going despite of
+	       errors. */
+	    if( !err && !(++stats->count % 100) ) {
+		if ((options & IMPORT_BULK))
+		    print_bulk_progress (stats->count,
+					 stats->count - start_count,
+					 start_time);
+		else if( !opt.quiet )
+		    log_info(_("%lu keys processed so far\n"), stats->count );
+	    }
 	}
-	release_kbnode(keyblock);
-        /* fixme: we should increment the not imported counter but this
-           does only make sense if we keep on going despite of errors. */
-	if( rc )
-	    break;
-	if( !(++stats->count % 100) && !opt.quiet )
-	    log_info(_("%lu keys processed so far\n"), stats->count );
+	if (err)
+	    rc = err;
     }
+    xfree (batch);
     if( rc == -1 )
 	rc = 0;
     else if( rc && rc != G10ERR_INV_KEYRING )
@@ -294,6 +346,22 @@ import (IOBUF inp, const char* fname,struct stats_s *stats,
 }
 
 
+/* Print the progress of a bulk import.  COUNT is the total number of
+   processed keys and N the number of keys processed since START.  */
+static void
+print_bulk_progress (ulong count, ulong n, u32 start)
+{
+  u32 elapsed = make_timestamp () - start;
+  char buf[50];
+
+  if (!opt.quiet)
+    log_info (_("%lu keys processed so far (%lu keys/s)\n"),
+              count, n / (elapsed? elapsed : 1));
+  snprintf (buf, sizeof buf, "import ? %lu 0", count);
+  write_status_text (STATUS_PROGRESS, buf);
+}
+
+
 void
 import_print_stats (void *hd)
 {
@@ -400,7 +468,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
     }
     else
 	in_cert = 0;
-    pkt = xmalloc( sizeof *pkt );
+    pkt = alloc_packet ();
     init_packet(pkt);
     while( (rc=parse_packet(a, pkt)) != -1 ) {
 	if( rc ) {  /* ignore errors */
@@ -461,7 +529,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
 		    root = new_kbnode( pkt );
 		else
 		    add_kbnode( root, new_kbnode( pkt ) );
-		pkt = xmalloc( sizeof *pkt );
+		pkt = alloc_packet ();
 	    }
 	    init_packet(pkt);
 	    break;
@@ -475,8 +543,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
 	release_kbnode( root );
     else
 	*ret_root = root;
-    free_packet( pkt );
-    xfree( pkt );
+    release_packet (pkt);
     return rc;
 }
 
@@ -900,6 +967,10 @@ import_one( const char *fname, KBNODE keyblock, struct stats_s *stats,
 	    clear_ownertrusts (pk);
 	    if(non_self)
 	      revalidation_mark ();
+            /* The key may not yet be in the keyring; take the user
+               ID for the messages below from the keyblock.  */
+            if ((options & IMPORT_BULK))
+              cache_keyblock_user_id (keyblock);
 	  }
         keydb_release (hd);
 
@@ -990,8 +1061,13 @@ import_one( const char *fname, KBNODE keyblock, struct stats_s *stats,
             if (rc)
 		log_error (_("error writing keyring `%s': %s\n"),
 			     keydb_get_resource_name (hd), g10_errstr(rc) );
-	    else if(non_self)
-	      revalidation_mark ();
+	    else
+              {
+                if(non_self)
+                  revalidation_mark ();
+                if ((options & IMPORT_BULK))
+                  cache_keyblock_user_id (keyblock_orig);
+              }
 
 	    /* we are ready */
 	    if( !opt.quiet )
@@ -1465,6 +1541,10 @@ chk_self_sigs( const char *fname, KBNODE keyblock,
   (void)fname;
   (void)pk;
 
+  /* This just caches the sigs for later use.  That way we import a
+     fully-cached key which speeds things up. */
+  check_keyblock_sigs (keyblock, 1);
+
   for (n=keyblock; (n = find_next_kbnode (n, 0)); )
     {
       if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
@@ -1487,11 +1567,6 @@ chk_self_sigs( const char *fname, KBNODE keyblock,
           continue;
         }
 
-      /* This just caches the sigs for later use.  That way we
-         import a fully-cached key which speeds things up. */
-      if (!opt.no_sig_cache)
-        check_key_signature (keyblock, n, NULL);
-
       if ( IS_UID_SIG(sig) || IS_UID_REV(sig) )
         {
           KBNODE unode = find_prev_kbnode( keyblock, n, PKT_USER_ID );
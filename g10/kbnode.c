@@ -33,14 +33,26 @@
 
 static KBNODE unused_nodes;
 
+/* Statistics for --debug 128.  */
+static struct
+{
+  unsigned long keyblocks;  /* Released keyblocks.  */
+  unsigned long nodes;      /* Released nodes of these keyblocks.  */
+  unsigned long allocated;  /* Allocated nodes.  */
+  unsigned long reused;     /* ... of which were taken from UNUSED_NODES.  */
+} kbnode_stats;
+
 static KBNODE
 alloc_node(void)
 {
     KBNODE n;
 
+    kbnode_stats.allocated++;
     n = unused_nodes;
-    if( n )
+    if( n ) {
 	unused_nodes = n->next;
+	kbnode_stats.reused++;
+    }
     else
 	n = xmalloc( sizeof *n );
     n->next = NULL;
@@ -91,18 +103,31 @@ release_kbnode( KBNODE n )
 {
     KBNODE n2;
 
+    if( n && (n->pkt->pkttype == PKT_PUBLIC_KEY
+              || n->pkt->pkttype == PKT_SECRET_KEY) )
+	kbnode_stats.keyblocks++;
     while( n ) {
+	kbnode_stats.nodes++;
 	n2 = n->next;
-	if( !is_cloned_kbnode(n) ) {
-	    free_packet( n->pkt );
-	    xfree( n->pkt );
-	}
+	if( !is_cloned_kbnode(n) )
+	    release_packet (n->pkt);
 	free_node( n );
 	n = n2;
     }
 }
 
 
+void
+kbnode_print_stats (void)
+{
+  log_info ("kbnode: %lu keyblocks with %lu nodes released,"
+            " %lu nodes allocated, %lu reused\n",
+            kbnode_stats.keyblocks, kbnode_stats.nodes,
+            kbnode_stats.allocated, kbnode_stats.reused);
+  packet_pool_print_stats ();
+}
+
+
 /****************
  * Delete NODE.
  * Note: This only works with walk_kbnode!!
@@ -264,10 +289,8 @@ commit_kbnode( KBNODE *root )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-		free_packet( n->pkt );
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+		release_packet (n->pkt);
 	    free_node( n );
 	    changed = 1;
 	}
@@ -288,10 +311,8 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-		free_packet( n->pkt );
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+		release_packet (n->pkt);
 	    free_node( n );
 	}
 	else
@@ -35,6 +35,7 @@
 #include "packet.h"
 #include "keyring.h"
 #include "keydb.h"
+#include "trustdb.h"
 #include "i18n.h"
 
 static int active_handles;
@@ -562,6 +563,7 @@ int
 keydb_update_keyblock (KEYDB_HANDLE hd, KBNODE kb)
 {
     int rc = 0;
+    byte stamp[20];
 
     if (!hd)
         return G10ERR_INV_ARG;
@@ -576,6 +578,9 @@ keydb_update_keyblock (KEYDB_HANDLE hd, KBNODE kb)
     if (rc)
         return rc;
 
+    if (!hd->active[hd->found].secret)
+      keydb_get_stamp (stamp);
+
     switch (hd->active[hd->found].type) {
       case KEYDB_RESOURCE_TYPE_NONE:
       case KEYDB_RESOURCE_TYPE_KEYBOX:
@@ -586,6 +591,8 @@ keydb_update_keyblock (KEYDB_HANDLE hd, KBNODE kb)
         break;
     }
 
+    if (!rc && !hd->active[hd->found].secret)
+      trustdb_journal_change (kb, stamp);
     unlock_all (hd);
     return rc;
 }
@@ -599,6 +606,7 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, KBNODE kb)
 {
     int rc = -1;
     int idx;
+    byte stamp[20];
 
     if (!hd)
         return G10ERR_INV_ARG;
@@ -617,6 +625,9 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, KBNODE kb)
     if (rc)
         return rc;
 
+    if (!hd->active[idx].secret)
+      keydb_get_stamp (stamp);
+
     switch (hd->active[idx].type) {
       case KEYDB_RESOURCE_TYPE_NONE:
       case KEYDB_RESOURCE_TYPE_KEYBOX:
@@ -627,6 +638,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, KBNODE kb)
         break;
     }
 
+    if (!rc && !hd->active[idx].secret)
+      trustdb_journal_change (kb, stamp);
     unlock_all (hd);
     return rc;
 }
@@ -639,6 +652,7 @@ int
 keydb_delete_keyblock (KEYDB_HANDLE hd)
 {
     int rc = -1;
+    byte stamp[20];
 
     if (!hd)
         return G10ERR_INV_ARG;
@@ -653,6 +667,9 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
     if (rc)
         return rc;
 
+    if (!hd->active[hd->found].secret)
+      keydb_get_stamp (stamp);
+
     switch (hd->active[hd->found].type) {
       case KEYDB_RESOURCE_TYPE_NONE:
       case KEYDB_RESOURCE_TYPE_KEYBOX:
@@ -663,6 +680,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
         break;
     }
 
+    if (!rc && !hd->active[hd->found].secret)
+      trustdb_journal_change (NULL, stamp);
     unlock_all (hd);
     return rc;
 }
@@ -755,6 +774,83 @@ keydb_rebuild_caches (int noisy)
 
 
 
+/*
+ * Bulk mode for the import: Changes to the public keyrings are
+ * collected and written with one copy of the keyring for each N
+ * changes.  See keyring.c for details.
+ */
+void
+keydb_set_bulk_size (unsigned int n)
+{
+  keyring_set_bulk_size (n);
+}
+
+int
+keydb_bulk_begin (void)
+{
+  if (opt.dry_run)
+    return 0;
+  return keyring_bulk_begin ();
+}
+
+/* Write the collected changes and journal them for the trustdb.  */
+static int
+bulk_flush (void)
+{
+  byte stamp[20];
+  int rc;
+
+  keydb_get_stamp (stamp);
+  rc = keyring_bulk_flush ();
+  trustdb_journal_change (NULL, stamp);
+  return rc;
+}
+
+int
+keydb_bulk_end (void)
+{
+  int rc = 0;
+
+  if (keyring_bulk_pending (NULL, 0))
+    rc = bulk_flush ();
+  keyring_bulk_end ();
+  return rc;
+}
+
+
+/*
+ * Store a hash over the names and the state of the files of all
+ * public keyrings at STAMP, which must provide space for 20 bytes.
+ * The value changes with each modification of one of the keyrings.
+ */
+void
+keydb_get_stamp (byte *stamp)
+{
+  gcry_md_hd_t md;
+  int i;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    BUG ();
+  for (i=0; i < used_resources; i++)
+    {
+      if (all_resources[i].secret)
+        continue;
+      switch (all_resources[i].type)
+        {
+        case KEYDB_RESOURCE_TYPE_NONE: /* ignore */
+        case KEYDB_RESOURCE_TYPE_KEYBOX: /* ignore */
+          break;
+        case KEYDB_RESOURCE_TYPE_KEYRING:
+          keyring_hash_stamp (all_resources[i].token, md);
+          break;
+        }
+    }
+  gcry_md_final (md);
+  memcpy (stamp, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+}
+
+
 /*
  * Start the next search on this handle right at the beginning
  */
@@ -796,6 +892,17 @@ keydb_search2 (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     if (!hd)
         return G10ERR_INV_ARG;
 
+    /* Make sure that we don't miss changes collected in bulk mode;
+       they only affect the public keyrings.  */
+    if (hd->used && !hd->active[0].secret
+        && keyring_bulk_pending (desc, ndesc))
+      {
+        rc = bulk_flush ();
+        if (rc)
+          return rc;
+        rc = -1;
+      }
+
     while (rc == -1 && hd->current >= 0 && hd->current < hd->used) {
         switch (hd->active[hd->current].type) {
           case KEYDB_RESOURCE_TYPE_NONE:
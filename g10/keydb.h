@@ -126,6 +126,7 @@ typedef enum {
     KEYDB_SEARCH_MODE_FPR16,
     KEYDB_SEARCH_MODE_FPR20,
     KEYDB_SEARCH_MODE_FPR,
+    KEYDB_SEARCH_MODE_KEYGRIP,
     KEYDB_SEARCH_MODE_FIRST,
     KEYDB_SEARCH_MODE_NEXT
 } KeydbSearchMode;
@@ -138,6 +139,7 @@ struct keydb_search_desc {
         const char *name;
         byte fpr[MAX_FINGERPRINT_LEN];
         u32  kid[2];
+        byte grip[20];
     } u;
     int exact;
 };
@@ -166,6 +168,10 @@ int keydb_insert_keyblock (KEYDB_HANDLE hd, KBNODE kb);
 int keydb_delete_keyblock (KEYDB_HANDLE hd);
 int keydb_locate_writable (KEYDB_HANDLE hd, const char *reserved);
 void keydb_rebuild_caches (int noisy);
+void keydb_get_stamp (byte *stamp);
+void keydb_set_bulk_size (unsigned int n);
+int keydb_bulk_begin (void);
+int keydb_bulk_end (void);
 int keydb_search_reset (KEYDB_HANDLE hd);
 #define keydb_search(a,b,c) keydb_search2((a),(b),(c),NULL)
 int keydb_search2 (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
@@ -218,7 +224,10 @@ void next_to_last_passphrase(void);
 /*-- getkey.c --*/
 int classify_user_id( const char *name, KEYDB_SEARCH_DESC *desc);
 void cache_public_key( PKT_public_key *pk );
+void cache_keyblock_user_id (KBNODE keyblock);
 void getkey_disable_caches(void);
+unsigned int getkey_set_cache_size (unsigned long nentries);
+void getkey_print_stats (void);
 int get_pubkey( PKT_public_key *pk, u32 *keyid );
 int get_pubkey_fast ( PKT_public_key *pk, u32 *keyid );
 KBNODE get_pubkeyblock( u32 *keyid );
@@ -294,6 +303,7 @@ const char *colon_datestr_from_sig (PKT_signature *sig);
 const char *colon_expirestr_from_sig (PKT_signature *sig);
 byte *fingerprint_from_sk( PKT_secret_key *sk, byte *buf, size_t *ret_len );
 byte *fingerprint_from_pk( PKT_public_key *pk, byte *buf, size_t *ret_len );
+int keygrip_from_pk (PKT_public_key *pk, unsigned char *array);
 char *serialno_and_fpr_from_sk (const unsigned char *sn, size_t snlen,
                                 PKT_secret_key *sk);
 
@@ -301,6 +311,7 @@ char *serialno_and_fpr_from_sk (const unsigned char *sn, size_t snlen,
 KBNODE new_kbnode( PACKET *pkt );
 KBNODE clone_kbnode( KBNODE node );
 void release_kbnode( KBNODE n );
+void kbnode_print_stats (void);
 void delete_kbnode( KBNODE node );
 void add_kbnode( KBNODE root, KBNODE node );
 void insert_kbnode( KBNODE root, KBNODE node, int pkttype );
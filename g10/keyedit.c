@@ -309,6 +309,8 @@ check_all_keysigs( KBNODE keyblock, int only_selected )
     int selected = !only_selected;
     int anyuid = 0;
 
+    check_keyblock_sigs (keyblock, 0);
+
     for( kbctx=NULL; (node=walk_kbnode( keyblock, &kbctx, 0)) ; ) {
 	if( node->pkt->pkttype == PKT_USER_ID ) {
 	    PKT_user_id *uid = node->pkt->pkt.user_id;
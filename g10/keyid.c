@@ -59,6 +59,9 @@ hash_public_key( gcry_md_hd_t md, PKT_public_key *pk )
   unsigned int n = 6;
   unsigned int nn[PUBKEY_MAX_NPKEY];
   byte *pp[PUBKEY_MAX_NPKEY];
+  int on_heap[PUBKEY_MAX_NPKEY];
+  byte buffer[2048];  /* Enough for all parameters of common keys.  */
+  size_t used = 0;
   int i;
   unsigned int nbits;
   size_t nbytes;
@@ -80,7 +83,14 @@ hash_public_key( gcry_md_hd_t md, PKT_public_key *pk )
       {
 	if (gcry_mpi_print (GCRYMPI_FMT_PGP, NULL, 0, &nbytes, pk->pkey[i]))
           BUG ();
-	pp[i] = xmalloc (nbytes);
+        on_heap[i] = (used + nbytes > sizeof buffer);
+        if (on_heap[i])
+          pp[i] = xmalloc (nbytes);
+        else
+          {
+            pp[i] = buffer + used;
+            used += nbytes;
+          }
 	if (gcry_mpi_print (GCRYMPI_FMT_PGP, pp[i], nbytes,
                             &nbytes, pk->pkey[i]))
           BUG ();
@@ -120,7 +130,8 @@ hash_public_key( gcry_md_hd_t md, PKT_public_key *pk )
     for(i=0; i < npkey; i++ )
       {
 	gcry_md_write ( md, pp[i], nn[i] );
-	xfree(pp[i]);
+        if (on_heap[i])
+          xfree(pp[i]);
       }
 }
 
@@ -807,6 +818,53 @@ fingerprint_from_sk( PKT_secret_key *sk, byte *array, size_t *ret_len )
 }
 
 
+/* Compute the keygrip of the public key PK and store it at ARRAY,
+   which must provide space for 20 bytes.  The keygrip is the
+   protocol independent identifier as used by gpg-agent.  Returns 0 on
+   success or an error code if the algorithm is not supported.  */
+int
+keygrip_from_pk (PKT_public_key *pk, unsigned char *array)
+{
+  gcry_sexp_t s_pkey;
+  int rc;
+
+  switch (pk->pubkey_algo)
+    {
+    case GCRY_PK_DSA:
+      rc = gcry_sexp_build (&s_pkey, NULL,
+                            "(public-key(dsa(p%m)(q%m)(g%m)(y%m)))",
+                            pk->pkey[0], pk->pkey[1],
+                            pk->pkey[2], pk->pkey[3]);
+      break;
+
+    case GCRY_PK_ELG:
+    case GCRY_PK_ELG_E:
+      rc = gcry_sexp_build (&s_pkey, NULL,
+                            "(public-key(elg(p%m)(g%m)(y%m)))",
+                            pk->pkey[0], pk->pkey[1], pk->pkey[2]);
+      break;
+
+    case GCRY_PK_RSA:
+    case GCRY_PK_RSA_E:
+    case GCRY_PK_RSA_S:
+      rc = gcry_sexp_build (&s_pkey, NULL,
+                            "(public-key(rsa(n%m)(e%m)))",
+                            pk->pkey[0], pk->pkey[1]);
+      break;
+
+    default:
+      return gpg_error (GPG_ERR_PUBKEY_ALGO);
+    }
+  if (rc)
+    return rc;
+
+  if (!gcry_pk_get_keygrip (s_pkey, array))
+    rc = gpg_error (GPG_ERR_GENERAL);
+  gcry_sexp_release (s_pkey);
+  return rc;
+}
+
+
 /* Create a serialno/fpr string from the serial number and the secret
    key.  Caller must free the returned string.  There is no error
    return.  */
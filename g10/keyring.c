@@ -35,6 +35,7 @@
 #include "options.h"
 #include "main.h" /*for check_key_signature()*/
 #include "i18n.h"
+#include "host2net.h"
 
 /* off_item is a funny named for an object used to keep track of known
  * keys.  The idea was to use the offset to seek to the known keyblock, but
@@ -58,6 +59,8 @@ struct keyring_name
   DOTLOCK lockhd;
   int is_locked;
   int did_full_scan;
+  int idx_broken;   /* The index can't be used for this keyring.  */
+  unsigned int generation; /* Incremented with each rewrite in bulk mode. */
   char fname[1];
 };
 typedef struct keyring_name const * CONST_KR_NAME;
@@ -68,6 +71,33 @@ static int active_handles;
 static OffsetHashTable kr_offtbl;
 static int kr_offtbl_ready;
 
+/* Default number of keyblock changes collected in bulk mode before
+   the keyring is rewritten.  */
+#define KEYRING_BULK_SIZE 1000
+
+/* A keyblock change collected in bulk mode.  */
+struct bulk_item
+{
+  struct bulk_item *next;
+  CONST_KR_NAME kr;
+  off_t offset;           /* Offset of the replaced keyblock and */
+  unsigned int n_packets; /* its number of packets; 0 for an insert.  */
+  IOBUF data;             /* The new keyblock or NULL for a delete.  */
+};
+
+/* State of the bulk mode.  ITEMS is in reverse order of the changes;
+   KIDS has the key IDs and the fingerprint based IDs (see bulk_fprid)
+   of all keys in ITEMS.  */
+static struct
+{
+  int active;
+  unsigned int size;
+  unsigned int count;
+  struct bulk_item *items;
+  OffsetHashTable kids;
+  int any;  /* Set if a search may need any of the changes.  */
+} bulk = { 0, KEYRING_BULK_SIZE };
+
 
 struct keyring_handle {
   CONST_KR_NAME resource;
@@ -75,6 +105,7 @@ struct keyring_handle {
   struct {
     CONST_KR_NAME kr;
     IOBUF iobuf;
+    unsigned int generation; /* Of KR when IOBUF was opened.  */
     int eof;
     int error;
   } current;
@@ -84,6 +115,7 @@ struct keyring_handle {
     size_t pk_no;
     size_t uid_no;
     unsigned int n_packets; /*used for delete and update*/
+    unsigned int generation; /* Of KR when OFFSET was valid.  */
   } found;
   struct {
     char *name;
@@ -95,6 +127,14 @@ struct keyring_handle {
 
 static int do_copy (int mode, const char *fname, KBNODE root, int secret,
                     off_t start_offset, unsigned int n_packets );
+static int create_tmp_file (const char *template,
+                            char **r_bakfname, char **r_tmpfname, IOBUF *r_fp);
+static int rename_tmp_file (const char *bakfname, const char *tmpfname,
+                            const char *fname, int secret);
+static int write_keyblock (IOBUF fp, KBNODE keyblock);
+static int bulk_add (CONST_KR_NAME kr, KBNODE kb,
+                     off_t offset, unsigned int n_packets);
+static int refresh_found (KEYRING_HANDLE hd, KBNODE kb);
 
 
 
@@ -107,7 +147,6 @@ new_offset_item (void)
   return k;
 }
 
-#if 0
 static void
 release_offset_items (struct off_item *k)
 {
@@ -119,7 +158,6 @@ release_offset_items (struct off_item *k)
       xfree (k);
     }
 }
-#endif
 
 static OffsetHashTable 
 new_offset_hash_table (void)
@@ -130,7 +168,6 @@ new_offset_hash_table (void)
   return tbl;
 }
 
-#if 0
 static void
 release_offset_hash_table (OffsetHashTable tbl)
 {
@@ -142,7 +179,6 @@ release_offset_hash_table (OffsetHashTable tbl)
     release_offset_items (tbl[i]);
   xfree (tbl);
 }
-#endif
 
 static struct off_item *
 lookup_offset_hash_table (OffsetHashTable tbl, u32 *kid)
@@ -194,6 +230,746 @@ update_offset_hash_table_from_kb (OffsetHashTable tbl, KBNODE node, off_t off)
     }
 }
 
+
+
+/*
+ * The keyring index is an optional file kept next to a public keyring
+ * (e.g. "pubring.gpg.idx") with three sorted tables mapping key IDs,
+ * fingerprints and keygrips to the offset of the keyblock holding the
+ * key.  It is only used if --keyring-index is active.  The header
+ * records size, mtime and inode of the keyring at the time the index
+ * was written so that any modification done behind our back is
+ * detected; a generation counter is bumped with each update.  The
+ * index is never trusted blindly: keyring_search still parses the
+ * keyblock at the offset and falls back to a full scan on a mismatch.
+ *
+ * Layout (all integers are big endian):
+ *
+ *   0  4  magic "KIDX"
+ *   4  1  version
+ *   5  3  reserved
+ *   8  4  generation
+ *  12  4  number of key ID records
+ *  16  4  number of fingerprint records
+ *  20  4  number of keygrip records
+ *  24  8  size of the keyring
+ *  32  8  mtime of the keyring
+ *  40  8  inode of the keyring
+ *  48     key ID table, fingerprint table, keygrip table
+ *
+ * Each record is the key (8 or 20 bytes) followed by the 8 byte offset
+ * of the keyblock.  Records are sorted by key and then by offset.
+ */
+#define KRIDX_HDRLEN    48
+#define KRIDX_VERSION   1
+#define KRIDX_MAXRECLEN 28
+
+enum { KRIDX_KID = 0, KRIDX_FPR, KRIDX_GRIP, KRIDX_NTABLES };
+static const size_t kridx_keylen[KRIDX_NTABLES] = { 8, 20, 20 };
+#define KRIDX_RECLEN(t) (kridx_keylen[(t)] + 8)
+
+#define KRIDX_HI(v) ((u32)(((v) >> 16) >> 16))
+#define KRIDX_LO(v) ((u32)((v) & 0xffffffff))
+
+struct kridx_header
+{
+  u32 generation;
+  u32 count[KRIDX_NTABLES];
+  u32 size[2];    /* High and low part of the size, */
+  u32 mtime[2];   /* the modification time */
+  u32 ino[2];     /* and the inode of the keyring.  */
+};
+
+struct kridx_entry
+{
+  byte key[20];   /* Key IDs use only the first 8 bytes.  */
+  off_t off;      /* Offset of the keyblock.  */
+};
+
+/* Growable arrays of entries collected from keyblocks.  */
+struct kridx_list
+{
+  struct kridx_entry *items[KRIDX_NTABLES];
+  size_t count[KRIDX_NTABLES];
+  size_t size[KRIDX_NTABLES];
+};
+
+
+static char *
+kridx_fname (const char *fname)
+{
+  char *idxfname;
+
+#ifdef USE_ONLY_8DOT3
+  if (strlen (fname) > 4
+      && !strcmp (fname+strlen(fname)-4, EXTSEP_S "gpg"))
+    {
+      idxfname = xstrdup (fname);
+      strcpy (idxfname+strlen(fname)-4, EXTSEP_S "idx");
+      return idxfname;
+    }
+#endif
+  idxfname = xmalloc (strlen (fname) + 5);
+  strcpy (stpcpy (idxfname, fname), EXTSEP_S "idx");
+  return idxfname;
+}
+
+
+static void
+kridx_set_stat (struct kridx_header *hdr, const struct stat *st)
+{
+  hdr->size[0]  = KRIDX_HI (st->st_size);
+  hdr->size[1]  = KRIDX_LO (st->st_size);
+  hdr->mtime[0] = KRIDX_HI (st->st_mtime);
+  hdr->mtime[1] = KRIDX_LO (st->st_mtime);
+  hdr->ino[0]   = KRIDX_HI (st->st_ino);
+  hdr->ino[1]   = KRIDX_LO (st->st_ino);
+}
+
+
+static int
+kridx_stat_matches (const struct kridx_header *hdr, const struct stat *st)
+{
+  struct kridx_header tmp;
+
+  kridx_set_stat (&tmp, st);
+  return (!memcmp (tmp.size, hdr->size, sizeof tmp.size)
+          && !memcmp (tmp.mtime, hdr->mtime, sizeof tmp.mtime)
+          && !memcmp (tmp.ino, hdr->ino, sizeof tmp.ino));
+}
+
+
+static void
+kridx_put_off (byte *p, off_t off)
+{
+  u32tobuf (p, KRIDX_HI (off));
+  u32tobuf (p+4, KRIDX_LO (off));
+}
+
+
+static off_t
+kridx_get_off (const byte *p)
+{
+  off_t off;
+
+  off = (u32)buftou32 (p);
+  off = (off << 16) << 16;
+  return off | (u32)buftou32 (p+4);
+}
+
+
+/* Read the header of the index FP into HDR.  Returns 0 on success or
+   -1 if this is not a valid index.  */
+static int
+kridx_read_header (FILE *fp, struct kridx_header *hdr)
+{
+  byte buf[KRIDX_HDRLEN];
+  int i;
+
+  if (fread (buf, KRIDX_HDRLEN, 1, fp) != 1
+      || memcmp (buf, "KIDX", 4) || buf[4] != KRIDX_VERSION)
+    return -1;
+  hdr->generation = buftou32 (buf+8);
+  for (i=0; i < KRIDX_NTABLES; i++)
+    hdr->count[i] = buftou32 (buf+12+4*i);
+  hdr->size[0]  = buftou32 (buf+24);
+  hdr->size[1]  = buftou32 (buf+28);
+  hdr->mtime[0] = buftou32 (buf+32);
+  hdr->mtime[1] = buftou32 (buf+36);
+  hdr->ino[0]   = buftou32 (buf+40);
+  hdr->ino[1]   = buftou32 (buf+44);
+  return 0;
+}
+
+
+static int
+kridx_write_header (FILE *fp, const struct kridx_header *hdr)
+{
+  byte buf[KRIDX_HDRLEN];
+  int i;
+
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, "KIDX", 4);
+  buf[4] = KRIDX_VERSION;
+  u32tobuf (buf+8, hdr->generation);
+  for (i=0; i < KRIDX_NTABLES; i++)
+    u32tobuf (buf+12+4*i, hdr->count[i]);
+  u32tobuf (buf+24, hdr->size[0]);
+  u32tobuf (buf+28, hdr->size[1]);
+  u32tobuf (buf+32, hdr->mtime[0]);
+  u32tobuf (buf+36, hdr->mtime[1]);
+  u32tobuf (buf+40, hdr->ino[0]);
+  u32tobuf (buf+44, hdr->ino[1]);
+  return fwrite (buf, KRIDX_HDRLEN, 1, fp) == 1? 0 : -1;
+}
+
+
+static int
+kridx_cmp_entries (const void *a_arg, const void *b_arg)
+{
+  const struct kridx_entry *a = a_arg;
+  const struct kridx_entry *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->key, b->key, sizeof a->key);
+  if (cmp)
+    return cmp;
+  return a->off < b->off? -1 : a->off > b->off;
+}
+
+
+/* Read record number IDX of table TBL which starts at file offset
+   BASE into E.  */
+static int
+kridx_read_record (FILE *fp, long base, int tbl, u32 idx,
+                   struct kridx_entry *e)
+{
+  byte buf[KRIDX_MAXRECLEN];
+  size_t n = kridx_keylen[tbl];
+
+  if (fseek (fp, base + (long)idx * KRIDX_RECLEN (tbl), SEEK_SET)
+      || fread (buf, KRIDX_RECLEN (tbl), 1, fp) != 1)
+    return -1;
+  memset (e->key, 0, sizeof e->key);
+  memcpy (e->key, buf, n);
+  e->off = kridx_get_off (buf+n);
+  return 0;
+}
+
+
+static void
+kridx_list_add (struct kridx_list *list, int tbl, const byte *key, off_t off)
+{
+  struct kridx_entry *e;
+
+  if (list->count[tbl] == list->size[tbl])
+    {
+      list->size[tbl] = list->size[tbl]? 2 * list->size[tbl] : 64;
+      list->items[tbl] = xrealloc (list->items[tbl],
+                                   list->size[tbl] * sizeof *e);
+    }
+  e = list->items[tbl] + list->count[tbl]++;
+  memset (e->key, 0, sizeof e->key);
+  memcpy (e->key, key, kridx_keylen[tbl]);
+  e->off = off;
+}
+
+
+static void
+kridx_list_add_pk (struct kridx_list *list, PKT_public_key *pk, off_t off)
+{
+  byte buf[MAX_FINGERPRINT_LEN];
+  u32 kid[2];
+  size_t n;
+
+  keyid_from_pk (pk, kid);
+  u32tobuf (buf, kid[0]);
+  u32tobuf (buf+4, kid[1]);
+  kridx_list_add (list, KRIDX_KID, buf, off);
+
+  fingerprint_from_pk (pk, buf, &n);
+  while (n < 20) /* fill up to 20 bytes */
+    buf[n++] = 0;
+  kridx_list_add (list, KRIDX_FPR, buf, off);
+
+  if (!keygrip_from_pk (pk, buf))
+    kridx_list_add (list, KRIDX_GRIP, buf, off);
+}
+
+
+static void
+kridx_list_sort (struct kridx_list *list)
+{
+  int tbl;
+
+  for (tbl=0; tbl < KRIDX_NTABLES; tbl++)
+    if (list->count[tbl] > 1)
+      qsort (list->items[tbl], list->count[tbl], sizeof *list->items[tbl],
+             kridx_cmp_entries);
+}
+
+
+static void
+kridx_list_release (struct kridx_list *list)
+{
+  int tbl;
+
+  for (tbl=0; tbl < KRIDX_NTABLES; tbl++)
+    xfree (list->items[tbl]);
+}
+
+
+/* Write a new index described by HDR to IDXFNAME.  The records are
+   merged from the old index OLDFP with header OLDHDR (OLDFP may be
+   NULL) and the sorted LIST.  Records of the old index pointing to
+   the keyblock at DROPOFF are removed and records of keyblocks
+   located after DROPOFF are moved by DELTA; DROPOFF may be -1 to keep
+   the old records as they are.  If FNAME is not NULL the index has
+   been built without holding the lock of the keyring FNAME; in this
+   case the keyring is checked against the stamp in HDR again before
+   the index is installed.  */
+static int
+kridx_write (const char *idxfname, struct kridx_header *hdr,
+             FILE *oldfp, const struct kridx_header *oldhdr,
+             struct kridx_list *list, off_t dropoff, off_t delta,
+             const char *fname)
+{
+  char *tmpfname;
+  FILE *fp;
+  byte buf[KRIDX_MAXRECLEN];
+  struct stat st;
+  mode_t oldmask;
+  int tbl;
+  int rc = 0;
+
+  /* Other processes may rebuild the index at the same time; use a
+     temporary file of our own.  */
+  tmpfname = xasprintf ("%s" EXTSEP_S "%lu" EXTSEP_S "tmp",
+                        idxfname, (unsigned long)getpid ());
+  remove (tmpfname);
+
+  oldmask = umask (077);
+  fp = fopen (tmpfname, "wb");
+  umask (oldmask);
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      log_info (_("can't create `%s': %s\n"), tmpfname, strerror (errno));
+      xfree (tmpfname);
+      return rc;
+    }
+
+  /* Write the header first; it is rewritten with the actual counts
+     at the end.  */
+  for (tbl=0; tbl < KRIDX_NTABLES; tbl++)
+    hdr->count[tbl] = 0;
+  if (kridx_write_header (fp, hdr))
+    goto write_error;
+  if (oldfp && fseek (oldfp, KRIDX_HDRLEN, SEEK_SET))
+    goto read_error;
+
+  for (tbl=0; tbl < KRIDX_NTABLES; tbl++)
+    {
+      size_t keylen = kridx_keylen[tbl];
+      size_t reclen = KRIDX_RECLEN (tbl);
+      u32 nold = oldfp? oldhdr->count[tbl] : 0;
+      size_t inew = 0;
+      struct kridx_entry old, *new;
+      int have_old = 0;
+
+      for (;;)
+        {
+          if (!have_old && nold)
+            {
+              if (fread (buf, reclen, 1, oldfp) != 1)
+                goto read_error;
+              nold--;
+              memset (old.key, 0, sizeof old.key);
+              memcpy (old.key, buf, keylen);
+              old.off = kridx_get_off (buf+keylen);
+              if (dropoff != -1 && old.off == dropoff)
+                continue;
+              if (dropoff != -1 && old.off > dropoff)
+                old.off += delta;
+              have_old = 1;
+            }
+          new = list && inew < list->count[tbl]? list->items[tbl]+inew : NULL;
+          if (have_old && (!new || kridx_cmp_entries (&old, new) <= 0))
+            {
+              memcpy (buf, old.key, keylen);
+              kridx_put_off (buf+keylen, old.off);
+              have_old = 0;
+            }
+          else if (new)
+            {
+              memcpy (buf, new->key, keylen);
+              kridx_put_off (buf+keylen, new->off);
+              inew++;
+            }
+          else
+            break;
+          if (fwrite (buf, reclen, 1, fp) != 1)
+            goto write_error;
+          hdr->count[tbl]++;
+        }
+    }
+
+  if (fseek (fp, 0, SEEK_SET) || kridx_write_header (fp, hdr))
+    goto write_error;
+  if (fclose (fp))
+    {
+      fp = NULL;
+      goto write_error;
+    }
+  fp = NULL;
+
+  /* The keyring may have been replaced while we were reading it.
+     Such an index would claim that keys are missing which are
+     actually there, thus we better don't install it.  */
+  if (fname && (stat (fname, &st) || !kridx_stat_matches (hdr, &st)))
+    {
+      if (DBG_CACHE)
+        log_debug ("keyring `%s' changed while building the index\n", fname);
+      remove (tmpfname);
+      xfree (tmpfname);
+      return gpg_error (GPG_ERR_EAGAIN);
+    }
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  remove (idxfname);
+#endif
+  if (rename (tmpfname, idxfname))
+    {
+      rc = gpg_error_from_syserror ();
+      log_info (_("renaming `%s' to `%s' failed: %s\n"),
+                 tmpfname, idxfname, strerror (errno));
+      remove (tmpfname);
+    }
+  else if (DBG_CACHE)
+    log_debug ("keyring index `%s' written (generation %lu)\n",
+               idxfname, (ulong)hdr->generation);
+  xfree (tmpfname);
+  return rc;
+
+ read_error:
+  rc = gpg_error (GPG_ERR_INV_KEYRING);
+  log_info ("%s: error reading keyring index\n", idxfname);
+  goto leave;
+
+ write_error:
+  rc = gpg_error_from_syserror ();
+  log_info (_("error writing `%s': %s\n"), tmpfname, strerror (errno));
+
+ leave:
+  if (fp)
+    fclose (fp);
+  remove (tmpfname);
+  xfree (tmpfname);
+  return rc;
+}
+
+
+/* Scan the public keyring FNAME and write a fresh index for it.  */
+static int
+kridx_build (const char *fname)
+{
+  struct stat st;
+  struct kridx_header hdr;
+  struct kridx_list list;
+  char *idxfname;
+  FILE *fp;
+  IOBUF a;
+  PACKET pkt;
+  off_t offset, main_offset = -1;
+  int rc, save_mode;
+
+  if (stat (fname, &st))
+    return gpg_error_from_syserror ();
+
+  a = iobuf_open (fname);
+  if (!a)
+    {
+      rc = gpg_error_from_syserror ();
+      log_info (_("can't open `%s'\n"), fname);
+      return rc;
+    }
+
+  memset (&list, 0, sizeof list);
+  init_packet (&pkt);
+  save_mode = set_packet_list_mode (0);
+  while (!(rc = search_packet (a, &pkt, &offset, 0)))
+    {
+      if (pkt.pkttype == PKT_PUBLIC_KEY)
+        main_offset = offset;
+      if (main_offset != -1
+          && (pkt.pkttype == PKT_PUBLIC_KEY
+              || pkt.pkttype == PKT_PUBLIC_SUBKEY))
+        kridx_list_add_pk (&list, pkt.pkt.public_key, main_offset);
+      free_packet (&pkt);
+    }
+  free_packet (&pkt);
+  set_packet_list_mode (save_mode);
+  iobuf_close (a);
+
+  idxfname = kridx_fname (fname);
+  if (rc == -1)
+    {
+      memset (&hdr, 0, sizeof hdr);
+      /* Continue the generation count of a stale index.  */
+      fp = fopen (idxfname, "rb");
+      if (fp)
+        {
+          struct kridx_header oldhdr;
+
+          if (!kridx_read_header (fp, &oldhdr))
+            hdr.generation = oldhdr.generation + 1;
+          fclose (fp);
+        }
+      kridx_set_stat (&hdr, &st);
+      kridx_list_sort (&list);
+      rc = kridx_write (idxfname, &hdr, NULL, NULL, &list, -1, 0, fname);
+      if (!rc && opt.verbose)
+        log_info (_("%s: keyring index created\n"), fname);
+    }
+  else
+    log_info ("%s: can't build keyring index: %s\n",
+               fname, g10_errstr (rc));
+
+  xfree (idxfname);
+  kridx_list_release (&list);
+  return rc;
+}
+
+
+/* Look up the key described by DESC in the index of keyring KR and
+   store the offset of the first keyblock at or after MINOFF holding
+   that key at R_OFF.  Returns 0 on success, -1 if the index tells us
+   that there is no such keyblock, or an error code if the index can't
+   be used.  A missing or outdated index is rebuilt.  */
+static int
+kridx_lookup (CONST_KR_NAME kr, KEYDB_SEARCH_DESC *desc, off_t minoff,
+              off_t *r_off)
+{
+  struct kridx_header hdr;
+  struct kridx_entry want, e;
+  struct stat st;
+  char *idxfname;
+  FILE *fp = NULL;
+  long base;
+  u32 lo, hi, mid;
+  int i, tbl, rc;
+  int tried_build = 0;
+
+  memset (&want, 0, sizeof want);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      tbl = KRIDX_KID;
+      u32tobuf (want.key, desc->u.kid[0]);
+      u32tobuf (want.key+4, desc->u.kid[1]);
+      break;
+    case KEYDB_SEARCH_MODE_FPR16:
+      tbl = KRIDX_FPR;
+      memcpy (want.key, desc->u.fpr, 16);
+      break;
+    case KEYDB_SEARCH_MODE_FPR20:
+    case KEYDB_SEARCH_MODE_FPR:
+      tbl = KRIDX_FPR;
+      memcpy (want.key, desc->u.fpr, 20);
+      break;
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      tbl = KRIDX_GRIP;
+      memcpy (want.key, desc->u.grip, 20);
+      break;
+    default:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  want.off = minoff;
+
+  idxfname = kridx_fname (kr->fname);
+  for (;;)
+    {
+      if (stat (kr->fname, &st))
+        {
+          rc = gpg_error_from_syserror ();
+          goto leave;
+        }
+      fp = fopen (idxfname, "rb");
+      if (fp && !kridx_read_header (fp, &hdr)
+          && kridx_stat_matches (&hdr, &st))
+        break;
+      if (fp)
+        {
+          fclose (fp);
+          fp = NULL;
+        }
+      if (tried_build || kr->readonly)
+        {
+          rc = gpg_error (GPG_ERR_NO_DATA);
+          goto leave;
+        }
+      if (DBG_CACHE)
+        log_debug ("keyring index for `%s' is not usable - rebuilding\n",
+                   kr->fname);
+      tried_build = 1;
+      rc = kridx_build (kr->fname);
+      if (rc)
+        goto leave;
+    }
+
+  /* Binary search for the first record not less than WANT.  */
+  base = KRIDX_HDRLEN;
+  for (i=0; i < tbl; i++)
+    base += (long)hdr.count[i] * KRIDX_RECLEN (i);
+  lo = 0;
+  hi = hdr.count[tbl];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (kridx_read_record (fp, base, tbl, mid, &e))
+        {
+          rc = gpg_error (GPG_ERR_INV_KEYRING);
+          goto leave;
+        }
+      if (kridx_cmp_entries (&e, &want) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  rc = -1;
+  if (lo < hdr.count[tbl])
+    {
+      if (kridx_read_record (fp, base, tbl, lo, &e))
+        rc = gpg_error (GPG_ERR_INV_KEYRING);
+      else if (!memcmp (e.key, want.key, sizeof e.key))
+        {
+          *r_off = e.off;
+          rc = 0;
+        }
+    }
+
+  if (DBG_CACHE)
+    log_debug ("keyring index lookup in `%s' (generation %lu): %s\n",
+               kr->fname, (ulong)hdr.generation,
+               !rc? "found" : rc == -1? "not found" : g10_errstr (rc));
+
+ leave:
+  if (fp)
+    fclose (fp);
+  xfree (idxfname);
+  return rc;
+}
+
+
+/* Update the index of keyring FNAME after do_copy replaced the
+   keyring described by OLDST.  MODE is the do_copy mode; START_OFFSET
+   and OLD_LEN describe the deleted or updated keyblock and NEW_LEN is
+   the length of the new keyblock ROOT.  If the index does not match
+   the old keyring or can't be updated it is removed so that it gets
+   rebuilt on the next lookup.  */
+static void
+kridx_update (const char *fname, const struct stat *oldst, int mode,
+              off_t start_offset, off_t old_len, KBNODE root, off_t new_len)
+{
+  struct kridx_header oldhdr, hdr;
+  struct kridx_list list;
+  struct stat st;
+  char *idxfname;
+  FILE *fp;
+  off_t newoff, dropoff;
+  int rc = -1;
+
+  memset (&list, 0, sizeof list);
+  idxfname = kridx_fname (fname);
+  fp = fopen (idxfname, "rb");
+  if (!fp || kridx_read_header (fp, &oldhdr)
+      || !kridx_stat_matches (&oldhdr, oldst)
+      || stat (fname, &st))
+    goto leave;
+
+  if (mode == 1)
+    {
+      newoff = oldst->st_size;
+      dropoff = -1;
+    }
+  else
+    newoff = dropoff = start_offset;
+
+  /* Copying the keyring silently drops deleted packets, in which case
+     we can't know the new offsets.  */
+  if (st.st_size != oldst->st_size - old_len + new_len)
+    {
+      if (DBG_CACHE)
+        log_debug ("keyring `%s' changed size unexpectedly\n", fname);
+      goto leave;
+    }
+
+  if (root)
+    {
+      KBNODE kbctx = NULL, node;
+
+      while ((node = walk_kbnode (root, &kbctx, 0)))
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+          kridx_list_add_pk (&list, node->pkt->pkt.public_key, newoff);
+      kridx_list_sort (&list);
+    }
+
+  memset (&hdr, 0, sizeof hdr);
+  hdr.generation = oldhdr.generation + 1;
+  kridx_set_stat (&hdr, &st);
+  rc = kridx_write (idxfname, &hdr, fp, &oldhdr, &list,
+                    dropoff, new_len - old_len, NULL);
+
+ leave:
+  if (fp)
+    fclose (fp);
+  if (rc)
+    remove (idxfname);
+  kridx_list_release (&list);
+  xfree (idxfname);
+}
+
+
+static void
+kridx_mark_broken (CONST_KR_NAME resource)
+{
+  KR_NAME kr;
+
+  for (kr=kr_names; kr; kr = kr->next)
+    if (kr == resource)
+      kr->idx_broken = 1;
+}
+
+
+/* Position the current iobuf of HD at the next keyblock at or after
+   MINOFF which the index lists for DESC and store its offset at
+   R_OFF.  Returns 0 on success, -1 if there is no such keyblock and 1
+   if the index is not usable; in the latter case the position is not
+   changed.  Other values are hard errors.  */
+static int
+kridx_seek (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc, off_t minoff,
+            off_t *r_off)
+{
+  int rc;
+
+  rc = kridx_lookup (hd->current.kr, desc, minoff, r_off);
+  if (rc == -1)
+    return -1;
+  if (rc)
+    {
+      /* A keyring which changed while we were indexing it is worth
+         another try with the next search.  */
+      if (gpg_err_code (rc) != GPG_ERR_EAGAIN)
+        kridx_mark_broken (hd->current.kr);
+      return 1;
+    }
+  if (iobuf_seek (hd->current.iobuf, *r_off))
+    {
+      log_error ("can't seek `%s'\n", hd->current.kr->fname);
+      return G10ERR_KEYRING_OPEN;
+    }
+  return 0;
+}
+
+
+/* The index of the current keyring of HD turned out to be wrong.
+   Disable it and go back to START_OFF for a regular scan.  */
+static int
+kridx_rewind (KEYRING_HANDLE hd, off_t start_off)
+{
+  log_info (_("%s: keyring index is out of date - ignored\n"),
+            hd->current.kr->fname);
+  kridx_mark_broken (hd->current.kr);
+  if (iobuf_seek (hd->current.iobuf, start_off))
+    {
+      log_error ("can't seek `%s'\n", hd->current.kr->fname);
+      return G10ERR_KEYRING_OPEN;
+    }
+  return 0;
+}
+
 /* 
  * Register a filename for plain keyring files.  ptr is set to a
  * pointer to be used to create a handles etc, or the already-issued
@@ -231,6 +1007,8 @@ keyring_register_filename (const char *fname, int secret, int readonly,
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->idx_broken = 0;
+    kr->generation = 0;
     /* keep a list of all issued pointers */
     kr->next = kr_names;
     kr_names = kr;
@@ -251,6 +1029,32 @@ keyring_is_writable (void *token)
 
   return r? (r->readonly || !access (r->fname, W_OK)) : 0;
 }
+
+
+/* Feed the name and the current size, mtime and inode of the keyring
+   file TOKEN into the hash context MD.  This is used to detect
+   modifications of the keyring.  */
+void
+keyring_hash_stamp (void *token, gcry_md_hd_t md)
+{
+  KR_NAME r = token;
+  struct stat st;
+  byte buf[24];
+
+  gcry_md_write (md, r->fname, strlen (r->fname) + 1);
+  if (stat (r->fname, &st))
+    memset (buf, 0, sizeof buf);
+  else
+    {
+      u32tobuf (buf,    KRIDX_HI (st.st_size));
+      u32tobuf (buf+4,  KRIDX_LO (st.st_size));
+      u32tobuf (buf+8,  KRIDX_HI (st.st_mtime));
+      u32tobuf (buf+12, KRIDX_LO (st.st_mtime));
+      u32tobuf (buf+16, KRIDX_HI (st.st_ino));
+      u32tobuf (buf+20, KRIDX_LO (st.st_ino));
+    }
+  gcry_md_write (md, buf, sizeof buf);
+}
     
 
 
@@ -339,7 +1143,8 @@ keyring_lock (KEYRING_HANDLE hd, int yes)
         }
     }
 
-    if (rc || !yes) {
+    /* In bulk mode the locks are kept until keyring_bulk_end.  */
+    if ((rc || !yes) && !bulk.active) {
         for (kr=kr_names; kr; kr = kr->next) {
             if (!keyring_is_writable(kr))
                 continue;
@@ -381,6 +1186,12 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
     if (!hd->found.kr)
         return -1; /* no successful search */
 
+    if (hd->found.generation != hd->found.kr->generation) {
+        log_error ("%s: keyring rewritten since the search\n",
+                   hd->found.kr->fname);
+        return G10ERR_GENERAL;
+    }
+
     a = iobuf_open (hd->found.kr->fname);
     if (!a)
       {
@@ -394,7 +1205,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	return G10ERR_KEYRING_OPEN;
     }
 
-    pkt = xmalloc (sizeof *pkt);
+    pkt = alloc_packet ();
     init_packet (pkt);
     hd->found.n_packets = 0;;
     lastnode = NULL;
@@ -473,7 +1284,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
             break;
           }
 
-        pkt = xmalloc (sizeof *pkt);
+        pkt = alloc_packet ();
         init_packet(pkt);
     }
     set_packet_list_mode(save_mode);
@@ -495,8 +1306,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
         }
 	*ret_kb = keyblock;
     }
-    free_packet (pkt);
-    xfree (pkt);
+    release_packet (pkt);
     iobuf_close(a);
 
     /* Make sure that future search operations fail immediately when
@@ -519,6 +1329,10 @@ keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     if (hd->found.kr->readonly)
       return gpg_error (GPG_ERR_EACCES);
 
+    rc = refresh_found (hd, kb);
+    if (rc)
+      return rc;
+
     if (!hd->found.n_packets) {
         /* need to know the number of packets - do a dummy get_keyblock*/
         rc = keyring_get_keyblock (hd, NULL);
@@ -537,8 +1351,11 @@ keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     hd->current.iobuf = NULL;
 
     /* do the update */
-    rc = do_copy (3, hd->found.kr->fname, kb, hd->secret,
-                  hd->found.offset, hd->found.n_packets );
+    if (bulk.active && !hd->secret)
+      rc = bulk_add (hd->found.kr, kb, hd->found.offset, hd->found.n_packets);
+    else
+      rc = do_copy (3, hd->found.kr->fname, kb, hd->secret,
+                    hd->found.offset, hd->found.n_packets );
     if (!rc) {
       if (!hd->secret && kr_offtbl)
         {
@@ -555,26 +1372,26 @@ int
 keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 {
     int rc;
-    const char *fname;
+    CONST_KR_NAME kr;
 
     if (!hd)
-        fname = NULL;
+        kr = NULL;
     else if (hd->found.kr)
       {
-        fname = hd->found.kr->fname;
-        if (hd->found.kr->readonly)
+        kr = hd->found.kr;
+        if (kr->readonly)
           return gpg_error (GPG_ERR_EACCES);
       }
     else if (hd->current.kr)
       {
-        fname = hd->current.kr->fname;
-        if (hd->current.kr->readonly)
+        kr = hd->current.kr;
+        if (kr->readonly)
           return gpg_error (GPG_ERR_EACCES);
       }
     else 
-        fname = hd->resource? hd->resource->fname:NULL;
+        kr = hd->resource;
 
-    if (!fname)
+    if (!kr)
         return G10ERR_GENERAL; 
 
     /* Close this one otherwise we will lose the position for
@@ -584,8 +1401,11 @@ keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     iobuf_close (hd->current.iobuf);
     hd->current.iobuf = NULL;
 
-    /* do the insert */
-    rc = do_copy (1, fname, kb, hd->secret, 0, 0 );
+    /* do the insert; a new keyring is always created right away */
+    if (bulk.active && !hd->secret && !access (kr->fname, F_OK))
+      rc = bulk_add (kr, kb, 0, 0);
+    else
+      rc = do_copy (1, kr->fname, kb, hd->secret, 0, 0 );
     if (!rc && !hd->secret && kr_offtbl)
       {
         update_offset_hash_table_from_kb (kr_offtbl, kb, 0);
@@ -606,6 +1426,10 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
     if (hd->found.kr->readonly)
       return gpg_error (GPG_ERR_EACCES);
 
+    rc = refresh_found (hd, NULL);
+    if (rc)
+      return rc;
+
     if (!hd->found.n_packets) {
         /* need to know the number of packets - do a dummy get_keyblock*/
         rc = keyring_get_keyblock (hd, NULL);
@@ -625,8 +1449,12 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
     hd->current.iobuf = NULL;
 
     /* do the delete */
-    rc = do_copy (2, hd->found.kr->fname, NULL, hd->secret,
-                  hd->found.offset, hd->found.n_packets );
+    if (bulk.active && !hd->secret)
+      rc = bulk_add (hd->found.kr, NULL, hd->found.offset,
+                     hd->found.n_packets);
+    else
+      rc = do_copy (2, hd->found.kr->fname, NULL, hd->secret,
+                    hd->found.offset, hd->found.n_packets );
     if (!rc) {
         /* better reset the found info */
         hd->found.kr = NULL;
@@ -638,6 +1466,383 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
 }
 
 
+
+/*
+ * Bulk mode.  While it is active, the inserted, updated and deleted
+ * keyblocks of the public keyrings are collected in memory and
+ * written with a single copy of the keyring once the configured
+ * number of changes has been collected, when a search may need one of
+ * the changed keyblocks, or when the bulk mode ends.  The copy
+ * replaces the keyring by a rename as usual, thus an interrupted run
+ * never leaves a partly written keyring behind; only the collected
+ * changes are lost.  All keyrings stay locked while the bulk mode is
+ * active so that the offsets of the changed keyblocks stay valid.
+ *
+ * The bulk mode is used by the import, which only adds to existing
+ * keyblocks; a search is thus known to need a changed keyblock if it
+ * is for one of the keys of the new keyblock.
+ *
+ * A rewrite invalidates the offsets found by earlier searches.  Each
+ * rewrite thus bumps the generation of the keyring; a keyblock found
+ * in an older generation is searched again by its fingerprint before
+ * it is replaced.
+ */
+
+/* Set the number of changes collected in bulk mode to N.  */
+void
+keyring_set_bulk_size (unsigned int n)
+{
+  bulk.size = n? n : 1;
+}
+
+
+/* Store the last 8 bytes of the LEN bytes long fingerprint FPR,
+   padded to 20 bytes, at ID.  This is how the key IDs of fingerprint
+   searches are looked up in the table of changed keys; for v4 keys
+   this is the key ID.  */
+static void
+bulk_fprid (const byte *fpr, size_t len, u32 *id)
+{
+  byte buf[MAX_FINGERPRINT_LEN];
+
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, fpr, len);
+  id[0] = buftou32 (buf + 12);
+  id[1] = buftou32 (buf + 16);
+}
+
+
+/* Record a change of keyring KR in bulk mode.  KB is the new keyblock
+   or NULL for a delete; OFFSET and N_PACKETS describe the keyblock to
+   be replaced and N_PACKETS is 0 for an insert.  */
+static int
+bulk_add (CONST_KR_NAME kr, KBNODE kb, off_t offset, unsigned int n_packets)
+{
+  struct bulk_item *item;
+  KBNODE node;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 kid[2];
+  int rc;
+
+  item = xmalloc_clear (sizeof *item);
+  item->kr = kr;
+  item->offset = offset;
+  item->n_packets = n_packets;
+  if (kb)
+    {
+      item->data = iobuf_temp ();
+      rc = write_keyblock (item->data, kb);
+      if (rc)
+        {
+          iobuf_close (item->data);
+          xfree (item);
+          return rc;
+        }
+      for (node = kb; node; node = node->next)
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+          {
+            keyid_from_pk (node->pkt->pkt.public_key, kid);
+            update_offset_hash_table (bulk.kids, kid, 0);
+            fingerprint_from_pk (node->pkt->pkt.public_key, fpr, &fprlen);
+            bulk_fprid (fpr, fprlen, kid);
+            update_offset_hash_table (bulk.kids, kid, 0);
+          }
+    }
+  else
+    bulk.any = 1;  /* We don't know the keys of a deleted keyblock.  */
+  item->next = bulk.items;
+  bulk.items = item;
+
+  if (++bulk.count >= bulk.size)
+    return keyring_bulk_flush ();
+  return 0;
+}
+
+
+static int
+bulk_cmp_offset (const void *a_arg, const void *b_arg)
+{
+  const struct bulk_item *a = *(const struct bulk_item **)a_arg;
+  const struct bulk_item *b = *(const struct bulk_item **)b_arg;
+
+  return a->offset < b->offset? -1 : a->offset > b->offset;
+}
+
+
+/* Write those of the COUNT changes in LIST which belong to KR to a
+   new copy of KR and replace KR with it.  LIST is in the order the
+   changes were made.  */
+static int
+bulk_write (CONST_KR_NAME kr, struct bulk_item **list, size_t count)
+{
+  struct bulk_item **changes;
+  IOBUF fp, newfp;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  size_t i, n;
+  int rc;
+
+  /* The replaced keyblocks need to be processed in file order.  */
+  changes = xmalloc (count * sizeof *changes);
+  for (i=n=0; i < count; i++)
+    if (list[i]->kr == kr && list[i]->n_packets)
+      changes[n++] = list[i];
+  qsort (changes, n, sizeof *changes, bulk_cmp_offset);
+
+  fp = iobuf_open (kr->fname);
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("can't open `%s': %s\n"), kr->fname, strerror (errno));
+      goto leave;
+    }
+  rc = create_tmp_file (kr->fname, &bakfname, &tmpfname, &newfp);
+  if (rc)
+    {
+      iobuf_close (fp);
+      goto leave;
+    }
+
+  for (i=0; !rc && i < n; i++)
+    {
+      rc = copy_some_packets (fp, newfp, changes[i]->offset);
+      if (!rc)
+        rc = skip_some_packets (fp, changes[i]->n_packets);
+      if (!rc && changes[i]->data)
+        rc = iobuf_write_temp (newfp, changes[i]->data);
+    }
+  if (!rc)
+    {
+      rc = copy_all_packets (fp, newfp);
+      if (rc == -1)
+        rc = 0;
+      else if (!rc)
+        rc = G10ERR_GENERAL;
+    }
+  for (i=0; !rc && i < count; i++)
+    if (list[i]->kr == kr && !list[i]->n_packets)
+      rc = iobuf_write_temp (newfp, list[i]->data);
+  if (rc)
+    {
+      log_error ("%s: copy to `%s' failed: %s\n",
+                 kr->fname, tmpfname, g10_errstr (rc));
+      iobuf_close (fp);
+      iobuf_cancel (newfp);
+      goto leave;
+    }
+
+  if (iobuf_close (fp))
+    {
+      rc = gpg_error_from_syserror ();
+      log_error ("%s: close failed: %s\n", kr->fname, strerror (errno));
+      iobuf_cancel (newfp);
+      goto leave;
+    }
+  if (iobuf_close (newfp))
+    {
+      rc = gpg_error_from_syserror ();
+      log_error ("%s: close failed: %s\n", tmpfname, strerror (errno));
+      goto leave;
+    }
+  rc = rename_tmp_file (bakfname, tmpfname, kr->fname, 0);
+
+ leave:
+  xfree (changes);
+  xfree (bakfname);
+  xfree (tmpfname);
+  return rc;
+}
+
+
+/* Write all changes collected in bulk mode.  */
+int
+keyring_bulk_flush (void)
+{
+  struct bulk_item **list, *item, **itemp;
+  KR_NAME kr;
+  size_t i, n, count;
+  int rc = 0;
+
+  if (!bulk.items)
+    return 0;
+
+  for (count=0, item = bulk.items; item; item = item->next)
+    count++;
+  list = xmalloc (count * sizeof *list);
+  for (i=count, item = bulk.items; item; item = item->next)
+    list[--i] = item;
+
+  for (kr = kr_names; kr; kr = kr->next)
+    {
+      for (n=i=0; i < count; i++)
+        if (list[i]->kr == kr)
+          n++;
+      if (!n)
+        continue;
+      rc = bulk_write (kr, list, count);
+      if (rc)
+        break;
+      kr->generation++;
+      if (opt.verbose)
+        log_info (_("%s: %lu changed keyblocks written\n"),
+                  kr->fname, (ulong)n);
+
+      /* Drop the written changes.  */
+      for (itemp = &bulk.items; (item = *itemp); )
+        {
+          if (item->kr == kr)
+            {
+              *itemp = item->next;
+              iobuf_close (item->data);
+              xfree (item);
+            }
+          else
+            itemp = &item->next;
+        }
+    }
+  xfree (list);
+
+  if (!bulk.items)
+    {
+      release_offset_hash_table (bulk.kids);
+      bulk.kids = new_offset_hash_table ();
+      bulk.count = 0;
+      bulk.any = 0;
+    }
+  return rc;
+}
+
+
+/* Return true if changes collected in bulk mode may affect a search
+   for the NDESC descriptions DESC.  If DESC is NULL return true if
+   there are any changes.  */
+int
+keyring_bulk_pending (KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  u32 id[2];
+  size_t n;
+
+  if (!bulk.items)
+    return 0;
+  if (!desc || bulk.any)
+    return 1;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          id[0] = desc[n].u.kid[0];
+          id[1] = desc[n].u.kid[1];
+          break;
+        case KEYDB_SEARCH_MODE_FPR16:
+          bulk_fprid (desc[n].u.fpr, 16, id);
+          break;
+        case KEYDB_SEARCH_MODE_FPR20:
+        case KEYDB_SEARCH_MODE_FPR:
+          bulk_fprid (desc[n].u.fpr, 20, id);
+          break;
+        default:
+          return 1;
+        }
+      if (lookup_offset_hash_table (bulk.kids, id))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Make sure that the offset of the keyblock found by the last search
+   on HD is still valid.  If the keyring has been rewritten since that
+   search, the keyblock is searched again using the fingerprint of the
+   primary key of KB.  */
+static int
+refresh_found (KEYRING_HANDLE hd, KBNODE kb)
+{
+  CONST_KR_NAME kr = hd->found.kr;
+  KEYDB_SEARCH_DESC desc;
+  KBNODE node;
+  size_t n;
+  int rc;
+
+  if (hd->found.generation == kr->generation)
+    return 0;
+
+  node = kb? find_kbnode (kb, PKT_PUBLIC_KEY) : NULL;
+  if (!node)
+    {
+      log_error ("%s: keyring rewritten since the search\n", kr->fname);
+      return G10ERR_GENERAL;
+    }
+
+  memset (&desc, 0, sizeof desc);
+  fingerprint_from_pk (node->pkt->pkt.public_key, desc.u.fpr, &n);
+  desc.mode = n == 20? KEYDB_SEARCH_MODE_FPR20 : KEYDB_SEARCH_MODE_FPR16;
+
+  keyring_search_reset (hd);
+  rc = keyring_search (hd, &desc, 1, NULL);
+  if (!rc && hd->found.kr != kr)
+    rc = -1;
+  if (rc)
+    {
+      log_error ("%s: keyblock not found after rewrite: %s\n",
+                 kr->fname, g10_errstr (rc));
+      return rc == -1? G10ERR_GENERAL : rc;
+    }
+  hd->found.n_packets = 0;
+  return 0;
+}
+
+
+/* Start the bulk mode.  This locks all keyrings.  */
+int
+keyring_bulk_begin (void)
+{
+  int rc;
+
+  if (bulk.active)
+    return 0;
+  rc = keyring_lock (NULL, 1);
+  if (rc)
+    return rc;
+  bulk.active = 1;
+  if (!bulk.kids)
+    bulk.kids = new_offset_hash_table ();
+  return 0;
+}
+
+
+/* End the bulk mode and release the locks.  Changes which have not
+   been written by keyring_bulk_flush are discarded.  */
+void
+keyring_bulk_end (void)
+{
+  struct bulk_item *item;
+  unsigned int n = 0;
+
+  if (!bulk.active)
+    return;
+
+  while ((item = bulk.items))
+    {
+      bulk.items = item->next;
+      iobuf_close (item->data);
+      xfree (item);
+      n++;
+    }
+  if (n)
+    log_error (_("%u changed keyblocks have not been written\n"), n);
+  release_offset_hash_table (bulk.kids);
+  bulk.kids = NULL;
+  bulk.count = 0;
+  bulk.any = 0;
+  bulk.active = 0;
+  keyring_lock (NULL, 0);
+}
+
+
 
 /* 
  * Start the next search on this handle right at the beginning
@@ -691,6 +1896,7 @@ prepare_search (KEYRING_HANDLE hd)
     }
 
     hd->current.eof = 0;
+    hd->current.generation = hd->current.kr->generation;
     hd->current.iobuf = iobuf_open (hd->current.kr->fname);
     if (!hd->current.iobuf)
       {
@@ -698,6 +1904,10 @@ prepare_search (KEYRING_HANDLE hd)
         log_error(_("can't open `%s'\n"), hd->current.kr->fname );
         return hd->current.error;
       }
+    /* In bulk mode the keyring may be rewritten while the file is
+       open; it must then not go into the fd cache.  */
+    if (bulk.active)
+      iobuf_ioctl (hd->current.iobuf, 3, 1, NULL);
 
     return 0;
 }
@@ -901,17 +2111,23 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   int save_mode;
   off_t offset, main_offset;
   size_t n;
-  int need_uid, need_words, need_keyid, need_fpr, any_skip;
+  int need_uid, need_words, need_keyid, need_fpr, need_grip, any_skip;
   int pk_no, uid_no;
   int initial_skip;
   int use_offtbl;
+  int use_idx;
+  int idx_matched = 0;
+  off_t idx_off = -1;
+  off_t start_off = 0;
   PKT_user_id *uid = NULL;
   PKT_public_key *pk = NULL;
   PKT_secret_key *sk = NULL;
   u32 aki[2];
+  byte agrip[20];
+  int grip_valid = 0;
 
   /* figure out what information we need */
-  need_uid = need_words = need_keyid = need_fpr = any_skip = 0;
+  need_uid = need_words = need_keyid = need_fpr = need_grip = any_skip = 0;
   for (n=0; n < ndesc; n++) 
     {
       switch (desc[n].mode) 
@@ -936,6 +2152,9 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         case KEYDB_SEARCH_MODE_FPR: 
           need_fpr = 1;
           break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          need_grip = 1;
+          break;
         case KEYDB_SEARCH_MODE_FIRST:
           /* always restart the search in this mode */
           keyring_search_reset (hd);
@@ -953,7 +2172,36 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   if (rc)
     return rc;
 
-  use_offtbl = !hd->secret && kr_offtbl;
+  /* Exact lookups of a single key are answered by the keyring index
+     if enabled.  */
+  use_idx = (opt.keyring_index && !hd->secret && ndesc == 1
+             && !hd->current.kr->idx_broken
+             && (desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID
+                 || desc[0].mode == KEYDB_SEARCH_MODE_FPR16
+                 || desc[0].mode == KEYDB_SEARCH_MODE_FPR20
+                 || desc[0].mode == KEYDB_SEARCH_MODE_FPR
+                 || desc[0].mode == KEYDB_SEARCH_MODE_KEYGRIP));
+  if (use_idx)
+    {
+      start_off = iobuf_tell (hd->current.iobuf);
+      rc = kridx_seek (hd, desc, start_off, &idx_off);
+      if (rc == -1)
+        { /* We know that we don't have this key */
+          hd->found.kr = NULL;
+          hd->current.eof = 1;
+          return -1;
+        }
+      if (rc == 1)
+        use_idx = 0;
+      else if (rc)
+        {
+          hd->current.error = rc;
+          return rc;
+        }
+      rc = 0;
+    }
+
+  use_offtbl = !hd->secret && kr_offtbl && !use_idx;
   if (!use_offtbl)
     ;
   else if (!kr_offtbl_ready)
@@ -1007,6 +2255,7 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   main_offset = 0;
   pk_no = uid_no = 0;
   initial_skip = 1; /* skip until we see the start of a keyblock */
+ scan:
   while (!(rc=search_packet (hd->current.iobuf, &pkt, &offset, need_uid))) 
     {
       byte afp[MAX_FINGERPRINT_LEN];
@@ -1014,6 +2263,39 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
       if (pkt.pkttype == PKT_PUBLIC_KEY  || pkt.pkttype == PKT_SECRET_KEY) 
         {
+          if (idx_off != -1 && offset != idx_off)
+            {
+              /* We left the keyblock the index pointed us to.  */
+              free_packet (&pkt);
+              initial_skip = 1;
+              if (!idx_matched)
+                {
+                  idx_off = -1;
+                  if ((rc = kridx_rewind (hd, start_off)))
+                    break;
+                  continue;
+                }
+              /* The key was found but skipped; ask the index for the
+                 next keyblock.  */
+              idx_matched = 0;
+              rc = kridx_seek (hd, desc, offset, &idx_off);
+              if (rc == 1)
+                {
+                  idx_off = -1;
+                  if (iobuf_seek (hd->current.iobuf, offset))
+                    {
+                      rc = G10ERR_KEYRING_OPEN;
+                      break;
+                    }
+                  rc = 0;
+                }
+              else if (rc)
+                {
+                  idx_off = -1;
+                  break;
+                }
+              continue;
+            }
           main_offset = offset;
           pk_no = uid_no = 0;
           initial_skip = 0;
@@ -1040,6 +2322,8 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
           }
           if (need_keyid)
             keyid_from_pk (pk, aki);
+          if (need_grip)
+            grip_valid = !keygrip_from_pk (pk, agrip);
 
           if (use_offtbl && !kr_offtbl_ready)
             update_offset_hash_table (kr_offtbl, aki, main_offset);
@@ -1101,6 +2385,10 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
             if ((pk||sk) && !memcmp (desc[n].u.fpr, afp, 20))
               goto found;
             break;
+          case KEYDB_SEARCH_MODE_KEYGRIP:
+            if (pk && grip_valid && !memcmp (desc[n].u.grip, agrip, 20))
+              goto found;
+            break;
           case KEYDB_SEARCH_MODE_FIRST: 
             if (pk||sk)
               goto found;
@@ -1121,6 +2409,7 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 	 meaningful if this function returns with no errors. */
       if(descindex)
 	*descindex=n;
+      idx_matched = 1;
       for (n=any_skip?0:ndesc; n < ndesc; n++) 
         {
           if (desc[n].skipfnc
@@ -1131,11 +2420,23 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         goto real_found;
       free_packet (&pkt);
     }
+  if (rc == -1 && idx_off != -1 && !idx_matched)
+    {
+      /* The index pointed us to the last keyblock which did not
+         match.  */
+      idx_off = -1;
+      initial_skip = 1;
+      free_packet (&pkt);
+      rc = kridx_rewind (hd, start_off);
+      if (!rc)
+        goto scan;
+    }
  real_found:
   if (!rc)
     {
       hd->found.offset = main_offset;
       hd->found.kr = hd->current.kr;
+      hd->found.generation = hd->current.generation;
       hd->found.pk_no = (pk||sk)? pk_no : 0;
       hd->found.uid_no = uid? uid_no : 0;
     }
@@ -1374,6 +2675,25 @@ write_keyblock (IOBUF fp, KBNODE keyblock)
   return 0;
 }
 
+/* Same as write_keyblock but also return the number of bytes
+   written at R_LEN.  */
+static int
+write_keyblock_len (IOBUF fp, KBNODE keyblock, off_t *r_len)
+{
+  IOBUF a;
+  int rc;
+
+  a = iobuf_temp ();
+  rc = write_keyblock (a, keyblock);
+  if (!rc)
+    {
+      *r_len = iobuf_get_temp_length (a);
+      rc = iobuf_write_temp (fp, a);
+    }
+  iobuf_close (a);
+  return rc;
+}
+
 /* 
  * Walk over all public keyrings, check the signatures and replace the
  * keyring with a new one where the signature cache is then updated.
@@ -1543,12 +2863,19 @@ do_copy (int mode, const char *fname, KBNODE root, int secret,
     int rc=0;
     char *bakfname = NULL;
     char *tmpfname = NULL;
+    struct stat oldst;
+    int use_idx;
+    off_t old_len = 0, new_len = 0;
 
     /* Open the source file. Because we do a rename, we have to check the 
        permissions of the file */
     if (access (fname, W_OK))
       return gpg_error_from_syserror ();
 
+    /* Remember the state of the keyring so that we can update its
+       index after the copy.  */
+    use_idx = !secret && opt.keyring_index && !stat (fname, &oldst);
+
     fp = iobuf_open (fname);
     if (mode == 1 && !fp && errno == ENOENT) { 
 	/* insert mode but file does not exist: create a new file */
@@ -1644,10 +2971,14 @@ do_copy (int mode, const char *fname, KBNODE root, int secret,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        old_len = iobuf_tell (fp) - start_offset;
     }
 
     if( mode == 1 || mode == 3 ) { /* insert or update */
-        rc = write_keyblock (newfp, root);
+        if (use_idx)
+          rc = write_keyblock_len (newfp, root, &new_len);
+        else
+          rc = write_keyblock (newfp, root);
         if (rc) {
           iobuf_close(fp);
           if (secret)
@@ -1685,6 +3016,9 @@ do_copy (int mode, const char *fname, KBNODE root, int secret,
     }
 
     rc = rename_tmp_file (bakfname, tmpfname, fname, secret);
+    if (!rc && use_idx)
+      kridx_update (fname, &oldst, mode, start_offset, old_len,
+                    mode == 2? NULL : root, new_len);
 
   leave:
     xfree(bakfname);
@@ -26,6 +26,7 @@ typedef struct keyring_handle *KEYRING_HANDLE;
 int keyring_register_filename (const char *fname, int secret, int readonly,
                                void **ptr);
 int keyring_is_writable (void *token);
+void keyring_hash_stamp (void *token, gcry_md_hd_t md);
 
 KEYRING_HANDLE keyring_new (void *token, int secret);
 void keyring_release (KEYRING_HANDLE hd);
@@ -41,4 +42,10 @@ int keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 		    size_t ndesc, size_t *descindex);
 int keyring_rebuild_cache (void *token,int noisy);
 
+void keyring_set_bulk_size (unsigned int n);
+int keyring_bulk_begin (void);
+int keyring_bulk_flush (void);
+int keyring_bulk_pending (KEYDB_SEARCH_DESC *desc, size_t ndesc);
+void keyring_bulk_end (void);
+
 #endif /*GPG_KEYRING_H*/
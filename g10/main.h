@@ -157,6 +157,9 @@ int mpi_print( FILE *fp, gcry_mpi_t a, int mode );
 
 /*-- status.c --*/
 void set_status_fd ( int fd );
+void set_status_callback (void (*cb)(void *opaque, const char *keyword,
+                                     const char *args),
+                          void *opaque);
 int  is_status_enabled ( void );
 void write_status ( int no );
 void write_status_error (const char *where, int errcode);
@@ -204,6 +207,10 @@ int clearsign_file( const char *fname, strlist_t locusr, const char *outfile );
 int sign_symencrypt_file (const char *fname, strlist_t locusr);
 
 /*-- sig-check.c --*/
+void sig_cache_set_size (unsigned int n);
+void sig_cache_open (const char *fname);
+void sig_cache_close (void);
+void sig_cache_print_stats (void);
 int check_revocation_keys (PKT_public_key *pk, PKT_signature *sig);
 int check_backsig(PKT_public_key *main_pk,PKT_public_key *sub_pk,
 		  PKT_signature *backsig);
@@ -211,6 +218,8 @@ int check_key_signature( KBNODE root, KBNODE node, int *is_selfsig );
 int check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 			  PKT_public_key *ret_pk, int *is_selfsig,
 			  u32 *r_expiredate, int *r_expired );
+void check_keyblock_sigs (KBNODE root, int self_only);
+void check_keyblock_sigs_parallel (KBNODE *list, int n, int jobs);
 
 /*-- delkey.c --*/
 int delete_keys( strlist_t names, int secret, int allow_both );
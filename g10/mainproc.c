@@ -1961,7 +1961,7 @@ check_sig_and_print( CTX c, KBNODE node )
 
 	if( rc )
 	    g10_errors_seen = 1;
-	if( opt.batch && rc )
+	if( opt.batch && rc && !glo_ctrl.in_server )
 	    g10_exit(1);
     }
     else {
@@ -73,6 +73,7 @@ struct
   int compress_algo;
   int compress_level;
   int bz2_compress_level;
+  unsigned int compress_chunk_size; /* In bytes; 0 = don't chunk.  */
   int bz2_decompress_lowmem;
   const char *def_secret_key;
   char *def_recipient;
@@ -194,6 +195,9 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  unsigned int import_jobs; /* Processes to check imported keys with.  */
+  int keyring_index;   /* Maintain and use the keyring index files.  */
+  int trustdb_mmap;    /* Read the trustdb through a memory mapping.  */
   int no_sig_create_check;
   int no_auto_check_trustdb;
   int preserve_permissions;
@@ -261,6 +265,8 @@ EXTERN_UNLESS_MAIN_MODULE
 struct {
   int in_auto_key_retrieve; /* True if we are doing an
                                auto_key_retrieve. */
+  int in_server;            /* True if we are running as a server and
+                               thus must not exit on errors.  */
 } glo_ctrl;
 
 #define DBG_PACKET_VALUE  1	/* debug packet reading/writing */
@@ -323,6 +329,7 @@ EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 #define IMPORT_MINIMAL                   (1<<5)
 #define IMPORT_CLEAN                     (1<<6)
 #define IMPORT_NO_SECKEY                 (1<<7)
+#define IMPORT_BULK                      (1<<8)
 
 #define EXPORT_LOCAL_SIGS                (1<<0)
 #define EXPORT_ATTRIBUTES                (1<<1)
@@ -408,6 +408,7 @@ int skip_some_packets( iobuf_t inp, unsigned n );
 
 int parse_signature( iobuf_t inp, int pkttype, unsigned long pktlen,
 		     PKT_signature *sig );
+int parse_sig_data (PKT_signature *sig);
 const byte *enum_sig_subpkt ( const subpktarea_t *subpkts,
                               sigsubpkttype_t reqtype,
                               size_t *ret_n, int *start, int *critical );
@@ -440,6 +441,11 @@ struct notation *sig_to_notation(PKT_signature *sig);
 void free_notation(struct notation *notation);
 
 /*-- free-packet.c --*/
+PACKET *alloc_packet (void);
+void release_packet (PACKET *pkt);
+PKT_signature *alloc_signature (void);
+PKT_public_key *alloc_public_key (void);
+void packet_pool_print_stats (void);
 void free_symkey_enc( PKT_symkey_enc *enc );
 void free_pubkey_enc( PKT_pubkey_enc *enc );
 void free_seckey_enc( PKT_signature *enc );
@@ -50,6 +50,9 @@ static int  copy_packet( IOBUF inp, IOBUF out, int pkttype,
 static void skip_packet( IOBUF inp, int pkttype,
 			 unsigned long pktlen, int partial );
 static void *read_rest( IOBUF inp, size_t pktlen, int partial );
+static int  read_sig_data (IOBUF inp, unsigned long pktlen,
+                           PKT_signature *sig, int ndata);
+static size_t sig_data_length (const byte *buffer, size_t length, int ndata);
 static int  parse_marker( IOBUF inp, int pkttype, unsigned long pktlen );
 static int  parse_symkeyenc( IOBUF inp, int pkttype, unsigned long pktlen,
 							     PACKET *packet );
@@ -117,6 +120,7 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
   gcry_mpi_t a = NULL;
   byte *buf = NULL;
   byte *p;
+  byte buffer[2+512];  /* Used for public values up to 4096 bits.  */
 
   if (!nmax)
     goto overflow;
@@ -137,7 +141,12 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
     }
 
   nbytes = (nbits+7) / 8;
-  buf = secure ? gcry_xmalloc_secure (nbytes + 2) : gcry_xmalloc (nbytes + 2);
+  if (secure)
+    buf = gcry_xmalloc_secure (nbytes + 2);
+  else if (nbytes + 2 <= sizeof buffer)
+    buf = buffer;
+  else
+    buf = gcry_xmalloc (nbytes + 2);
   p = buf;
   p[0] = c1;
   p[1] = c2;
@@ -162,14 +171,16 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
     }
 
   *ret_nread = nread;
-  gcry_free(buf);
+  if (buf != buffer)
+    gcry_free(buf);
   return a;
 
  overflow:
   log_error ("mpi larger than indicated length (%u bits)\n", 8*nmax);
  leave:
   *ret_nread = nread;
-  gcry_free(buf);
+  if (buf != buffer)
+    gcry_free(buf);
   return a;
 }
 
@@ -557,7 +568,7 @@ parse( IOBUF inp, PACKET *pkt, int onlykeypkts, off_t *retpos,
     switch( pkttype ) {
       case PKT_PUBLIC_KEY:
       case PKT_PUBLIC_SUBKEY:
-	pkt->pkt.public_key = xmalloc_clear(sizeof *pkt->pkt.public_key );
+	pkt->pkt.public_key = alloc_public_key ();
 	rc = parse_key(inp, pkttype, pktlen, hdr, hdrlen, pkt );
 	break;
       case PKT_SECRET_KEY:
@@ -572,7 +583,7 @@ parse( IOBUF inp, PACKET *pkt, int onlykeypkts, off_t *retpos,
 	rc = parse_pubkeyenc(inp, pkttype, pktlen, pkt );
 	break;
       case PKT_SIGNATURE:
-	pkt->pkt.signature = xmalloc_clear(sizeof *pkt->pkt.signature );
+	pkt->pkt.signature = alloc_signature ();
 	rc = parse_signature(inp, pkttype, pktlen, pkt->pkt.signature );
 	break;
       case PKT_ONEPASS_SIG:
@@ -1385,7 +1396,7 @@ parse_signature( IOBUF inp, int pkttype, unsigned long pktlen,
     unsigned n;
     int is_v4=0;
     int rc=0;
-    int i, ndata;
+    int ndata;
 
     if( pktlen < 16 ) {
 	log_error("packet(%d) too short\n", pkttype);
@@ -1580,20 +1591,32 @@ parse_signature( IOBUF inp, int pkttype, unsigned long pktlen,
             pktlen = 0;
           }
     }
-    else {
-	for( i=0; i < ndata; i++ ) {
-	    n = pktlen;
-	    sig->data[i] = mpi_read(inp, &n, 0 );
-	    pktlen -=n;
-	    if( list_mode ) {
-		fprintf (listfp, "\tdata: ");
-		mpi_print(listfp, sig->data[i], mpi_print_mode );
-		putc ('\n', listfp);
-	    }
-            if (!sig->data[i])
-                rc = G10ERR_INVALID_PACKET;
+    else if (!list_mode && pktlen <= ndata * (2 + MAX_EXTERN_MPI_BITS/8)) {
+	/* The values are only needed to verify the signature, so we
+	   keep them undecoded in DATA[0] until parse_sig_data is
+	   called.  Values which would not be decoded without errors
+	   are decoded right away to get the usual diagnostics.  */
+	byte *buffer = xmalloc (pktlen? pktlen : 1);
+	int nread = iobuf_read (inp, buffer, pktlen);
+	IOBUF a;
+
+	if (nread < 0)
+	    nread = 0;
+	pktlen -= nread;
+	n = sig_data_length (buffer, nread, ndata);
+	if (n)
+	    sig->data[0] = gcry_mpi_set_opaque (NULL, buffer, n*8);
+	else {
+	    a = iobuf_temp_with_content ((const char *)buffer, nread);
+	    rc = read_sig_data (a, nread, sig, ndata);
+	    iobuf_close (a);
+	    xfree (buffer);
 	}
     }
+    else {
+	rc = read_sig_data (inp, pktlen, sig, ndata);
+	pktlen = 0;
+    }
 
   leave:
     iobuf_skip_rest(inp, pktlen, 0);
@@ -1601,6 +1624,94 @@ parse_signature( IOBUF inp, int pkttype, unsigned long pktlen,
 }
 
 
+/* Read the NDATA signature values of SIG from the PKTLEN bytes of
+   INP.  */
+static int
+read_sig_data (IOBUF inp, unsigned long pktlen, PKT_signature *sig,
+               int ndata)
+{
+  unsigned int n;
+  int i;
+  int rc = 0;
+
+  for (i=0; i < ndata; i++)
+    {
+      n = pktlen;
+      sig->data[i] = mpi_read (inp, &n, 0);
+      pktlen -= n;
+      if (list_mode)
+        {
+          fprintf (listfp, "\tdata: ");
+          mpi_print (listfp, sig->data[i], mpi_print_mode);
+          putc ('\n', listfp);
+        }
+      if (!sig->data[i])
+        rc = G10ERR_INVALID_PACKET;
+    }
+  iobuf_skip_rest (inp, pktlen, 0);
+  return rc;
+}
+
+
+/* Return the number of bytes used by NDATA MPIs at BUFFER which has
+   a length of LENGTH, or 0 if they are not valid.  */
+static size_t
+sig_data_length (const byte *buffer, size_t length, int ndata)
+{
+  size_t n = 0;
+  unsigned int nbits;
+
+  for (; ndata; ndata--)
+    {
+      if (length - n < 2)
+        return 0;
+      nbits = buffer[n] << 8 | buffer[n+1];
+      if (!nbits || nbits > MAX_EXTERN_MPI_BITS)
+        return 0;
+      n += 2 + (nbits+7)/8;
+      if (n > length)
+        return 0;
+    }
+  return n;
+}
+
+
+/* Decode the signature values of SIG if that has not yet been done
+   by parse_signature.  This needs to be called before the values in
+   SIG->DATA are used.  Returns 0 on success.  */
+int
+parse_sig_data (PKT_signature *sig)
+{
+  gcry_mpi_t data[PUBKEY_MAX_NSIG];
+  const byte *p;
+  unsigned int nbits;
+  size_t n;
+  int i, ndata;
+
+  ndata = pubkey_get_nsig (sig->pubkey_algo);
+  if (!ndata || !sig->data[0]
+      || !gcry_mpi_get_flag (sig->data[0], GCRYMPI_FLAG_OPAQUE))
+    return 0;
+
+  p = gcry_mpi_get_opaque (sig->data[0], &nbits);
+  for (i=0; i < ndata; i++)
+    {
+      n = 2 + ((p[0] << 8 | p[1]) + 7) / 8;
+      if (gcry_mpi_scan (&data[i], GCRYMPI_FMT_PGP, p, n, NULL))
+        {
+          while (i--)
+            mpi_release (data[i]);
+          return G10ERR_INVALID_PACKET;
+        }
+      p += n;
+    }
+  mpi_release (sig->data[0]);
+  for (i=0; i < ndata; i++)
+    sig->data[i] = data[i];
+  return 0;
+}
+
+
 static int
 parse_onepass_sig( IOBUF inp, int pkttype, unsigned long pktlen,
 					     PKT_onepass_sig *ops )
@@ -586,7 +586,7 @@ hash_datafiles( gcry_md_hd_t md, gcry_md_hd_t md2, strlist_t files,
 
 
 /* Hash the data from file descriptor DATA_FD and append the hash to hash
-   contexts MD and MD2.  */
+   contexts MD and MD2.  DATA_FD is not closed.  */
 int
 hash_datafile_by_fd ( gcry_md_hd_t md, gcry_md_hd_t md2, int data_fd,
                       int textmode )
@@ -595,6 +595,8 @@ hash_datafile_by_fd ( gcry_md_hd_t md, gcry_md_hd_t md2, int data_fd,
   iobuf_t fp;
 
   fp = iobuf_fdopen (data_fd, "rb");
+  if (fp)
+    iobuf_ioctl (fp, 1, 1, NULL); /* Keep DATA_FD open.  */
   if (fp && is_secured_file (data_fd))
     {
       iobuf_close (fp);
@@ -25,6 +25,8 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 
 #include "gpg.h"
@@ -32,6 +34,8 @@
 #include "util.h"
 #include "i18n.h"
 #include "options.h"
+#include "main.h"
+#include "status.h"
 #include "../common/sysutils.h"
 
 
@@ -48,6 +52,22 @@ struct server_local_s
 };
 
 
+/* Counters for the VERIFY command.  These are kept for the lifetime
+   of the process and may be queried with "GETINFO verify_stats".  */
+static struct
+{
+  unsigned long items;    /* Number of VERIFY commands.  */
+  unsigned long failed;   /* Number of VERIFY commands returning ERR.  */
+  unsigned long good;     /* Number of GOODSIG status lines.  */
+  unsigned long bad;      /* Number of BADSIG status lines.  */
+  unsigned long expired;  /* Number of EXPSIG and EXPKEYSIG lines.  */
+  unsigned long revoked;  /* Number of REVKEYSIG status lines.  */
+  unsigned long errsig;   /* Number of ERRSIG status lines.  */
+  unsigned long bytes;    /* Total size of the input files in KiB.  */
+  time_t started;         /* Time of the first VERIFY command.  */
+} verify_stats;
+
+
 
 /* Helper to close the message fd if it is open. */
 static void 
@@ -245,7 +265,41 @@ cmd_decrypt (assuan_context_t ctx, char *line)
 
 
 
-/*  VERIFY
+/* Status callback used while processing a VERIFY command.  It sends
+   the status lines to the client and updates the counters.  */
+static void
+verify_status_cb (void *opaque, const char *keyword, const char *args)
+{
+  assuan_context_t ctx = opaque;
+
+  if (!strcmp (keyword, "GOODSIG"))
+    verify_stats.good++;
+  else if (!strcmp (keyword, "BADSIG"))
+    verify_stats.bad++;
+  else if (!strcmp (keyword, "EXPSIG") || !strcmp (keyword, "EXPKEYSIG"))
+    verify_stats.expired++;
+  else if (!strcmp (keyword, "REVKEYSIG"))
+    verify_stats.revoked++;
+  else if (!strcmp (keyword, "ERRSIG"))
+    verify_stats.errsig++;
+
+  assuan_write_status (ctx, keyword, args);
+}
+
+
+/* Return the size of the file open as FD in KiB or 0 if not known.  */
+static unsigned long
+fd_size_kb (int fd)
+{
+  struct stat st;
+
+  if (fd == -1 || fstat (fd, &st) || !S_ISREG (st.st_mode))
+    return 0;
+  return (unsigned long)(st.st_size / 1024);
+}
+
+
+/*  VERIFY [<sigfile> [<datafile>]]
 
    This does a verify operation on the message send to the input-FD.
    The result is written out using status lines.  If an output FD was
@@ -253,6 +307,14 @@ cmd_decrypt (assuan_context_t ctx, char *line)
   
    If the signature is a detached one, the server will inquire about
    the signed material and the client must provide it.
+
+   Instead of using the INPUT and MESSAGE commands the names of the
+   signature file and of the signed data may be given as arguments.
+   Spaces and other special characters in the names need to be
+   percent-escaped.  Because the keys and the trust database are kept
+   open by the server, a client with many signatures to check should
+   use one connection and issue one VERIFY command per signature.
+   "GETINFO verify_stats" returns counters about these commands.
  */
 static gpg_error_t
 cmd_verify (assuan_context_t ctx, char *line)
@@ -262,29 +324,96 @@ cmd_verify (assuan_context_t ctx, char *line)
   gnupg_fd_t fd = assuan_get_input_fd (ctx);
   gnupg_fd_t out_fd = assuan_get_output_fd (ctx);
   FILE *out_fp = NULL;
+  char *sigfile = NULL;
+  char *datafile = NULL;
+  int sig_fd, data_fd = -1;
 
-  (void)line;
-
-  if (fd == GNUPG_INVALID_FD)
+  while (spacep (line))
+    line++;
+  if (*line)
+    {
+      sigfile = line;
+      while (*line && !spacep (line))
+        line++;
+      if (*line)
+        {
+          *line++ = 0;
+          while (spacep (line))
+            line++;
+          if (*line)
+            {
+              datafile = line;
+              while (*line && !spacep (line))
+                line++;
+              if (*line)
+                *line++ = 0;
+              while (spacep (line))
+                line++;
+              if (*line)
+                return set_error (GPG_ERR_ASS_PARAMETER, "too many arguments");
+              datafile[percent_unescape_inplace (datafile, 0)] = 0;
+            }
+        }
+      sigfile[percent_unescape_inplace (sigfile, 0)] = 0;
+    }
+  else if (fd == GNUPG_INVALID_FD)
     return gpg_error (GPG_ERR_ASS_NO_INPUT);
 
+  if (!verify_stats.started)
+    verify_stats.started = gnupg_get_time ();
+  verify_stats.items++;
+
   if (out_fd != GNUPG_INVALID_FD)
     {
       out_fp = fdopen ( dup (FD2INT (out_fd)), "w");
       if (!out_fp)
-        return set_error (GPG_ERR_ASS_GENERAL, "fdopen() failed");
+        {
+          verify_stats.failed++;
+          return set_error (GPG_ERR_ASS_GENERAL, "fdopen() failed");
+        }
     }
 
-  log_debug ("WARNING: The server mode work "
-             "in progress and not ready for use\n");
+  if (sigfile)
+    {
+      sig_fd = open (sigfile, O_RDONLY);
+      if (sig_fd == -1)
+        {
+          rc = gpg_error_from_syserror ();
+          log_error (_("can't open `%s': %s\n"), sigfile, gpg_strerror (rc));
+          goto leave;
+        }
+      if (datafile)
+        {
+          data_fd = open (datafile, O_RDONLY);
+          if (data_fd == -1)
+            {
+              rc = gpg_error_from_syserror ();
+              log_error (_("can't open `%s': %s\n"),
+                         datafile, gpg_strerror (rc));
+              close (sig_fd);
+              goto leave;
+            }
+        }
+    }
+  else
+    {
+      /* Need to dup it because it might get closed and libassuan
+         won't know about it then. */
+      sig_fd = dup (FD2INT (fd));
+      data_fd = dup (FD2INT (ctrl->server_local->message_fd));
+    }
+
+  verify_stats.bytes += fd_size_kb (sig_fd) + fd_size_kb (data_fd);
 
-  /* Need to dup it because it might get closed and libassuan won't
-     know about it then. */
-  rc = gpg_verify (ctrl,
-                   dup ( FD2INT (fd)), 
-                   dup ( FD2INT (ctrl->server_local->message_fd)),
-                   out_fp);
+  set_status_callback (verify_status_cb, ctx);
+  rc = gpg_verify (ctrl, sig_fd, data_fd, out_fp);
+  set_status_callback (NULL, NULL);
 
+ leave:
+  if (data_fd != -1)
+    close (data_fd);
+  if (rc)
+    verify_stats.failed++;
   if (out_fp)
     fclose (out_fp);
   close_message_fd (ctrl);
@@ -295,7 +424,7 @@ cmd_verify (assuan_context_t ctx, char *line)
 }
 
 
-
+
 /*  SIGN [--detached]
 
    Sign the data set with the INPUT command and write it to the sink
@@ -433,6 +562,10 @@ cmd_genkey (assuan_context_t ctx, char *line)
 
      version     - Return the version of the program.
      pid         - Return the process id of the server.
+     verify_stats - Return the counters of the VERIFY command as a
+                   list of NAME=VALUE pairs.  "seconds" is the time
+                   since the first VERIFY command and "kbytes" the
+                   amount of data read from regular files.
 
  */
 static gpg_error_t
@@ -452,6 +585,22 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%lu", (unsigned long)getpid ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "verify_stats"))
+    {
+      char buf[300];
+
+      snprintf (buf, sizeof buf,
+                "items=%lu failed=%lu good=%lu bad=%lu expired=%lu"
+                " revoked=%lu errsig=%lu kbytes=%lu seconds=%lu",
+                verify_stats.items, verify_stats.failed,
+                verify_stats.good, verify_stats.bad,
+                verify_stats.expired, verify_stats.revoked,
+                verify_stats.errsig, verify_stats.bytes,
+                verify_stats.started?
+                (unsigned long)(gnupg_get_time () - verify_stats.started)
+                : 0UL);
+      rc = assuan_send_data (ctx, buf, strlen (buf));
+    }
   else
     rc = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
   return rc;
@@ -574,6 +723,7 @@ gpg_server (ctrl_t ctrl)
     }
   ctrl->server_local->assuan_ctx = ctx;
   ctrl->server_local->message_fd = GNUPG_INVALID_FD;
+  glo_ctrl.in_server = 1;
 
   if (DBG_ASSUAN)
     assuan_set_log_stream (ctx, log_get_stream ());
@@ -601,6 +751,7 @@ gpg_server (ctrl_t ctrl)
     }
 
  leave:
+  glo_ctrl.in_server = 0;
   xfree (ctrl->server_local);
   ctrl->server_local = NULL;
   assuan_release (ctx);
@@ -22,7 +22,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef HAVE_W32_SYSTEM
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/wait.h>
+#endif
 
 #include "gpg.h"
 #include "util.h"
@@ -34,6 +42,7 @@
 #include "i18n.h"
 #include "options.h"
 #include "pkglue.h"
+#include "host2net.h"
 
 /* Context used by the compare function. */
 struct cmp_help_context_s
@@ -47,6 +56,396 @@ struct cmp_help_context_s
 static int do_check( PKT_public_key *pk, PKT_signature *sig,
                      gcry_md_hd_t digest,
 		     int *r_expired, int *r_revoked, PKT_public_key *ret_pk);
+static int do_check_digest (PKT_public_key *pk, PKT_signature *sig,
+                            gcry_md_hd_t digest);
+
+/*
+ * The signature cache keeps the results of public key operations done
+ * to verify key signatures in the file "sigcache.gpg" in the home
+ * directory.  An entry is identified by a SHA-256 hash over all the
+ * input to pk_verify: the public key of the signer, the encoded digest
+ * of the signed key material and the signature values.  A hit thus
+ * only replaces the public key operation; everything else, like the
+ * checks for expiration and revocation, is still done for each use.
+ * The file is read on the first lookup and written on exit if new
+ * entries have been added.  It holds at most sig_cache_size entries;
+ * when writing, entries not used in this session are dropped first.
+ * The file is written to a temporary file of its own by each process
+ * and renamed while holding a lock on the cache file.
+ *
+ * Layout of the file (all integers are big endian):
+ *
+ *   0  4  magic "GSCH"
+ *   4  1  version
+ *   5  3  reserved
+ *   8  4  number of records
+ *  12     records
+ *   n 32  SHA-256 hash over all the preceding bytes
+ *
+ * Each record is the 32 byte hash followed by a flag byte with bit 0
+ * set for a good signature.  The whole file is ignored if the final
+ * hash does not match, so that a damaged file can't turn a bad
+ * signature into a good one.
+ */
+#define SIG_CACHE_HDRLEN  12
+#define SIG_CACHE_VERSION 2
+#define SIG_CACHE_RECLEN  33
+#define SIG_CACHE_DEFAULT_SIZE 50000
+
+#define SIG_CACHE_GOOD  1  /* The signature is good.  */
+#define SIG_CACHE_NEW   2  /* Added in this session.  */
+#define SIG_CACHE_USED  4  /* Used in this session.  */
+
+struct sig_cache_item
+{
+  struct sig_cache_item *next;
+  byte key[32];
+  byte flags;
+};
+
+static char *sig_cache_fname;    /* NULL if the cache is not used.  */
+static unsigned int sig_cache_size = SIG_CACHE_DEFAULT_SIZE;
+static int sig_cache_loaded;
+static struct sig_cache_item **sig_cache_table;
+static unsigned int sig_cache_mask;
+/* All items in the order they have been loaded or added.  */
+static struct sig_cache_item **sig_cache_items;
+static unsigned int sig_cache_count, sig_cache_alloced, sig_cache_added;
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+} sig_cache_stats;
+
+
+/* Set the maximum number of entries kept in the signature cache.  A
+   value of 0 disables the cache.  */
+void
+sig_cache_set_size (unsigned int n)
+{
+  sig_cache_size = n;
+}
+
+
+/* Use FNAME as the signature cache file.  */
+void
+sig_cache_open (const char *fname)
+{
+  xfree (sig_cache_fname);
+  sig_cache_fname = xstrdup (fname);
+}
+
+
+void
+sig_cache_print_stats (void)
+{
+  if (!sig_cache_loaded)
+    return;
+  log_info ("sig cache: %u entries, %lu hits, %lu misses, %u added\n",
+            sig_cache_count, sig_cache_stats.hits, sig_cache_stats.misses,
+            sig_cache_added);
+}
+
+
+static struct sig_cache_item *
+sig_cache_find (const byte *key)
+{
+  struct sig_cache_item *item;
+
+  for (item = sig_cache_table[buftou32 (key) & sig_cache_mask];
+       item; item = item->next)
+    if (!memcmp (item->key, key, 32))
+      return item;
+  return NULL;
+}
+
+
+static void
+sig_cache_add (const byte *key, int flags)
+{
+  struct sig_cache_item *item;
+  unsigned int idx;
+
+  if (sig_cache_count == sig_cache_alloced)
+    {
+      sig_cache_alloced = sig_cache_alloced? 2 * sig_cache_alloced : 1024;
+      sig_cache_items = xrealloc (sig_cache_items,
+                                  sig_cache_alloced * sizeof *sig_cache_items);
+    }
+  item = xmalloc (sizeof *item);
+  memcpy (item->key, key, 32);
+  item->flags = flags;
+  idx = buftou32 (key) & sig_cache_mask;
+  item->next = sig_cache_table[idx];
+  sig_cache_table[idx] = item;
+  sig_cache_items[sig_cache_count++] = item;
+}
+
+
+/* Remove all entries from the signature cache.  */
+static void
+sig_cache_clear (void)
+{
+  unsigned int i;
+
+  for (i=0; i < sig_cache_count; i++)
+    xfree (sig_cache_items[i]);
+  sig_cache_count = 0;
+  memset (sig_cache_table, 0, (sig_cache_mask + 1) * sizeof *sig_cache_table);
+}
+
+
+static void
+sig_cache_load (void)
+{
+  FILE *fp;
+  gcry_md_hd_t md;
+  byte buf[SIG_CACHE_HDRLEN > SIG_CACHE_RECLEN?
+           SIG_CACHE_HDRLEN : SIG_CACHE_RECLEN];
+  u32 n;
+
+  sig_cache_loaded = 1;
+  for (n = 256; n < sig_cache_size && n < (1 << 20); n <<= 1)
+    ;
+  sig_cache_table = xmalloc_clear (n * sizeof *sig_cache_table);
+  sig_cache_mask = n - 1;
+
+  fp = fopen (sig_cache_fname, "rb");
+  if (!fp)
+    return;
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    {
+      fclose (fp);
+      return;
+    }
+  if (fread (buf, SIG_CACHE_HDRLEN, 1, fp) != 1
+      || memcmp (buf, "GSCH", 4) || buf[4] != SIG_CACHE_VERSION)
+    goto invalid;
+  gcry_md_write (md, buf, SIG_CACHE_HDRLEN);
+  for (n = buftou32 (buf+8); n; n--)
+    {
+      if (fread (buf, SIG_CACHE_RECLEN, 1, fp) != 1)
+        goto invalid;
+      gcry_md_write (md, buf, SIG_CACHE_RECLEN);
+      if (!sig_cache_find (buf))
+        sig_cache_add (buf, (buf[32] & SIG_CACHE_GOOD));
+    }
+  if (fread (buf, 32, 1, fp) != 1
+      || memcmp (buf, gcry_md_read (md, GCRY_MD_SHA256), 32))
+    goto invalid;
+  gcry_md_close (md);
+  fclose (fp);
+  return;
+
+ invalid:
+  if (opt.verbose)
+    log_info (_("%s: invalid signature cache - ignored\n"), sig_cache_fname);
+  sig_cache_clear ();
+  gcry_md_close (md);
+  fclose (fp);
+}
+
+
+/* Write the signature cache back if entries have been added.  */
+void
+sig_cache_close (void)
+{
+  DOTLOCK lockhd;
+  char *tmpfname;
+  FILE *fp;
+  gcry_md_hd_t md;
+  byte buf[SIG_CACHE_RECLEN];
+  struct sig_cache_item *item;
+  unsigned int skip, n, i;
+  mode_t oldmask;
+  int pass;
+
+  if (!sig_cache_loaded || !sig_cache_added || opt.dry_run)
+    return;
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return;
+
+  lockhd = create_dotlock (sig_cache_fname);
+  if (!lockhd)
+    {
+      log_info ("can't allocate lock for `%s'\n", sig_cache_fname);
+      gcry_md_close (md);
+      return;
+    }
+  if (make_dotlock (lockhd, -1))
+    {
+      log_info ("can't lock `%s'\n", sig_cache_fname);
+      destroy_dotlock (lockhd);
+      gcry_md_close (md);
+      return;
+    }
+
+  /* Use a temporary file of our own; a file of that name can only be
+     left over from a crashed process.  */
+  tmpfname = xasprintf ("%s" EXTSEP_S "%lu" EXTSEP_S "tmp",
+                        sig_cache_fname, (unsigned long)getpid ());
+  remove (tmpfname);
+  oldmask = umask (077);
+  fp = fopen (tmpfname, "wb");
+  umask (oldmask);
+  if (!fp)
+    {
+      if (opt.verbose)
+        log_info (_("can't create `%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+#ifndef HAVE_W32_SYSTEM
+  fchmod (fileno (fp), S_IRUSR|S_IWUSR);
+#endif
+
+  n = sig_cache_count < sig_cache_size? sig_cache_count : sig_cache_size;
+  skip = sig_cache_count - n;
+  memset (buf, 0, SIG_CACHE_HDRLEN);
+  memcpy (buf, "GSCH", 4);
+  buf[4] = SIG_CACHE_VERSION;
+  u32tobuf (buf+8, n);
+  gcry_md_write (md, buf, SIG_CACHE_HDRLEN);
+  if (fwrite (buf, SIG_CACHE_HDRLEN, 1, fp) != 1)
+    goto write_error;
+
+  /* Write the old entries not used in this session first, then the
+     used ones and the new ones last, so that the least useful
+     entries are dropped.  */
+  for (pass=0; pass < 3; pass++)
+    for (i=0; i < sig_cache_count; i++)
+      {
+        item = sig_cache_items[i];
+        if ((pass == 0 && (item->flags & (SIG_CACHE_NEW|SIG_CACHE_USED)))
+            || (pass == 1 && ((item->flags & SIG_CACHE_NEW)
+                              || !(item->flags & SIG_CACHE_USED)))
+            || (pass == 2 && !(item->flags & SIG_CACHE_NEW)))
+          continue;
+        if (skip)
+          {
+            skip--;
+            continue;
+          }
+        memcpy (buf, item->key, 32);
+        buf[32] = (item->flags & SIG_CACHE_GOOD);
+        gcry_md_write (md, buf, SIG_CACHE_RECLEN);
+        if (fwrite (buf, SIG_CACHE_RECLEN, 1, fp) != 1)
+          goto write_error;
+      }
+  if (fwrite (gcry_md_read (md, GCRY_MD_SHA256), 32, 1, fp) != 1)
+    goto write_error;
+  if (fclose (fp))
+    {
+      fp = NULL;
+      goto write_error;
+    }
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  remove (sig_cache_fname);
+#endif
+  if (rename (tmpfname, sig_cache_fname))
+    {
+      log_info (_("renaming `%s' to `%s' failed: %s\n"),
+                tmpfname, sig_cache_fname, strerror (errno));
+      remove (tmpfname);
+    }
+  goto leave;
+
+ write_error:
+  log_info (_("error writing `%s': %s\n"), tmpfname, strerror (errno));
+  if (fp)
+    fclose (fp);
+  remove (tmpfname);
+ leave:
+  release_dotlock (lockhd);
+  destroy_dotlock (lockhd);
+  xfree (tmpfname);
+  gcry_md_close (md);
+}
+
+
+static int
+sig_cache_hash_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  unsigned char *p;
+  byte len[4];
+  size_t n;
+
+  if (!a || gcry_mpi_aprint (GCRYMPI_FMT_USG, &p, &n, a))
+    return -1;
+  u32tobuf (len, n);
+  gcry_md_write (md, len, 4);
+  gcry_md_write (md, p, n);
+  gcry_free (p);
+  return 0;
+}
+
+
+/* Compute the cache key for verifying the signature values of SIG
+   over the encoded digest VALUE using PK.  */
+static int
+sig_cache_key (byte *key, PKT_public_key *pk, PKT_signature *sig,
+               gcry_mpi_t value)
+{
+  gcry_md_hd_t md;
+  int i, n;
+  int rc = 0;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return -1;
+  gcry_md_putc (md, pk->pubkey_algo);
+  n = pubkey_get_npkey (pk->pubkey_algo);
+  for (i=0; i < n && !rc; i++)
+    rc = sig_cache_hash_mpi (md, pk->pkey[i]);
+  if (!rc)
+    rc = sig_cache_hash_mpi (md, value);
+  n = pubkey_get_nsig (sig->pubkey_algo);
+  for (i=0; i < n && !rc; i++)
+    rc = sig_cache_hash_mpi (md, sig->data[i]);
+  if (!rc)
+    memcpy (key, gcry_md_read (md, GCRY_MD_SHA256), 32);
+  gcry_md_close (md);
+  return rc;
+}
+
+
+/* Verify the signature values of SIG over the encoded digest VALUE
+   using PK.  The signature cache is used for signatures on keys.  */
+static int
+cached_pk_verify (PKT_public_key *pk, PKT_signature *sig, gcry_mpi_t value)
+{
+  struct sig_cache_item *item;
+  byte key[32];
+  int rc;
+
+  rc = parse_sig_data (sig);
+  if (rc)
+    return rc;
+  if (!sig_cache_fname || !sig_cache_size || opt.no_sig_cache
+      || sig->sig_class < 0x10 || sig->sig_class > 0x30
+      || sig_cache_key (key, pk, sig, value))
+    return pk_verify (pk->pubkey_algo, value, sig->data, pk->pkey);
+
+  if (!sig_cache_loaded)
+    sig_cache_load ();
+  item = sig_cache_find (key);
+  if (item)
+    {
+      sig_cache_stats.hits++;
+      item->flags |= SIG_CACHE_USED;
+      return ((item->flags & SIG_CACHE_GOOD)?
+              0 : gpg_error (GPG_ERR_BAD_SIGNATURE));
+    }
+  sig_cache_stats.misses++;
+
+  rc = pk_verify (pk->pubkey_algo, value, sig->data, pk->pkey);
+  if ((!rc || gpg_err_code (rc) == GPG_ERR_BAD_SIGNATURE)
+      && sig_cache_count < 2 * sig_cache_size)
+    {
+      sig_cache_add (key, (rc? 0 : SIG_CACHE_GOOD) | SIG_CACHE_NEW);
+      sig_cache_added++;
+    }
+  return rc;
+}
+
 
 /****************
  * Check the signature which is contained in SIG.
@@ -150,6 +549,10 @@ signature_check2 (PKT_signature *sig, gcry_md_hd_t digest, u32 *r_expiredate,
         int i;
         char hashbuf[20];
 
+        /* The values have already been decoded for the check above;
+           thus this can't fail unless the packet is corrupt.  */
+        if (parse_sig_data (sig))
+          return G10ERR_BAD_SIGN;
         nbytes = 6;
 	for (i=0; i < nsig; i++ )
           {
@@ -263,12 +666,30 @@ static int
 do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
 	  int *r_expired, int *r_revoked, PKT_public_key *ret_pk )
 {
-    gcry_mpi_t result = NULL;
     int rc = 0;
 
     if( (rc=do_check_messages(pk,sig,r_expired,r_revoked)) )
         return rc;
 
+    rc = do_check_digest (pk, sig, digest);
+
+    if(!rc && ret_pk)
+      copy_public_key(ret_pk,pk);
+
+    return rc;
+}
+
+
+/* The cryptographic part of do_check: Complete DIGEST with the
+   trailer of SIG and verify it using PK.  Other than do_check this
+   does not look at the validity of PK and thus does not print any
+   messages about it.  */
+static int
+do_check_digest (PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest)
+{
+    gcry_mpi_t result = NULL;
+    int rc = 0;
+
     if (sig->digest_algo == GCRY_MD_MD5
         && !opt.flags.allow_weak_digest_algos)
       {
@@ -333,7 +754,7 @@ do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
     result = encode_md_value( pk, NULL, digest, sig->digest_algo );
     if (!result)
         return G10ERR_GENERAL;
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+    rc = cached_pk_verify (pk, sig, result);
     gcry_mpi_release (result);
 
     if( !rc && sig->flags.unknown_critical )
@@ -343,9 +764,6 @@ do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
 	rc = G10ERR_BAD_SIGN;
       }
 
-    if(!rc && ret_pk)
-      copy_public_key(ret_pk,pk);
-
     return rc;
 }
 
@@ -680,3 +1098,304 @@ check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 
     return rc;
 }
+
+
+/* Digest contexts used by check_keyblock_sigs for one digest
+   algorithm.  BASE has the primary key hashed, UID[0] and UID[1]
+   additionally the current user ID in the v3 and v4 style, and SUB
+   the current subkey.  */
+struct keyblock_md_s
+{
+  struct keyblock_md_s *next;
+  int algo;
+  gcry_md_hd_t base;
+  gcry_md_hd_t uid[2];
+  gcry_md_hd_t sub;
+};
+
+
+/* Return true if check_key_signature would print a time conflict
+   message while checking SIG with PK.  */
+static int
+sig_time_conflict (PKT_public_key *pk, PKT_signature *sig)
+{
+  if (opt.ignore_time_conflict)
+    return 0;
+  return (pk->timestamp > sig->timestamp
+          || pk->timestamp > make_timestamp ());
+}
+
+
+/* Verify all not yet checked signatures of the keyblock ROOT and
+   store the result in the signature flags, so that the following
+   calls of check_key_signature for these signatures take the cached
+   path.  The primary key is hashed only once per digest algorithm
+   and the user ID or subkey only once for all signatures bound to
+   it; each signature then works on a copy of that digest state.  If
+   SELF_ONLY is set only the self-signatures are checked.
+
+   Signatures which would make check_key_signature print a
+   diagnostic, revocations by designated revokers and certifications
+   by subkeys are left alone; they are checked the usual way later.
+   Nothing is done with --no-sig-cache.  */
+void
+check_keyblock_sigs (KBNODE root, int self_only)
+{
+  struct keyblock_md_s *mdlist = NULL, *m;
+  PKT_public_key *pk, *signer;
+  PKT_signature *sig;
+  KBNODE node, unode = NULL, snode = NULL;
+  gcry_md_hd_t md, *ctx;
+  u32 keyid[2];
+  int i, rc, selfsig;
+
+  if (opt.no_sig_cache)
+    return;
+  assert (root->pkt->pkttype == PKT_PUBLIC_KEY);
+  pk = root->pkt->pkt.public_key;
+  keyid_from_pk (pk, keyid);
+
+  for (node = root->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_USER_ID
+          || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          for (m = mdlist; m; m = m->next)
+            {
+              if (node->pkt->pkttype == PKT_USER_ID)
+                {
+                  for (i=0; i < 2; i++)
+                    {
+                      gcry_md_close (m->uid[i]);
+                      m->uid[i] = NULL;
+                    }
+                }
+              else
+                {
+                  gcry_md_close (m->sub);
+                  m->sub = NULL;
+                }
+            }
+          if (node->pkt->pkttype == PKT_USER_ID)
+            unode = node;
+          else
+            snode = node;
+          continue;
+        }
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked
+          || openpgp_pk_test_algo (sig->pubkey_algo)
+          || openpgp_md_test_algo (sig->digest_algo))
+        continue;
+      selfsig = (keyid[0] == sig->keyid[0] && keyid[1] == sig->keyid[1]);
+
+      /* Find the context with the data signed by SIG hashed.  */
+      for (m = mdlist; m; m = m->next)
+        if (m->algo == sig->digest_algo)
+          break;
+      if (!m)
+        {
+          m = xmalloc_clear (sizeof *m);
+          m->algo = sig->digest_algo;
+          if (gcry_md_open (&m->base, m->algo, 0))
+            BUG ();
+          hash_public_key (m->base, pk);
+          m->next = mdlist;
+          mdlist = m;
+        }
+      if (sig->sig_class == 0x20)
+        {
+          if (!selfsig)
+            continue;  /* Designated revoker.  */
+          ctx = &m->base;
+        }
+      else if (sig->sig_class == 0x1f)
+        ctx = &m->base;
+      else if (sig->sig_class == 0x18 || sig->sig_class == 0x28)
+        {
+          if (!snode)
+            continue;
+          ctx = &m->sub;
+          if (!*ctx)
+            {
+              if (gcry_md_copy (ctx, m->base))
+                BUG ();
+              hash_public_key (*ctx, snode->pkt->pkt.public_key);
+            }
+        }
+      else
+        {
+          if (!unode || (!selfsig && self_only))
+            continue;
+          ctx = &m->uid[sig->version >= 4];
+          if (!*ctx)
+            {
+              if (gcry_md_copy (ctx, m->base))
+                BUG ();
+              hash_uid_node (unode, *ctx, sig);
+            }
+        }
+
+      /* Like check_key_signature we use the key of the signer only
+         for certifications; everything else is checked with the
+         primary key.  */
+      if (selfsig || ctx == &m->base || ctx == &m->sub)
+        {
+          if (sig_time_conflict (pk, sig))
+            continue;
+          if (gcry_md_copy (&md, *ctx))
+            BUG ();
+          rc = do_check_digest (pk, sig, md);
+        }
+      else
+        {
+          /* An expired or revoked signer is reported by do_check;
+             leave such certifications to check_key_signature.  */
+          signer = xmalloc_clear (sizeof *signer);
+          if (get_pubkey (signer, sig->keyid)
+              || !signer->is_primary || sig_time_conflict (signer, sig)
+              || sig_time_conflict (pk, sig)
+              || signer->has_expired || signer->is_revoked
+              || (signer->expiredate
+                  && signer->expiredate < make_timestamp ()))
+            {
+              free_public_key (signer);
+              continue;
+            }
+          if (gcry_md_copy (&md, *ctx))
+            BUG ();
+          rc = do_check_digest (signer, sig, md);
+          free_public_key (signer);
+        }
+      gcry_md_close (md);
+      cache_sig_result (sig, rc);
+    }
+
+  while ((m = mdlist))
+    {
+      mdlist = m->next;
+      gcry_md_close (m->base);
+      gcry_md_close (m->uid[0]);
+      gcry_md_close (m->uid[1]);
+      gcry_md_close (m->sub);
+      xfree (m);
+    }
+}
+
+
+/* Check the self-signatures of the N keyblocks in LIST using JOBS
+   processes.  JOBS-1 child processes are forked which check every
+   JOBS-th keyblock and send the results back as new entries for the
+   signature cache; the caller checks its own share directly.  The
+   keyblocks are not changed by the children, so the actual import
+   still needs to call check_keyblock_sigs, but it will then find all
+   results in the cache.  If anything goes wrong with a child process
+   its results are simply missing from the cache.  Nothing is done if
+   the signature cache is not used.  */
+void
+check_keyblock_sigs_parallel (KBNODE *list, int n, int jobs)
+{
+#ifndef HAVE_W32_SYSTEM
+  pid_t *pids;
+  int *fds;
+  int i, k, fd[2];
+  unsigned int start;
+  byte buf[SIG_CACHE_RECLEN];
+  FILE *fp;
+  struct sig_cache_item *item;
+
+  if (!sig_cache_fname || !sig_cache_size || opt.no_sig_cache)
+    return;
+  if (jobs > n)
+    jobs = n;
+  if (jobs < 2)
+    return;
+  /* Load the cache now so that the children don't need to.  */
+  if (!sig_cache_loaded)
+    sig_cache_load ();
+
+  pids = xcalloc (jobs, sizeof *pids);
+  fds = xcalloc (jobs, sizeof *fds);
+  fflush (NULL);
+  for (k=1; k < jobs; k++)
+    {
+      if (pipe (fd))
+        break;
+      pids[k] = fork ();
+      if (pids[k] == (pid_t)-1)
+        {
+          close (fd[0]);
+          close (fd[1]);
+          break;
+        }
+      if (!pids[k])
+        {
+          /* The child.  Diagnostics are left to the parent which
+             checks the same signatures again; thus the log, which
+             may go to a file or socket shared with the parent, and
+             the status output are redirected to /dev/null.  We use
+             _exit so that no cleanup handlers, like the one
+             releasing the keyring locks, are run.  */
+          close (fd[0]);
+          i = open ("/dev/null", O_WRONLY);
+          if (i == -1 || dup2 (i, 2) == -1)
+            _exit (2);
+          log_set_fd (2);
+          set_status_fd (-1);
+          set_status_callback (NULL, NULL);
+          start = sig_cache_count;
+          for (i=k; i < n; i += jobs)
+            if (list[i]->pkt->pkttype == PKT_PUBLIC_KEY)
+              check_keyblock_sigs (list[i], 1);
+          fp = fdopen (fd[1], "wb");
+          if (!fp)
+            _exit (2);
+          for (; start < sig_cache_count; start++)
+            {
+              item = sig_cache_items[start];
+              memcpy (buf, item->key, 32);
+              buf[32] = (item->flags & SIG_CACHE_GOOD);
+              if (fwrite (buf, SIG_CACHE_RECLEN, 1, fp) != 1)
+                _exit (2);
+            }
+          _exit (fclose (fp)? 2 : 0);
+        }
+      close (fd[1]);
+      fds[k] = fd[0];
+    }
+
+  for (i=0; i < n; i += jobs)
+    if (list[i]->pkt->pkttype == PKT_PUBLIC_KEY)
+      check_keyblock_sigs (list[i], 1);
+
+  /* Collect the results.  If we were not able to start all children
+     the keyblocks of the missing ones are checked later.  */
+  for (k=1; k < jobs && pids[k] > 0; k++)
+    {
+      fp = fdopen (fds[k], "rb");
+      if (!fp)
+        close (fds[k]);
+      else
+        {
+          while (fread (buf, SIG_CACHE_RECLEN, 1, fp) == 1)
+            if (!sig_cache_find (buf) && sig_cache_count < 2 * sig_cache_size)
+              {
+                sig_cache_add (buf, (buf[32] & SIG_CACHE_GOOD)|SIG_CACHE_NEW);
+                sig_cache_added++;
+              }
+          fclose (fp);
+        }
+      while (waitpid (pids[k], &i, 0) == (pid_t)-1 && errno == EINTR)
+        ;
+    }
+  xfree (fds);
+  xfree (pids);
+#else
+  (void)list;
+  (void)n;
+  (void)jobs;
+#endif
+}
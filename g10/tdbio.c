@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "gpg.h"
 #include "status.h"
@@ -50,26 +53,41 @@
 
 
 /****************
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  Records are kept in a hash table indexed by the
+ * record number and on a list ordered by their last use.  Records
+ * read from the file are cached as well as modified ones.  Modified
+ * records are written back only if the cache needs room or on
+ * tdbio_sync; this is done in the order of the record numbers so
+ * that runs of adjacent records can be written with one call.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct {
-    CACHE_CTRL next;
+    CACHE_CTRL next;       /* Next in the hash chain.  */
+    CACHE_CTRL lru_prev;
+    CACHE_CTRL lru_next;
     struct {
-	unsigned used:1;
 	unsigned dirty:1;
     } flags;
     ulong recno;
     char data[TRUST_RECORD_LEN];
 };
 
-#define MAX_CACHE_ENTRIES_SOFT	200    /* may be increased while in a */
-#define MAX_CACHE_ENTRIES_HARD	10000  /* transaction to this one */
-static CACHE_CTRL cache_list;
+#define DEFAULT_CACHE_ENTRIES  4096  /* may be increased while in a */
+#define CACHE_TRANSACTION_FACTOR  4  /* transaction by this factor */
+#define WRITEBACK_RUN          64    /* Max. records per write call.  */
+static unsigned int cache_size = DEFAULT_CACHE_ENTRIES;
+static CACHE_CTRL *cache_table;
+static unsigned int cache_table_mask;
+static CACHE_CTRL cache_mru;   /* Most recently used entry.  */
+static CACHE_CTRL cache_lru;   /* Least recently used entry.  */
 static int cache_entries;
-static int cache_is_dirty;
+static int cache_dirty_count;
+static struct {
+    ulong hits;
+    ulong misses;
+    ulong flushes;
+    ulong written;
+} cache_stats;
 
 /* a type used to pass infomation to cmp_krec_fpr */
 struct cmp_krec_fpr_struct {
@@ -91,6 +109,12 @@ static int is_locked;
 static int  db_fd = -1;
 static int in_transaction;
 
+/* With --trustdb-mmap the file is mapped read-only and records not in
+   the cache are taken directly from the mapping.  */
+static const byte *db_map;
+static size_t db_maplen;
+static int db_map_failed;
+
 static void open_db(void);
 
 
@@ -99,6 +123,89 @@ static void open_db(void);
  ************* record cache **********
  *************************************/
 
+/* Set the number of records kept in the cache to NRECORDS and return
+   the old value.  This should be called before the trustdb is
+   opened.  */
+unsigned int
+tdbio_set_cache_size (unsigned int nrecords)
+{
+  unsigned int old = cache_size;
+
+  if (nrecords < 16)
+    nrecords = 16;
+  cache_size = nrecords;
+  return old;
+}
+
+
+/* Print the counters of the record cache.  */
+void
+tdbio_print_stats (void)
+{
+  if (db_fd == -1)
+    return;
+  log_info ("trustdb cache: %d entries, %lu hits, %lu misses,"
+            " %lu flushes, %lu records written\n",
+            cache_entries, cache_stats.hits, cache_stats.misses,
+            cache_stats.flushes, cache_stats.written);
+}
+
+
+static void
+cache_unlink (CACHE_CTRL r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    cache_mru = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    cache_lru = r->lru_prev;
+}
+
+static void
+cache_push (CACHE_CTRL r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = cache_mru;
+  if (cache_mru)
+    cache_mru->lru_prev = r;
+  else
+    cache_lru = r;
+  cache_mru = r;
+}
+
+static CACHE_CTRL
+cache_find (ulong recno)
+{
+  CACHE_CTRL r;
+
+  if (!cache_table)
+    return NULL;
+  for (r = cache_table[recno & cache_table_mask]; r; r = r->next)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+/* Remove R from the cache without releasing it.  */
+static void
+cache_remove (CACHE_CTRL r)
+{
+  CACHE_CTRL *pp;
+
+  cache_unlink (r);
+  for (pp = &cache_table[r->recno & cache_table_mask]; *pp != r;
+       pp = &(*pp)->next)
+    ;
+  *pp = r->next;
+  if (r->flags.dirty)
+    cache_dirty_count--;
+  cache_entries--;
+}
+
+
 /****************
  * Get the data from therecord cache and return a
  * pointer into that cache.  Caller should copy
@@ -107,39 +214,155 @@ static void open_db(void);
 static const char *
 get_record_from_cache( ulong recno )
 {
-    CACHE_CTRL r;
+    CACHE_CTRL r = cache_find (recno);
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->recno == recno )
-	    return r->data;
+    if( !r ) {
+	cache_stats.misses++;
+	return NULL;
     }
-    return NULL;
+    cache_stats.hits++;
+    if( r != cache_mru ) {
+	cache_unlink (r);
+	cache_push (r);
+    }
+    return r->data;
 }
 
 
 static int
-write_cache_item( CACHE_CTRL r )
+cmp_cache_recno (const void *a, const void *b)
+{
+  ulong ra = (*(const CACHE_CTRL *)a)->recno;
+  ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+  return ra < rb? -1 : ra > rb;
+}
+
+/****************
+ * Write all modified records back to the file and mark them as
+ * clean.  The records are written in ascending order and runs of
+ * adjacent records are written with one call.
+ */
+static int
+write_dirty_records (void)
 {
-    gpg_error_t err;
-    int n;
-
-    if( lseek( db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
-        err = gpg_error_from_syserror ();
-	log_error(_("trustdb rec %lu: lseek failed: %s\n"),
-					    r->recno, strerror(errno) );
-	return err;
+    gpg_error_t err = 0;
+    char buffer[WRITEBACK_RUN * TRUST_RECORD_LEN];
+    CACHE_CTRL r, *list;
+    int i, j, k, n, nlist;
+
+    list = xmalloc( cache_dirty_count * sizeof *list );
+    for( nlist=0, r = cache_mru; r; r = r->lru_next )
+	if( r->flags.dirty )
+	    list[nlist++] = r;
+    assert( nlist == cache_dirty_count );
+    qsort( list, nlist, sizeof *list, cmp_cache_recno );
+
+    for( i=0; i < nlist; i = j ) {
+	for( j=i+1; (j < nlist && j - i < WRITEBACK_RUN
+		     && list[j]->recno == list[j-1]->recno + 1); j++ )
+	    ;
+	for( k=i; k < j; k++ )
+	    memcpy( buffer + (k-i) * TRUST_RECORD_LEN, list[k]->data,
+		    TRUST_RECORD_LEN );
+
+	if( lseek( db_fd, list[i]->recno * TRUST_RECORD_LEN,
+		   SEEK_SET ) == -1 ) {
+	    err = gpg_error_from_syserror ();
+	    log_error(_("trustdb rec %lu: lseek failed: %s\n"),
+		      list[i]->recno, strerror(errno) );
+	    break;
+	}
+	n = write( db_fd, buffer, (j-i) * TRUST_RECORD_LEN );
+	if( n != (j-i) * TRUST_RECORD_LEN ) {
+	    err = gpg_error_from_syserror ();
+	    log_error(_("trustdb rec %lu: write failed (n=%d): %s\n"),
+		      list[i]->recno, n, strerror(errno) );
+	    break;
+	}
+	for( k=i; k < j; k++ )
+	    list[k]->flags.dirty = 0;
+	cache_dirty_count -= j - i;
+	cache_stats.written += j - i;
     }
-    n = write( db_fd, r->data, TRUST_RECORD_LEN);
-    if( n != TRUST_RECORD_LEN ) {
-        err = gpg_error_from_syserror ();
-	log_error(_("trustdb rec %lu: write failed (n=%d): %s\n"),
-					    r->recno, n, strerror(errno) );
-	return err;
+    cache_stats.flushes++;
+    xfree( list );
+    return err;
+}
+
+
+/****************
+ * Return a new cache entry for the record RECNO.  If the cache is
+ * full the least recently used entry is reused; modified records are
+ * written back to make this possible.  Returns NULL and stores an
+ * error code at R_RC if no entry is available.
+ */
+static CACHE_CTRL
+new_cache_item( ulong recno, int *r_rc )
+{
+    CACHE_CTRL r = NULL;
+    unsigned int n;
+
+    *r_rc = 0;
+    if( !cache_table ) {
+	for( n = 64; n < cache_size / 2 && n < (1 << 20); n <<= 1 )
+	    ;
+	cache_table = xcalloc( n, sizeof *cache_table );
+	cache_table_mask = n - 1;
+    }
+
+    if( cache_entries >= (int)cache_size ) {
+	r = cache_lru;
+	if( r->flags.dirty && in_transaction ) {
+	    /* We can't write back while in a transaction: use the least
+	     * recently used clean entry or increase the cache size */
+	    for( ; r && r->flags.dirty; r = r->lru_prev )
+		;
+	    if( !r && (cache_entries
+		       >= (int)cache_size * CACHE_TRANSACTION_FACTOR) ) {
+		log_info(_("trustdb transaction too large\n"));
+		*r_rc = G10ERR_RESOURCE_LIMIT;
+		return NULL;
+	    }
+	    if( !r && opt.debug && !(cache_entries % 100) )
+		log_debug("increasing tdbio cache size\n");
+	}
+	else if( r->flags.dirty ) {
+	    int rc;
+
+	    if( !is_locked ) {
+		if( make_dotlock( lockhandle, -1 ) )
+		    log_fatal("can't acquire lock - giving up\n");
+		else
+		    is_locked = 1;
+	    }
+	    rc = write_dirty_records ();
+	    if( !opt.lock_once ) {
+		if( !release_dotlock( lockhandle ) )
+		    is_locked = 0;
+	    }
+	    if( rc ) {
+		*r_rc = rc;
+		return NULL;
+	    }
+	}
+	if( r )
+	    cache_remove (r);
     }
+
+    if( !r )
+	r = xmalloc( sizeof *r );
+    r->recno = recno;
     r->flags.dirty = 0;
-    return 0;
+    n = recno & cache_table_mask;
+    r->next = cache_table[n];
+    cache_table[n] = r;
+    cache_push (r);
+    cache_entries++;
+    return r;
 }
 
+
 /****************
  * Put data into the cache.  This function may flush the
  * some cache entries if there is not enough space available.
@@ -147,149 +370,41 @@ write_cache_item( CACHE_CTRL r )
 int
 put_record_into_cache( ulong recno, const char *data )
 {
-    CACHE_CTRL r, unused;
-    int dirty_count = 0;
-    int clean_count = 0;
+    CACHE_CTRL r;
+    int rc;
 
     /* see whether we already cached this one */
-    for( unused = NULL, r = cache_list; r; r = r->next ) {
-	if( !r->flags.used ) {
-	    if( !unused )
-		unused = r;
-	}
-	else if( r->recno == recno ) {
-	    if( !r->flags.dirty ) {
-		/* Hmmm: should we use a a copy and compare? */
-		if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
-		    r->flags.dirty = 1;
-		    cache_is_dirty = 1;
-		}
-	    }
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    return 0;
-	}
-	if( r->flags.used ) {
-	    if( r->flags.dirty )
-		dirty_count++;
-	    else
-		clean_count++;
-	}
-    }
-    /* not in the cache: add a new entry */
-    if( unused ) { /* reuse this entry */
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
-    }
-    /* see whether we reached the limit */
-    if( cache_entries < MAX_CACHE_ENTRIES_SOFT ) { /* no */
-	r = xmalloc( sizeof *r );
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	r->next = cache_list;
-	cache_list = r;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
-    }
-    /* cache is full: discard some clean entries */
-    if( clean_count ) {
-	int n = clean_count / 3; /* discard a third of the clean entries */
-	if( !n )
-	    n = 1;
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && !r->flags.dirty ) {
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
-		if( !--n )
-		    break;
+    r = cache_find (recno);
+    if( r ) {
+	if( !r->flags.dirty ) {
+	    if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
+		r->flags.dirty = 1;
+		cache_dirty_count++;
 	    }
 	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
 	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
-    }
-    /* no clean entries: have to flush some dirty entries */
-    if( in_transaction ) {
-	/* but we can't do this while in a transaction
-	 * we increase the cache size instead */
-	if( cache_entries < MAX_CACHE_ENTRIES_HARD ) { /* no */
-	    if( opt.debug && !(cache_entries % 100) )
-		log_debug("increasing tdbio cache size\n");
-	    r = xmalloc( sizeof *r );
-	    r->flags.used = 1;
-	    r->recno = recno;
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    r->flags.dirty = 1;
-	    r->next = cache_list;
-	    cache_list = r;
-	    cache_is_dirty = 1;
-	    cache_entries++;
-	    return 0;
+	if( r != cache_mru ) {
+	    cache_unlink (r);
+	    cache_push (r);
 	}
-	log_info(_("trustdb transaction too large\n"));
-	return G10ERR_RESOURCE_LIMIT;
-    }
-    if( dirty_count ) {
-	int n = dirty_count / 5; /* discard some dirty entries */
-	if( !n )
-	    n = 1;
-	if( !is_locked ) {
-	    if( make_dotlock( lockhandle, -1 ) )
-		log_fatal("can't acquire lock - giving up\n");
-	    else
-		is_locked = 1;
-	}
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		int rc = write_cache_item( r );
-		if( rc )
-		    return rc;
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
-		if( !--n )
-		    break;
-	    }
-	}
-	if( !opt.lock_once ) {
-	    if( !release_dotlock( lockhandle ) )
-		is_locked = 0;
-	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
 	return 0;
     }
-    BUG();
+
+    /* not in the cache: add a new entry */
+    r = new_cache_item( recno, &rc );
+    if( !r )
+	return rc;
+    memcpy( r->data, data, TRUST_RECORD_LEN );
+    r->flags.dirty = 1;
+    cache_dirty_count++;
+    return 0;
 }
 
 
 int
 tdbio_is_dirty()
 {
-    return cache_is_dirty;
+    return !!cache_dirty_count;
 }
 
 
@@ -299,15 +414,15 @@ tdbio_is_dirty()
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
     int did_lock = 0;
+    int rc;
 
     if( db_fd == -1 )
 	open_db();
     if( in_transaction )
 	log_bug("tdbio: syncing while in transaction\n");
 
-    if( !cache_is_dirty )
+    if( !cache_dirty_count )
 	return 0;
 
     if( !is_locked ) {
@@ -317,14 +432,9 @@ tdbio_sync()
 	    is_locked = 1;
 	did_lock = 1;
     }
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
-    cache_is_dirty = 0;
+    rc = write_dirty_records ();
+    if( rc )
+	return rc;
     if( did_lock && !opt.lock_once ) {
 	if( !release_dotlock( lockhandle ) )
 	    is_locked = 0;
@@ -385,21 +495,19 @@ tdbio_end_transaction()
 int
 tdbio_cancel_transaction()
 {
-    CACHE_CTRL r;
+    CACHE_CTRL r, r2;
 
     if( !in_transaction )
 	log_bug("tdbio: no active transaction\n");
 
     /* remove all dirty marked entries, so that the original ones
      * are read back the next time */
-    if( cache_is_dirty ) {
-	for( r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		r->flags.used = 0;
-		cache_entries--;
-	    }
+    for( r = cache_mru; r && cache_dirty_count; r = r2 ) {
+	r2 = r->lru_next;
+	if( r->flags.dirty ) {
+	    cache_remove (r);
+	    xfree (r);
 	}
-	cache_is_dirty = 0;
     }
 
     in_transaction = 0;
@@ -1164,6 +1272,51 @@ tdbio_dump_record( TRUSTREC *rec, FILE *fp  )
     }
 }
 
+/****************
+ * Make sure that the mapping of the trustdb covers the record RECNUM.
+ * The file is mapped on first use and mapped again after it has
+ * grown.  Writers still use write(2) under the dotlock; as the
+ * mapping is shared it sees their changes and, because the trustdb
+ * is never truncated, it stays valid.  Returns true if the record
+ * can be read from the mapping.
+ */
+static int
+map_db( ulong recnum )
+{
+#ifdef HAVE_MMAP
+    struct stat st;
+    off_t need = (off_t)(recnum + 1) * TRUST_RECORD_LEN;
+    void *map;
+
+    if( db_map && need <= (off_t)db_maplen )
+	return 1;
+    if( !opt.trustdb_mmap || db_map_failed || db_fd == -1 )
+	return 0;
+    if( fstat( db_fd, &st ) || st.st_size < need
+	|| (off_t)(size_t)st.st_size != st.st_size )
+	return 0;
+
+    if( db_map )
+	munmap( (void*)db_map, db_maplen );
+    db_map = NULL;
+    db_maplen = 0;
+    map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, db_fd, 0 );
+    if( map == MAP_FAILED ) {
+	if( opt.verbose )
+	    log_info("can't map `%s': %s\n", db_name, strerror(errno) );
+	db_map_failed = 1;
+	return 0;
+    }
+    db_map = map;
+    db_maplen = (size_t)st.st_size;
+    return 1;
+#else
+    (void)recnum;
+    return 0;
+#endif
+}
+
+
 /****************
  * read the record with number recnum
  * returns: -1 on error, 0 on success
@@ -1179,6 +1332,8 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
     if( db_fd == -1 )
 	open_db();
     buf = get_record_from_cache( recnum );
+    if( !buf && map_db( recnum ) )
+	buf = db_map + recnum * TRUST_RECORD_LEN;
     if( !buf ) {
 	if( lseek( db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
             err = gpg_error_from_syserror ();
@@ -1196,6 +1351,15 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
 	    return err;
 	}
 	buf = readbuf;
+	/* Keep a copy in the cache; failing to do so is not an error. */
+	{
+	    CACHE_CTRL r;
+	    int rc;
+
+	    r = new_cache_item( recnum, &rc );
+	    if( r )
+		memcpy( r->data, readbuf, TRUST_RECORD_LEN );
+	}
     }
     rec->recnum = recnum;
     rec->dirty = 0;
@@ -102,6 +102,8 @@ int tdbio_db_matches_options(void);
 byte tdbio_read_model(void);
 ulong tdbio_read_nextcheck (void);
 int tdbio_write_nextcheck (ulong stamp);
+unsigned int tdbio_set_cache_size (unsigned int nrecords);
+void tdbio_print_stats (void);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
 int tdbio_begin_transaction(void);
@@ -22,7 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifndef DISABLE_REGEX
 #include <sys/types.h>
@@ -38,6 +42,7 @@
 #include "packet.h"
 #include "main.h"
 #include "i18n.h"
+#include "host2net.h"
 #include "tdbio.h"
 #include "trustdb.h"
 
@@ -48,6 +53,7 @@
  */
 struct key_item {
   struct key_item *next;
+  struct key_item *hnext;  /* Used by index_klist.  */
   unsigned int ownertrust,min_ownertrust;
   byte trust_depth;
   byte trust_value;
@@ -58,6 +64,26 @@ struct key_item {
 
 typedef struct key_item **KeyHashTable; /* see new_key_hash_table() */
 
+/*
+ * While scanning all keys for the first level of the validation we
+ * remember which key certified which other key.  The following levels
+ * then only need to look at the keys certified by a key of the
+ * current klist.  The table is indexed by the signer's key ID.
+ */
+struct cert_item {
+  struct cert_item *next;
+  u32 signer[2];
+  u32 kid[2];
+};
+typedef struct cert_item **CertHashTable;
+#define CERT_HASH_SIZE 65536
+
+/* The opaque value for search_skipfnc.  */
+struct skip_tables {
+  KeyHashTable full_trust;
+  KeyHashTable candidates;  /* If set skip all keys not in this table. */
+};
+
 /*
  * Structure to keep track of keys, this is used as an array wherre
  * the item right after the last one has a keyblock set to NULL.
@@ -173,6 +199,104 @@ add_key_hash_table (KeyHashTable tbl, u32 *kid)
   tbl[(kid[1] & 0x03ff)] = kk;
 }
 
+/*
+ * Return a hash table of the key items in KLIST.  The items are
+ * chained via their HNEXT field, so KLIST must not be changed while
+ * the table is in use.  Release the table with xfree.
+ */
+static struct key_item **
+index_klist (struct key_item *klist)
+{
+  struct key_item **tbl, *k, *kk;
+  int idx;
+
+  tbl = xmalloc_clear (1024 * sizeof *tbl);
+  for (k = klist; k; k = k->next)
+    {
+      idx = (k->kid[1] & 0x03ff);
+      for (kk = tbl[idx]; kk; kk = kk->hnext)
+        if (kk->kid[0] == k->kid[0] && kk->kid[1] == k->kid[1])
+          break;
+      if (kk)
+        continue; /* The first one in KLIST wins.  */
+      k->hnext = tbl[idx];
+      tbl[idx] = k;
+    }
+  return tbl;
+}
+
+static void
+release_cert_hash_table (CertHashTable tbl)
+{
+  struct cert_item *c, *c2;
+  int i;
+
+  if (!tbl)
+    return;
+  for (i=0; i < CERT_HASH_SIZE; i++)
+    for (c = tbl[i]; c; c = c2)
+      {
+        c2 = c->next;
+        xfree (c);
+      }
+  xfree (tbl);
+}
+
+/*
+ * Remember all signatures on KEYBLOCK which have not been made by the
+ * key itself.
+ */
+static void
+add_cert_hash_table (CertHashTable tbl, KBNODE keyblock)
+{
+  KBNODE node;
+  PKT_signature *sig;
+  struct cert_item *c;
+  u32 kid[2];
+  int idx;
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  for (node=keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1])
+        continue;
+      idx = (sig->keyid[1] & (CERT_HASH_SIZE - 1));
+      for (c = tbl[idx]; c; c = c->next)
+        if (c->signer[0] == sig->keyid[0] && c->signer[1] == sig->keyid[1]
+            && c->kid[0] == kid[0] && c->kid[1] == kid[1])
+          break;
+      if (c)
+        continue;
+      c = xmalloc (sizeof *c);
+      c->signer[0] = sig->keyid[0];
+      c->signer[1] = sig->keyid[1];
+      c->kid[0] = kid[0];
+      c->kid[1] = kid[1];
+      c->next = tbl[idx];
+      tbl[idx] = c;
+    }
+}
+
+/*
+ * Return a table with the key IDs of all keys certified by a key in
+ * KLIST.
+ */
+static KeyHashTable
+certified_keys (CertHashTable certs, struct key_item *klist)
+{
+  KeyHashTable tbl = new_key_hash_table ();
+  struct cert_item *c;
+
+  for (; klist; klist = klist->next)
+    for (c = certs[(klist->kid[1] & (CERT_HASH_SIZE - 1))]; c; c = c->next)
+      if (c->signer[0] == klist->kid[0] && c->signer[1] == klist->kid[1])
+        add_key_hash_table (tbl, c->kid);
+  return tbl;
+}
+
 /*
  * Release a key_array
  */
@@ -189,6 +313,421 @@ release_key_array ( struct key_array *keys )
 }
 
 
+/*********************************************
+ *******  Certification graph journal  *******
+ *********************************************/
+
+/*
+ * A full validation run saves the table of certifications collected
+ * on its first level to "trustdb.gpg.certs".  Each insert, update or
+ * delete of a public keyblock is appended by keydb.c to
+ * "trustdb.gpg.journal" as long as that file exists.  A journal line
+ * has the key ID of the changed key ("-" for a deleted key) followed
+ * by the keyring stamps (see keydb_get_stamp) before and after the
+ * change.  The next non-interactive validation run then loads the
+ * saved table instead of scanning all keys and rescans only the
+ * journaled keys.  If the stamps do not form a chain from the saved
+ * table to the current keyrings, some modification has not been
+ * journaled and a full run is done instead.
+ *
+ * Certifications are never removed from the table; a stale one only
+ * leads to another key being looked at.
+ *
+ * Layout of the table (all integers are big endian):
+ *
+ *   0  4  magic "TCRT"
+ *   4  1  version
+ *   5  3  reserved
+ *   8 20  keyring stamp
+ *  28 20  SHA-1 hash of the sorted ultimately trusted key IDs
+ *  48  4  number of records
+ *  52     records
+ *
+ * Each record is the key ID of the signer followed by the key ID of
+ * the certified key.
+ */
+#define CERTS_HDRLEN  52
+#define CERTS_VERSION 1
+#define CERTS_RECLEN  16
+
+
+static char *
+journal_fname (const char *suffix)
+{
+  const char *dbname = tdbio_get_dbname ();
+  char *fname;
+
+  fname = xmalloc (strlen (dbname) + strlen (suffix) + 1);
+  strcpy (stpcpy (fname, dbname), suffix);
+  return fname;
+}
+
+static int
+cmp_kid (const void *a, const void *b)
+{
+  const u32 *x = a;
+  const u32 *y = b;
+
+  if (x[0] != y[0])
+    return x[0] < y[0]? -1 : 1;
+  if (x[1] != y[1])
+    return x[1] < y[1]? -1 : 1;
+  return 0;
+}
+
+/* Store a hash over the key IDs of the ultimately trusted keys at
+   DIGEST.  Keys which are not ultimately trusted are skipped on the
+   first level and thus not recorded in the saved table.  */
+static void
+utk_digest (byte *digest)
+{
+  gcry_md_hd_t md;
+  struct key_item *k;
+  u32 *kids;
+  byte buf[8];
+  size_t n, i;
+
+  for (n=0, k=utk_list; k; k = k->next)
+    n++;
+  kids = xmalloc ((n+1) * 2 * sizeof *kids);
+  for (n=0, k=utk_list; k; k = k->next, n++)
+    {
+      kids[2*n] = k->kid[0];
+      kids[2*n+1] = k->kid[1];
+    }
+  qsort (kids, n, 2 * sizeof *kids, cmp_kid);
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    BUG ();
+  for (i=0; i < n; i++)
+    {
+      u32tobuf (buf, kids[2*i]);
+      u32tobuf (buf+4, kids[2*i+1]);
+      gcry_md_write (md, buf, 8);
+    }
+  gcry_md_final (md);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+  xfree (kids);
+}
+
+/* Return the size of the journal or 0 if there is none.  */
+static off_t
+journal_length (void)
+{
+  char *fname = journal_fname (EXTSEP_S "journal");
+  struct stat st;
+
+  if (stat (fname, &st))
+    st.st_size = 0;
+  xfree (fname);
+  return st.st_size;
+}
+
+/*
+ * Note that KEYBLOCK has been inserted into or updated in a public
+ * keyring or, if KEYBLOCK is NULL, that a keyblock has been deleted.
+ * OLDSTAMP is the keyring stamp taken before the change.  The caller
+ * must hold the keyring lock.
+ */
+void
+trustdb_journal_change (KBNODE keyblock, const byte *oldstamp)
+{
+  char *fname;
+  FILE *fp;
+  byte newstamp[20];
+  char oldhex[41], newhex[41];
+  u32 kid[2];
+  mode_t oldmask;
+
+  init_trustdb ();
+  if (trustdb_args.no_trustdb
+      || (opt.trust_model != TM_PGP && opt.trust_model != TM_CLASSIC))
+    return;
+
+  /* Without a saved table the next run is a full one anyway.  */
+  fname = journal_fname (EXTSEP_S "certs");
+  if (access (fname, F_OK))
+    {
+      xfree (fname);
+      return;
+    }
+  xfree (fname);
+
+  fname = journal_fname (EXTSEP_S "journal");
+  oldmask = umask (077);
+  fp = fopen (fname, "a");
+  umask (oldmask);
+  if (!fp)
+    {
+      log_info (_("can't open `%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  keydb_get_stamp (newstamp);
+  bin2hex (oldstamp, 20, oldhex);
+  bin2hex (newstamp, 20, newhex);
+  if (!keyblock)
+    fprintf (fp, "- %s %s\n", oldhex, newhex);
+  else if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+    {
+      keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+      fprintf (fp, "%08lX%08lX %s %s\n",
+               (ulong)kid[0], (ulong)kid[1], oldhex, newhex);
+    }
+  else
+    fprintf (fp, "* %s %s\n", oldhex, newhex); /* Force a full run.  */
+
+  if (fclose (fp))
+    log_info (_("error writing `%s': %s\n"), fname, strerror (errno));
+  xfree (fname);
+}
+
+/*
+ * Load the saved table of certifications and the journal.  On success
+ * the table is stored at R_CERTS, the key IDs of the journaled keys at
+ * R_CHANGED, the current keyring stamp at STAMP and the number of
+ * journal bytes read at R_JNLLEN; 0 is returned then.  Returns -1 if
+ * a full run is required.
+ */
+static int
+load_cert_graph (CertHashTable *r_certs, KeyHashTable *r_changed,
+                 byte *stamp, off_t *r_jnllen)
+{
+  char *fname, *jname;
+  FILE *fp, *jfp;
+  byte hdr[CERTS_HDRLEN], rec[CERTS_RECLEN], digest[20], chain[20];
+  byte oldstamp[20], newstamp[20];
+  char line[128], *p;
+  size_t len;
+  int off;
+  CertHashTable certs = NULL;
+  KeyHashTable changed = NULL;
+  struct cert_item *c;
+  u32 n, kid[2];
+  off_t jnllen = 0;
+  int idx;
+  int rc = -1;
+
+  *r_certs = NULL;
+  *r_changed = NULL;
+  if (!utk_list)
+    return -1;
+
+  fname = journal_fname (EXTSEP_S "certs");
+  fp = fopen (fname, "rb");
+  if (!fp)
+    {
+      xfree (fname);
+      return -1;
+    }
+  utk_digest (digest);
+  if (fread (hdr, CERTS_HDRLEN, 1, fp) != 1
+      || memcmp (hdr, "TCRT", 4) || hdr[4] != CERTS_VERSION
+      || memcmp (hdr+28, digest, 20))
+    goto leave;
+  memcpy (chain, hdr+8, 20);
+
+  /* Check that all modifications of the keyrings since the table was
+     saved have been journaled and collect the changed keys.  */
+  changed = new_key_hash_table ();
+  jname = journal_fname (EXTSEP_S "journal");
+  jfp = fopen (jname, "r");
+  xfree (jname);
+  if (jfp)
+    {
+      while (fgets (line, sizeof line, jfp))
+        {
+          len = strlen (line);
+          if (!len || line[len-1] != '\n')
+            break;
+          p = strchr (line, ' ');
+          if (!p)
+            break;
+          *p++ = 0;
+          if ((off = hex2bin (p, oldstamp, 20)) < 0
+              || hex2bin (p+off, newstamp, 20) < 0
+              || memcmp (oldstamp, chain, 20))
+            break;
+          memcpy (chain, newstamp, 20);
+          if (!strcmp (line, "*"))
+            break;
+          if (strcmp (line, "-"))
+            {
+              if (strlen (line) != 16 || hex2bin (line, rec, 8) < 0)
+                break;
+              kid[0] = buftou32 (rec);
+              kid[1] = buftou32 (rec+4);
+              add_key_hash_table (changed, kid);
+            }
+          jnllen += len;
+        }
+      if (!feof (jfp) || ferror (jfp))
+        {
+          fclose (jfp);
+          goto leave;
+        }
+      fclose (jfp);
+    }
+  keydb_get_stamp (stamp);
+  if (memcmp (chain, stamp, 20))
+    goto leave;
+
+  certs = xmalloc_clear (CERT_HASH_SIZE * sizeof *certs);
+  for (n = buftou32 (hdr+48); n; n--)
+    {
+      if (fread (rec, CERTS_RECLEN, 1, fp) != 1)
+        goto leave;
+      c = xmalloc (sizeof *c);
+      c->signer[0] = buftou32 (rec);
+      c->signer[1] = buftou32 (rec+4);
+      c->kid[0] = buftou32 (rec+8);
+      c->kid[1] = buftou32 (rec+12);
+      idx = (c->signer[1] & (CERT_HASH_SIZE - 1));
+      c->next = certs[idx];
+      certs[idx] = c;
+    }
+
+  *r_certs = certs;
+  certs = NULL;
+  *r_changed = changed;
+  changed = NULL;
+  *r_jnllen = jnllen;
+  rc = 0;
+
+ leave:
+  if (rc && opt.verbose)
+    log_info (_("%s: not usable; checking all keys\n"), fname);
+  fclose (fp);
+  xfree (fname);
+  release_cert_hash_table (certs);
+  release_key_hash_table (changed);
+  return rc;
+}
+
+/*
+ * Save the table CERTS which describes the keyrings with STAMP and
+ * remove the first JNLLEN bytes of the journal which are covered by
+ * it.  If CERTS is NULL the table and the journal are removed.
+ */
+static void
+save_cert_graph (CertHashTable certs, const byte *stamp, off_t jnllen)
+{
+  char *fname, *jname, *tmpfname = NULL;
+  FILE *fp = NULL;
+  byte buf[CERTS_HDRLEN];
+  struct cert_item *c;
+  char *tail = NULL;
+  off_t len;
+  size_t n;
+  u32 count;
+  mode_t oldmask;
+  int i;
+
+  fname = journal_fname (EXTSEP_S "certs");
+  jname = journal_fname (EXTSEP_S "journal");
+  if (!certs)
+    {
+      remove (fname);
+      remove (jname);
+      goto leave;
+    }
+
+  tmpfname = xmalloc (strlen (fname) + 5);
+  strcpy (stpcpy (tmpfname, fname), EXTSEP_S "tmp");
+  oldmask = umask (077);
+  fp = fopen (tmpfname, "wb");
+  umask (oldmask);
+  if (!fp)
+    {
+      log_info (_("can't create `%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+
+  for (count=0, i=0; i < CERT_HASH_SIZE; i++)
+    for (c = certs[i]; c; c = c->next)
+      count++;
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, "TCRT", 4);
+  buf[4] = CERTS_VERSION;
+  memcpy (buf+8, stamp, 20);
+  utk_digest (buf+28);
+  u32tobuf (buf+48, count);
+  if (fwrite (buf, CERTS_HDRLEN, 1, fp) != 1)
+    goto write_error;
+  for (i=0; i < CERT_HASH_SIZE; i++)
+    for (c = certs[i]; c; c = c->next)
+      {
+        u32tobuf (buf, c->signer[0]);
+        u32tobuf (buf+4, c->signer[1]);
+        u32tobuf (buf+8, c->kid[0]);
+        u32tobuf (buf+12, c->kid[1]);
+        if (fwrite (buf, CERTS_RECLEN, 1, fp) != 1)
+          goto write_error;
+      }
+  if (fclose (fp))
+    {
+      fp = NULL;
+      goto write_error;
+    }
+  fp = NULL;
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    {
+      log_info (_("renaming `%s' to `%s' failed: %s\n"),
+                tmpfname, fname, strerror (errno));
+      remove (tmpfname);
+      goto leave;
+    }
+
+  /* Drop the journaled changes covered by the new table but keep
+     those appended by other processes in the meantime.  */
+  len = journal_length ();
+  if (len <= jnllen)
+    remove (jname);
+  else
+    {
+      n = len - jnllen;
+      tail = xmalloc (n);
+      fp = fopen (jname, "r");
+      if (!fp || fseek (fp, jnllen, SEEK_SET)
+          || fread (tail, n, 1, fp) != 1)
+        {
+          remove (jname);
+          goto leave;
+        }
+      fclose (fp);
+      fp = fopen (tmpfname, "w");
+      if (!fp || fwrite (tail, n, 1, fp) != 1)
+        {
+          remove (tmpfname);
+          remove (jname);
+          goto leave;
+        }
+      if (fclose (fp) || rename (tmpfname, jname))
+        remove (jname);
+      fp = NULL;
+    }
+  goto leave;
+
+ write_error:
+  log_info (_("error writing `%s': %s\n"), tmpfname, strerror (errno));
+  remove (tmpfname);
+
+ leave:
+  if (fp)
+    fclose (fp);
+  xfree (tail);
+  xfree (tmpfname);
+  xfree (jname);
+  xfree (fname);
+}
+
+
+
 /*********************************************
  **********  Initialization  *****************
  *********************************************/
@@ -1459,12 +1998,14 @@ store_validation_status (int depth, KBNODE keyblock, KeyHashTable stored)
 }
 
 /*
- * check whether the signature sig is in the klist k
+ * check whether the signature sig is in the klist indexed by KIDX
  */
 static struct key_item *
-is_in_klist (struct key_item *k, PKT_signature *sig)
+is_in_klist (struct key_item **kidx, PKT_signature *sig)
 {
-  for (; k; k = k->next)
+  struct key_item *k;
+
+  for (k = kidx[(sig->keyid[1] & 0x03ff)]; k; k = k->hnext)
     {
       if (k->kid[0] == sig->keyid[0] && k->kid[1] == sig->keyid[1])
         return k;
@@ -1483,7 +2024,7 @@ is_in_klist (struct key_item *k, PKT_signature *sig)
  */
 static void
 mark_usable_uid_certs (KBNODE keyblock, KBNODE uidnode,
-                       u32 *main_kid, struct key_item *klist,
+                       u32 *main_kid, struct key_item **klist,
                        u32 curtime, u32 *next_expire)
 {
   KBNODE node;
@@ -1938,7 +2479,7 @@ check_regexp(const char *expr,const char *string)
  * This function assumes that all kbnode flags are cleared on entry.
  */
 static int
-validate_one_keyblock (KBNODE kb, struct key_item *klist,
+validate_one_keyblock (KBNODE kb, struct key_item **klist,
                        u32 curtime, u32 *next_expire)
 {
   struct key_item *kr;
@@ -2103,8 +2644,12 @@ validate_one_keyblock (KBNODE kb, struct key_item *klist,
 static int
 search_skipfnc (void *opaque, u32 *kid, PKT_user_id *dummy)
 {
+  struct skip_tables *tables = opaque;
+
   (void)dummy;
-  return test_key_hash_table ((KeyHashTable)opaque, kid);
+  if (tables->candidates && !test_key_hash_table (tables->candidates, kid))
+    return 1;
+  return test_key_hash_table (tables->full_trust, kid);
 }
 
 
@@ -2113,17 +2658,22 @@ search_skipfnc (void *opaque, u32 *kid, PKT_user_id *dummy)
  * kllist.  The caller has to pass keydb handle so that we don't use
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
- * Caller hast to release the returned array.
+ * Caller hast to release the returned array.  KLIST is the hash
+ * table of the klist as returned by index_klist.  If CANDIDATES is
+ * given only the keys in this table are looked at.  If CERTS is given
+ * the signatures of all scanned keys are stored there.
  */
 static struct key_array *
 validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+                   KeyHashTable candidates, CertHashTable certs,
+                   struct key_item **klist, u32 curtime, u32 *next_expire)
 {
   KBNODE keyblock = NULL;
   struct key_array *keys = NULL;
   size_t nkeys, maxkeys;
   int rc;
   KEYDB_SEARCH_DESC desc;
+  struct skip_tables tables;
 
   maxkeys = 1000;
   keys = xmalloc ((maxkeys+1) * sizeof *keys);
@@ -2139,8 +2689,10 @@ validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
 
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  tables.full_trust = full_trust;
+  tables.candidates = candidates;
   desc.skipfnc = search_skipfnc;
-  desc.skipfncvalue = full_trust;
+  desc.skipfncvalue = &tables;
   rc = keydb_search (hd, &desc, 1);
   if (rc == -1)
     {
@@ -2179,6 +2731,8 @@ validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
       /* prepare the keyblock for further processing */
       merge_keys_and_selfsig (keyblock);
       clear_kbnode_flags (keyblock);
+      if (certs)
+        add_cert_hash_table (certs, keyblock);
       pk = keyblock->pkt->pkt.public_key;
       if (pk->has_expired || pk->is_revoked)
         {
@@ -2303,14 +2857,34 @@ validate_keys (int interactive)
   int depth;
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
+  KeyHashTable candidates = NULL;
+  CertHashTable certs = NULL;
+  KeyHashTable changed = NULL;
+  struct key_item **kidx = NULL;
   u32 start_time, next_expire;
+  byte stamp[20];
+  off_t jnllen = 0;
+  int incremental = 0;
+  int i;
 
-  /* Make sure we have all sigs cached.  TODO: This is going to
-     require some architectual re-thinking, as it is agonizingly slow.
-     Perhaps combine this with reset_trust_records(), or only check
-     the caches on keys that are actually involved in the web of
-     trust. */
-  keydb_rebuild_caches(0);
+  /* If the table of certifications saved by the last run is still
+     valid we only need to look at the keys changed since then.  */
+  if (!interactive)
+    incremental = !load_cert_graph (&certs, &changed, stamp, &jnllen);
+  if (!incremental)
+    {
+      /* Make sure we have all sigs cached.  TODO: This is going to
+         require some architectual re-thinking, as it is agonizingly
+         slow.  Perhaps combine this with reset_trust_records(), or
+         only check the caches on keys that are actually involved in
+         the web of trust. */
+      keydb_rebuild_caches(0);
+      keydb_get_stamp (stamp);
+      jnllen = journal_length ();
+    }
+  else if (opt.verbose)
+    log_info (_("checking only the keys changed since the last"
+                " trustdb check\n"));
 
   start_time = make_timestamp ();
   next_expire = 0xffffffff; /* set next expire to the year 2106 */
@@ -2429,9 +3003,32 @@ validate_keys (int interactive)
 	  valids++;
         }
 
-      /* Find all keys which are signed by a key in kdlist */
-      keys = validate_key_list (kdb, full_trust, klist,
+      /* Find all keys which are signed by a key in kdlist.  The
+         first level looks at all keys and records who signed whom;
+         a key not signed by any key in klist can't get any validity
+         on the following levels and is thus skipped there.  All
+         other effects of looking at such a key have already been
+         taken care of on the first level.  An incremental run takes
+         the certifications from the saved table and looks at the
+         journaled keys on the first level to update it.  */
+      kidx = index_klist (klist);
+      if (!depth && !incremental)
+        certs = xmalloc_clear (CERT_HASH_SIZE * sizeof *certs);
+      else
+        {
+          candidates = certified_keys (certs, klist);
+          if (!depth)
+            for (i=0; i < 1024; i++)
+              for (k = changed[i]; k; k = k->next)
+                add_key_hash_table (candidates, k->kid);
+        }
+      keys = validate_key_list (kdb, full_trust, candidates,
+                                depth? NULL : certs, kidx,
 				start_time, &next_expire);
+      xfree (kidx);
+      kidx = NULL;
+      release_key_hash_table (candidates);
+      candidates = NULL;
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2511,8 +3108,11 @@ validate_keys (int interactive)
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
   release_key_hash_table (stored);
+  release_key_hash_table (changed);
   if (!rc && !quit) /* mark trustDB as checked */
     {
+      save_cert_graph (certs, stamp, jnllen);
+
       if (next_expire == 0xffffffff || next_expire < start_time )
         tdbio_write_nextcheck (0);
       else
@@ -2532,6 +3132,7 @@ validate_keys (int interactive)
       do_sync ();
       pending_check_trustdb = 0;
     }
+  release_cert_hash_table (certs);
 
   return rc;
 }
@@ -56,6 +56,7 @@ int string_to_trust_value (const char *str);
 void revalidation_mark (void);
 int trustdb_pending_check(void);
 void trustdb_check_or_update(void);
+void trustdb_journal_change (KBNODE keyblock, const byte *oldstamp);
 
 int cache_disabled_value(PKT_public_key *pk);
 
@@ -225,8 +225,8 @@ verify_files( int nfiles, char **files )
 
 /* Perform a verify operation.  To verify detached signatures, DATA_FD
    shall be the descriptor of the signed data; for regular signatures
-   it needs to be -1.  If OUT_FP is not NULL and DATA_FD is not -1 the
-   the signed material gets written that stream. 
+   it needs to be -1.  DATA_FD is not closed.  If OUT_FP is not NULL
+   and DATA_FD is not -1 the signed material gets written that stream.
 
    FIXME: OUTFP is not yet implemented.
 */
@@ -29,6 +29,7 @@
         map_assuan_err_with_source (GPG_ERR_SOURCE_DEFAULT, (a))
 
 #include <sys/types.h> /* off_t */
+#include <sys/stat.h>  /* struct stat */
 
 /* We include the type defintions from jnlib instead of defining our
    owns here.  This will not allow us build KBX in a standalone way
@@ -74,7 +75,7 @@ struct keybox_name
   /* Not yet used.  */
   int is_locked;
 
-  /* Not yet used.  */
+  /* Set if we already tried to create the hash index.  */
   int did_full_scan;
 
   /* The name of the resource file. */
@@ -95,6 +96,12 @@ struct keybox_handle {
   CONST_KB_NAME kb;
   int secret;             /* this is for a secret keybox */
   FILE *fp;
+  /* If MAP is not NULL the keybox has been mapped into memory for
+     searching and FP is not used.  MAPPOS is the offset of the next
+     blob to look at.  */
+  unsigned char *map;
+  size_t maplen;
+  size_t mappos;
   int eof;
   int error;
   int ephemeral;
@@ -183,12 +190,32 @@ int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp);
 int _keybox_read_blob2 (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
 int _keybox_write_header_blob (FILE *fp);
+int _keybox_map_file (KEYBOX_HANDLE hd);
+void _keybox_unmap_file (KEYBOX_HANDLE hd);
+int _keybox_map_next_blob (KEYBOX_HANDLE hd, const unsigned char **r_image,
+                           size_t *r_imagelen, off_t *r_off);
 
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
                                           int what,
                                           size_t *flag_off, size_t *flag_size);
+#ifdef KEYBOX_WITH_X509
+gpg_err_code_t _keybox_x509_keygrip (const unsigned char *buffer,
+                                     size_t length, unsigned char *grip);
+#endif /*KEYBOX_WITH_X509*/
+
+/*-- keybox-hidx.c --*/
+int _keybox_hidx_desc_key (KEYBOX_SEARCH_DESC *desc,
+                           const unsigned char *sn, int snlen,
+                           unsigned char *key);
+gpg_error_t _keybox_hidx_lookup (KEYBOX_HANDLE hd, const struct stat *st,
+                                 const unsigned char *key,
+                                 off_t **r_offs, size_t *r_noffs);
+void _keybox_hidx_insert (const char *fname, const struct stat *oldst,
+                          const unsigned char *image, size_t imagelen);
+void _keybox_hidx_touch (const char *fname, const struct stat *oldst);
+void _keybox_hidx_remove (const char *fname);
 
 /*-- keybox-dump.c --*/
 int _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp);
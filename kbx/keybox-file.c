@@ -23,6 +23,12 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#ifdef HAVE_MMAP
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+#endif
 
 #include "keybox-defs.h"
 
@@ -115,6 +121,112 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp)
 }
 
 
+/* Map the keybox file of HD into memory for searching.  Returns 0 on
+   success or an error code; in the latter case the caller should use
+   the stdio based functions instead.  */
+int
+_keybox_map_file (KEYBOX_HANDLE hd)
+{
+#ifdef HAVE_MMAP
+  int fd;
+  struct stat st;
+  void *map;
+
+  if (hd->map)
+    return 0;
+
+  fd = open (hd->kb->fname, O_RDONLY);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      gpg_error_t tmperr = gpg_error_from_syserror ();
+      close (fd);
+      return tmperr;
+    }
+  /* An empty file can't be mapped; let the stdio code handle it.  */
+  if (!st.st_size || (off_t)(size_t)st.st_size != st.st_size)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  map = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return gpg_error_from_syserror ();
+
+  hd->map = map;
+  hd->maplen = (size_t)st.st_size;
+  hd->mappos = 0;
+  return 0;
+#else /*!HAVE_MMAP*/
+  (void)hd;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Release the memory mapping of HD, if any.  */
+void
+_keybox_unmap_file (KEYBOX_HANDLE hd)
+{
+#ifdef HAVE_MMAP
+  if (hd->map)
+    {
+      munmap (hd->map, hd->maplen);
+      hd->map = NULL;
+      hd->maplen = 0;
+      hd->mappos = 0;
+    }
+#else
+  (void)hd;
+#endif
+}
+
+
+/* Return the next blob of the mapped keybox HD without copying it.
+   On success R_IMAGE is set to the start of the blob within the
+   mapping, R_IMAGELEN to its length and R_OFF to its offset in the
+   file.  The image is only valid until the file is unmapped.  Empty
+   blobs are skipped.  Returns -1 on EOF.  This is the mapped
+   counterpart to _keybox_read_blob.  */
+int
+_keybox_map_next_blob (KEYBOX_HANDLE hd, const unsigned char **r_image,
+                       size_t *r_imagelen, off_t *r_off)
+{
+  const unsigned char *p;
+  size_t imagelen, nleft;
+
+  for (;;)
+    {
+      *r_image = NULL;
+      if (hd->mappos >= hd->maplen)
+        return -1; /* eof */
+      p = hd->map + hd->mappos;
+      nleft = hd->maplen - hd->mappos;
+      if (nleft < 5)
+        return gpg_error (GPG_ERR_TOO_SHORT);
+
+      imagelen = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      if (imagelen > 500000) /* Sanity check. */
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      if (imagelen < 5)
+        return gpg_error (GPG_ERR_TOO_SHORT);
+      if (imagelen > nleft)
+        return gpg_error (GPG_ERR_TOO_SHORT);
+
+      *r_off = (off_t)hd->mappos;
+      hd->mappos += imagelen;
+      if (p[4]) /* Skip empty blobs.  */
+        break;
+    }
+
+  *r_image = p;
+  *r_imagelen = imagelen;
+  return 0;
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, FILE *fp)
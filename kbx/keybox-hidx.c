@@ -0,0 +1,798 @@
+/* keybox-hidx.c - Hash index for keybox files
+ * Copyright (C) 2014 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The hash index is a companion file to a keybox which maps the
+   fingerprints, keygrips and issuer/serial number pairs of the
+   stored certificates to the file offsets of their blobs.  It is used
+   by keybox_search to jump directly to the candidate blobs for an
+   exact lookup instead of scanning the entire keybox.  The matching
+   is still done on the actual blob; thus a stale entry (e.g. one for
+   a deleted blob) does no harm.
+
+   The file starts with a header of HIDX_HDRLEN bytes:
+
+     byte[4]  magic "KBXI"
+     byte     version (1)
+     byte[3]  reserved
+     u32      number of slots (a power of 2)
+     u32      number of used slots
+     u32      high and low part of the size of the keybox
+     u32      mtime of the keybox
+     u32      high and low part of the inode of the keybox
+     u32      reserved
+
+   followed by an open addressing hash table with linear probing:
+
+     byte[8]  first 8 bytes of the SHA-1 hash over the search key
+     u32      high and low part of the blob offset plus 1
+
+   All numbers are stored in network byte order.  A value of 0 for
+   the offset marks an unused slot; the offset is stored plus 1
+   because keyboxes without a header blob start with a certificate
+   blob at offset 0.  The size, mtime and inode stored in the
+   header must match the keybox; any change to the keybox not done
+   through this module invalidates the index.  An invalid index is
+   rebuilt on demand.  The rebuild is done without a lock on the
+   keybox; thus each process writes to a temporary file of its own
+   and the new index is only used if the keybox did not change while
+   it was read.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+# define fseeko(a,b,c) fseek ((a), (long)(b), (c))
+#endif
+
+#define HIDX_HDRLEN   40
+#define HIDX_SLOTLEN  16
+#define HIDX_VERSION  2
+#define HIDX_MINSLOTS 64
+
+/* Values to prefix the hashed data so that different kinds of keys
+   yield different hashes.  */
+#define HIDX_TAG_FPR    'F'
+#define HIDX_TAG_GRIP   'G'
+#define HIDX_TAG_ISSN   'I'
+
+
+struct hidx_header
+{
+  u32 nslots;
+  u32 nused;
+  off_t size;
+  u32 mtime;
+  unsigned long long ino;
+};
+
+struct hidx_entry
+{
+  unsigned char key[8];
+  off_t off;
+};
+
+struct hidx_list
+{
+  struct hidx_entry *items;
+  size_t nitems;
+  size_t size;
+};
+
+
+
+static inline u32
+get32 (const unsigned char *buffer)
+{
+  return ((u32)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8)
+          | buffer[3];
+}
+
+static inline unsigned int
+get16 (const unsigned char *buffer)
+{
+  return (buffer[0] << 8) | buffer[1];
+}
+
+static inline void
+put32 (unsigned char *buffer, u32 a)
+{
+  buffer[0] = a >> 24;
+  buffer[1] = a >> 16;
+  buffer[2] = a >>  8;
+  buffer[3] = a;
+}
+
+
+/* Return a malloced string with the name of the index file for the
+   keybox FNAME.  */
+static char *
+hidx_fname (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = xtrymalloc (strlen (fname) + 5);
+  if (!idxfname)
+    return NULL;
+#ifdef USE_ONLY_8DOT3
+  if (strlen (fname) > 4 && !strcmp (fname + strlen (fname) - 4, ".kbx"))
+    {
+      strcpy (idxfname, fname);
+      strcpy (idxfname + strlen (fname) - 4, ".kbi");
+      return idxfname;
+    }
+#endif
+  strcpy (stpcpy (idxfname, fname), ".idx");
+  return idxfname;
+}
+
+
+/* Store the stat information ST into HDR.  */
+static void
+hidx_set_stamp (struct hidx_header *hdr, const struct stat *st)
+{
+  hdr->size  = st->st_size;
+  hdr->mtime = (u32)st->st_mtime;
+  hdr->ino   = (unsigned long long)st->st_ino;
+}
+
+/* Return true if the stamp in HDR matches the stat information ST.  */
+static int
+hidx_stamp_matches (const struct hidx_header *hdr, const struct stat *st)
+{
+  return (hdr->size == st->st_size
+          && hdr->mtime == (u32)st->st_mtime
+          && hdr->ino == (unsigned long long)st->st_ino);
+}
+
+
+static int
+hidx_read_header (FILE *fp, struct hidx_header *hdr)
+{
+  unsigned char buf[HIDX_HDRLEN];
+
+  if (fseeko (fp, 0, SEEK_SET) || fread (buf, HIDX_HDRLEN, 1, fp) != 1)
+    return -1;
+  if (memcmp (buf, "KBXI", 4) || buf[4] != HIDX_VERSION)
+    return -1;
+  hdr->nslots = get32 (buf+8);
+  hdr->nused  = get32 (buf+12);
+  hdr->size   = (off_t)(((unsigned long long)get32 (buf+16) << 32)
+                        | get32 (buf+20));
+  hdr->mtime  = get32 (buf+24);
+  hdr->ino    = ((unsigned long long)get32 (buf+28) << 32) | get32 (buf+32);
+  if (hdr->nslots < HIDX_MINSLOTS || (hdr->nslots & (hdr->nslots - 1))
+      || hdr->nused >= hdr->nslots)
+    return -1;
+  return 0;
+}
+
+
+static int
+hidx_write_header (FILE *fp, const struct hidx_header *hdr)
+{
+  unsigned char buf[HIDX_HDRLEN];
+  unsigned long long size = (unsigned long long)hdr->size;
+
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, "KBXI", 4);
+  buf[4] = HIDX_VERSION;
+  put32 (buf+8, hdr->nslots);
+  put32 (buf+12, hdr->nused);
+  put32 (buf+16, (u32)(size >> 32));
+  put32 (buf+20, (u32)size);
+  put32 (buf+24, hdr->mtime);
+  put32 (buf+28, (u32)(hdr->ino >> 32));
+  put32 (buf+32, (u32)hdr->ino);
+  if (fseeko (fp, 0, SEEK_SET) || fwrite (buf, HIDX_HDRLEN, 1, fp) != 1)
+    return -1;
+  return 0;
+}
+
+
+/* Hash the data A,ALEN and B,BLEN prefixed by TAG and store the
+   first 8 bytes of the digest at KEY.  B may be NULL.  */
+static void
+hidx_make_key (unsigned char *key, int tag,
+               const void *a, size_t alen, const void *b, size_t blen)
+{
+  gcry_md_hd_t md;
+  unsigned char prefix[1];
+
+  prefix[0] = tag;
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    {
+      memset (key, 0, 8);
+      return;
+    }
+  gcry_md_write (md, prefix, 1);
+  gcry_md_write (md, a, alen);
+  if (b)
+    {
+      gcry_md_putc (md, 0);
+      gcry_md_write (md, b, blen);
+    }
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 8);
+  gcry_md_close (md);
+}
+
+
+/* Compute the index key for the search descriptor DESC.  SN,SNLEN is
+   the binary serial number for an issuer/serial search.  Returns 0
+   if DESC can be looked up in the index.  */
+int
+_keybox_hidx_desc_key (KEYBOX_SEARCH_DESC *desc,
+                       const unsigned char *sn, int snlen,
+                       unsigned char *key)
+{
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_FPR:
+    case KEYDB_SEARCH_MODE_FPR20:
+      hidx_make_key (key, HIDX_TAG_FPR, desc->u.fpr, 20, NULL, 0);
+      return 0;
+#ifdef KEYBOX_WITH_X509
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      hidx_make_key (key, HIDX_TAG_GRIP, desc->u.grip, 20, NULL, 0);
+      return 0;
+#endif
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+      if (!desc->u.name || !sn || snlen < 0)
+        return -1;
+      hidx_make_key (key, HIDX_TAG_ISSN, desc->u.name, strlen (desc->u.name),
+                     sn, snlen);
+      return 0;
+    default:
+      return -1;
+    }
+}
+
+
+static int
+hidx_list_add (struct hidx_list *list, const unsigned char *key, off_t off)
+{
+  if (list->nitems == list->size)
+    {
+      size_t n = list->size? list->size * 2 : 256;
+      struct hidx_entry *tmp;
+
+      tmp = xtryrealloc (list->items, n * sizeof *tmp);
+      if (!tmp)
+        return -1;
+      list->items = tmp;
+      list->size = n;
+    }
+  memcpy (list->items[list->nitems].key, key, 8);
+  list->items[list->nitems].off = off;
+  list->nitems++;
+  return 0;
+}
+
+
+/* Add the index keys of the blob BUFFER,LENGTH stored at offset OFF
+   to LIST.  */
+static int
+hidx_list_add_blob (struct hidx_list *list,
+                    const unsigned char *buffer, size_t length, off_t off)
+{
+  unsigned char key[8];
+  size_t pos, nkeys, keyinfolen, nserial, nuids, uidinfolen, idx;
+  const unsigned char *serial;
+
+  if (length < 40 || (buffer[4] != BLOBTYPE_X509 && buffer[4] != BLOBTYPE_PGP))
+    return 0;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (keyinfolen < 28)
+    return 0;
+  pos = 20;
+  if (pos + keyinfolen*nkeys + 2 > length)
+    return 0;
+  for (idx=0; idx < nkeys; idx++)
+    {
+      hidx_make_key (key, HIDX_TAG_FPR, buffer + pos + idx*keyinfolen, 20,
+                     NULL, 0);
+      if (hidx_list_add (list, key, off))
+        return -1;
+    }
+
+  if (buffer[4] != BLOBTYPE_X509)
+    return 0;
+
+#ifdef KEYBOX_WITH_X509
+  {
+    unsigned char grip[20];
+
+    if (!_keybox_x509_keygrip (buffer, length, grip))
+      {
+        hidx_make_key (key, HIDX_TAG_GRIP, grip, 20, NULL, 0);
+        if (hidx_list_add (list, key, off))
+          return -1;
+      }
+  }
+#endif /*KEYBOX_WITH_X509*/
+
+  /* The issuer is the first user ID of an X.509 blob.  */
+  pos += keyinfolen*nkeys;
+  nserial = get16 (buffer + pos);
+  serial = buffer + pos + 2;
+  pos += 2 + nserial;
+  if (pos + 4 > length)
+    return 0;
+  nuids = get16 (buffer + pos);
+  uidinfolen = get16 (buffer + pos + 2);
+  pos += 4;
+  if (nuids < 1 || uidinfolen < 12 || pos + uidinfolen*nuids > length)
+    return 0;
+  {
+    size_t off_name = get32 (buffer + pos);
+    size_t len_name = get32 (buffer + pos + 4);
+
+    if (!len_name || off_name + len_name > length)
+      return 0;
+    hidx_make_key (key, HIDX_TAG_ISSN, buffer + off_name, len_name,
+                   serial, nserial);
+    if (hidx_list_add (list, key, off))
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* Return true if SLOT is in use.  */
+static int
+hidx_slot_used (const unsigned char *slot)
+{
+  return get32 (slot+8) || get32 (slot+12);
+}
+
+
+/* Return the blob offset stored in the used SLOT.  */
+static off_t
+hidx_slot_offset (const unsigned char *slot)
+{
+  return (off_t)((((unsigned long long)get32 (slot+8) << 32)
+                  | get32 (slot+12)) - 1);
+}
+
+
+/* Store KEY and OFF in SLOT.  */
+static void
+hidx_slot_set (unsigned char *slot, const unsigned char *key, off_t off)
+{
+  unsigned long long value = (unsigned long long)off + 1;
+
+  memcpy (slot, key, 8);
+  put32 (slot+8, (u32)(value >> 32));
+  put32 (slot+12, (u32)value);
+}
+
+
+/* Store KEY and OFF in the first free slot of TABLE.  */
+static void
+hidx_table_put (unsigned char *table, u32 nslots,
+                const unsigned char *key, off_t off)
+{
+  u32 i = get32 (key) & (nslots - 1);
+  unsigned char *slot;
+
+  for (;;)
+    {
+      slot = table + i * HIDX_SLOTLEN;
+      if (!hidx_slot_used (slot))
+        break;
+      i = (i + 1) & (nslots - 1);
+    }
+  hidx_slot_set (slot, key, off);
+}
+
+
+/* Write a new index file for the keybox FNAME from scratch.  */
+static gpg_error_t
+hidx_build (const char *fname)
+{
+  gpg_error_t err;
+  char *idxfname = NULL;
+  char *tmpfname = NULL;
+  FILE *fp = NULL;
+  FILE *newfp = NULL;
+  struct stat st, newst;
+  mode_t oldmask;
+  struct hidx_header hdr;
+  struct hidx_list list;
+  KEYBOXBLOB blob = NULL;
+  unsigned char *table = NULL;
+  const unsigned char *buffer;
+  size_t length, n;
+  u32 nslots;
+  int rc;
+
+  memset (&list, 0, sizeof list);
+
+  idxfname = hidx_fname (fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  while (!(rc = _keybox_read_blob (&blob, fp)))
+    {
+      buffer = _keybox_get_blob_image (blob, &length);
+      if (hidx_list_add_blob (&list, buffer, length,
+                              _keybox_get_blob_fileoffset (blob)))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      _keybox_release_blob (blob);
+      blob = NULL;
+    }
+  if (rc != -1)
+    {
+      err = rc;
+      goto leave;
+    }
+
+  /* Leave enough room so that some inserts can be done in place.  */
+  for (nslots = HIDX_MINSLOTS; nslots < 2 * list.nitems; nslots *= 2)
+    ;
+  table = xtrycalloc (nslots, HIDX_SLOTLEN);
+  if (!table)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (n=0; n < list.nitems; n++)
+    hidx_table_put (table, nslots, list.items[n].key, list.items[n].off);
+
+  hdr.nslots = nslots;
+  hdr.nused = list.nitems;
+  hidx_set_stamp (&hdr, &st);
+
+  /* Other processes may rebuild the index at the same time; thus use
+     a temporary file of our own.  */
+  tmpfname = xtrymalloc (strlen (idxfname) + 30);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  sprintf (tmpfname, "%s.%lu.tmp", idxfname, (unsigned long)getpid ());
+  remove (tmpfname);
+  oldmask = umask (077);
+  newfp = fopen (tmpfname, "wb");
+  umask (oldmask);
+  if (!newfp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (hidx_write_header (newfp, &hdr)
+      || fwrite (table, HIDX_SLOTLEN, nslots, newfp) != nslots)
+    {
+      err = gpg_error_from_syserror ();
+      fclose (newfp);
+      newfp = NULL;
+      remove (tmpfname);
+      goto leave;
+    }
+  rc = fclose (newfp);
+  newfp = NULL;
+  if (rc)
+    {
+      err = gpg_error_from_syserror ();
+      remove (tmpfname);
+      goto leave;
+    }
+  /* The keybox is not locked while we read it.  If it has been
+     changed meanwhile the index might miss some blobs and must not be
+     used.  */
+  if (stat (fname, &newst) || !hidx_stamp_matches (&hdr, &newst))
+    {
+      err = gpg_error (GPG_ERR_EAGAIN);
+      remove (tmpfname);
+      goto leave;
+    }
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  remove (idxfname);
+#endif
+  if (rename (tmpfname, idxfname))
+    {
+      err = gpg_error_from_syserror ();
+      remove (tmpfname);
+      goto leave;
+    }
+  err = 0;
+
+ leave:
+  if (fp)
+    fclose (fp);
+  _keybox_release_blob (blob);
+  xfree (list.items);
+  xfree (table);
+  xfree (tmpfname);
+  xfree (idxfname);
+  return err;
+}
+
+
+static int
+cmp_offsets (const void *a, const void *b)
+{
+  off_t oa = *(const off_t *)a;
+  off_t ob = *(const off_t *)b;
+
+  return oa < ob ? -1 : oa > ob ? 1 : 0;
+}
+
+
+/* Look up KEY in the index of the keybox of HD.  ST is the stat
+   information of the keybox as searched by HD.  On success a
+   malloced array with the sorted offsets of all candidate blobs is
+   stored at R_OFFS and their number at R_NOFFS; the array may be
+   empty.  An error is returned if the index can't be used.  If the
+   index is missing or stale and we have not yet tried to rebuild it
+   for this keybox, a new index is created.  */
+gpg_error_t
+_keybox_hidx_lookup (KEYBOX_HANDLE hd, const struct stat *st,
+                     const unsigned char *key,
+                     off_t **r_offs, size_t *r_noffs)
+{
+  gpg_error_t err;
+  char *idxfname;
+  FILE *fp = NULL;
+  struct hidx_header hdr;
+  unsigned char slot[HIDX_SLOTLEN];
+  off_t *offs = NULL;
+  size_t noffs = 0, size = 0;
+  u32 i, count;
+  off_t off;
+
+  *r_offs = NULL;
+  *r_noffs = 0;
+
+  idxfname = hidx_fname (hd->kb->fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+
+  fp = fopen (idxfname, "rb");
+  if (!fp || hidx_read_header (fp, &hdr) || !hidx_stamp_matches (&hdr, st))
+    {
+      if (fp)
+        fclose (fp);
+      fp = NULL;
+      /* Try to create a new index but only once per process so that
+         a read-only keybox does not get scanned twice for each
+         search.  */
+      if (hd->kb->did_full_scan || access (hd->kb->fname, W_OK))
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+      ((KB_NAME)hd->kb)->did_full_scan = 1;
+      err = hidx_build (hd->kb->fname);
+      if (err)
+        goto leave;
+      fp = fopen (idxfname, "rb");
+      if (!fp || hidx_read_header (fp, &hdr)
+          || !hidx_stamp_matches (&hdr, st))
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+    }
+
+  i = get32 (key) & (hdr.nslots - 1);
+  for (count=0; count < hdr.nslots; count++, i = (i + 1) & (hdr.nslots - 1))
+    {
+      if (fseeko (fp, HIDX_HDRLEN + (off_t)i * HIDX_SLOTLEN, SEEK_SET)
+          || fread (slot, HIDX_SLOTLEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_INV_OBJ);
+          goto leave;
+        }
+      if (!hidx_slot_used (slot))
+        break; /* Empty slot - end of the probe sequence.  */
+      if (memcmp (slot, key, 8))
+        continue;
+      off = hidx_slot_offset (slot);
+      if (noffs == size)
+        {
+          off_t *tmp;
+
+          size += 8;
+          tmp = xtryrealloc (offs, size * sizeof *offs);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          offs = tmp;
+        }
+      offs[noffs++] = off;
+    }
+
+  if (noffs > 1)
+    qsort (offs, noffs, sizeof *offs, cmp_offsets);
+  *r_offs = offs;
+  *r_noffs = noffs;
+  offs = NULL;
+  err = 0;
+
+ leave:
+  if (fp)
+    fclose (fp);
+  xfree (offs);
+  xfree (idxfname);
+  return err;
+}
+
+
+/* Open the index of the keybox FNAME for update.  OLDST is the stat
+   information of the keybox before it was changed.  Returns NULL if
+   there is no valid index.  */
+static FILE *
+hidx_open_for_update (const char *idxfname, const struct stat *oldst,
+                      struct hidx_header *hdr)
+{
+  FILE *fp;
+
+  fp = fopen (idxfname, "r+b");
+  if (!fp)
+    return NULL;
+  if (hidx_read_header (fp, hdr) || !hidx_stamp_matches (hdr, oldst))
+    {
+      fclose (fp);
+      return NULL;
+    }
+  return fp;
+}
+
+
+/* Update the index of the keybox FNAME after the blob IMAGE,IMAGELEN
+   has been appended to it.  OLDST is the stat information of the
+   keybox before the insert or NULL if it did not exist.  If the index
+   can't be updated it is removed.  */
+void
+_keybox_hidx_insert (const char *fname, const struct stat *oldst,
+                     const unsigned char *image, size_t imagelen)
+{
+  char *idxfname;
+  FILE *fp = NULL;
+  struct hidx_header hdr;
+  struct hidx_list list;
+  struct stat st;
+  unsigned char slot[HIDX_SLOTLEN];
+  size_t n;
+  u32 i;
+  int okay = 0;
+
+  memset (&list, 0, sizeof list);
+  idxfname = hidx_fname (fname);
+  if (!idxfname)
+    return;
+
+  if (!oldst || !(fp = hidx_open_for_update (idxfname, oldst, &hdr)))
+    goto leave;
+  if (hidx_list_add_blob (&list, image, imagelen, oldst->st_size))
+    goto leave;
+  if ((hdr.nused + list.nitems) * 4 > hdr.nslots * 3)
+    {
+      /* Table too full - create a larger one.  */
+      fclose (fp);
+      fp = NULL;
+      okay = !hidx_build (fname);
+      goto leave;
+    }
+
+  for (n=0; n < list.nitems; n++)
+    {
+      i = get32 (list.items[n].key) & (hdr.nslots - 1);
+      for (;;)
+        {
+          if (fseeko (fp, HIDX_HDRLEN + (off_t)i * HIDX_SLOTLEN, SEEK_SET)
+              || fread (slot, HIDX_SLOTLEN, 1, fp) != 1)
+            goto leave;
+          if (!hidx_slot_used (slot))
+            break;
+          i = (i + 1) & (hdr.nslots - 1);
+        }
+      hidx_slot_set (slot, list.items[n].key, oldst->st_size);
+      if (fseeko (fp, HIDX_HDRLEN + (off_t)i * HIDX_SLOTLEN, SEEK_SET)
+          || fwrite (slot, HIDX_SLOTLEN, 1, fp) != 1)
+        goto leave;
+      hdr.nused++;
+    }
+
+  if (stat (fname, &st) || st.st_size != oldst->st_size + (off_t)imagelen)
+    goto leave;
+  hidx_set_stamp (&hdr, &st);
+  if (hidx_write_header (fp, &hdr))
+    goto leave;
+  okay = !fclose (fp);
+  fp = NULL;
+
+ leave:
+  if (fp)
+    fclose (fp);
+  if (!okay)
+    remove (idxfname);
+  xfree (list.items);
+  xfree (idxfname);
+}
+
+
+/* Update the stamp of the index of the keybox FNAME after an in-place
+   change of the keybox which did not move any blob.  OLDST is the
+   stat information of the keybox before the change.  */
+void
+_keybox_hidx_touch (const char *fname, const struct stat *oldst)
+{
+  char *idxfname;
+  FILE *fp;
+  struct hidx_header hdr;
+  struct stat st;
+  int okay = 0;
+
+  idxfname = hidx_fname (fname);
+  if (!idxfname)
+    return;
+
+  fp = hidx_open_for_update (idxfname, oldst, &hdr);
+  if (fp)
+    {
+      if (!stat (fname, &st) && st.st_size == oldst->st_size)
+        {
+          hidx_set_stamp (&hdr, &st);
+          okay = !hidx_write_header (fp, &hdr);
+        }
+      if (fclose (fp))
+        okay = 0;
+    }
+  if (!okay)
+    remove (idxfname);
+  xfree (idxfname);
+}
+
+
+/* Remove the index of the keybox FNAME.  */
+void
+_keybox_hidx_remove (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = hidx_fname (fname);
+  if (idxfname)
+    remove (idxfname);
+  xfree (idxfname);
+}
@@ -154,6 +154,7 @@ keybox_release (KEYBOX_HANDLE hd)
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_unmap_file (hd);
   xfree (hd->word_match.name);
   xfree (hd->word_match.pattern);
   xfree (hd);
@@ -227,6 +228,8 @@ _keybox_close_file (KEYBOX_HANDLE hd)
             fclose (roverhd->fp);
             roverhd->fp = NULL;
           }
+        _keybox_unmap_file (roverhd);
       }
   assert (!hd->fp);
+  assert (!hd->map);
 }
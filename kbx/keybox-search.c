@@ -30,6 +30,13 @@
 #include <gcrypt.h>
 
 
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+# define fseeko(a,b,c) fseek ((a), (long)(b), (c))
+#endif
+#if !defined(HAVE_FTELLO) && !defined(ftello)
+# define ftello(a) ((off_t)ftell ((a)))
+#endif
+
 #define xtoi_1(p)   (*(p) <= '9'? (*(p)- '0'): \
                      *(p) <= 'F'? (*(p)-'A'+10):(*(p)-'a'+10))
 #define xtoi_2(p)   ((xtoi_1(p) * 16) + xtoi_1((p)+1))
@@ -65,12 +72,8 @@ get16 (const byte *buffer)
 
 
 static inline int
-blob_get_type (KEYBOXBLOB blob)
+blob_get_type (const unsigned char *buffer, size_t length)
 {
-  const unsigned char *buffer;
-  size_t length;
-
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 32)
     return -1; /* blob too short */
 
@@ -78,12 +81,8 @@ blob_get_type (KEYBOXBLOB blob)
 }
 
 static inline unsigned int
-blob_get_blob_flags (KEYBOXBLOB blob)
+blob_get_blob_flags (const unsigned char *buffer, size_t length)
 {
-  const unsigned char *buffer;
-  size_t length;
-
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 8)
     return 0; /* oops */
 
@@ -196,15 +195,13 @@ get_flag_from_image (const unsigned char *buffer, size_t length,
 
 
 static int
-blob_cmp_sn (KEYBOXBLOB blob, const unsigned char *sn, int snlen)
+blob_cmp_sn (const unsigned char *buffer, size_t length,
+             const unsigned char *sn, int snlen)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off;
   size_t nkeys, keyinfolen;
   size_t nserial;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* blob too short */
 
@@ -228,15 +225,13 @@ blob_cmp_sn (KEYBOXBLOB blob, const unsigned char *sn, int snlen)
 
 
 static int
-blob_cmp_fpr (KEYBOXBLOB blob, const unsigned char *fpr)
+blob_cmp_fpr (const unsigned char *buffer, size_t length,
+              const unsigned char *fpr)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off;
   size_t nkeys, keyinfolen;
   int idx;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* blob too short */
 
@@ -259,16 +254,14 @@ blob_cmp_fpr (KEYBOXBLOB blob, const unsigned char *fpr)
 }
 
 static int
-blob_cmp_fpr_part (KEYBOXBLOB blob, const unsigned char *fpr,
+blob_cmp_fpr_part (const unsigned char *buffer, size_t length,
+                   const unsigned char *fpr,
                    int fproff, int fprlen)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off;
   size_t nkeys, keyinfolen;
   int idx;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* blob too short */
 
@@ -292,17 +285,14 @@ blob_cmp_fpr_part (KEYBOXBLOB blob, const unsigned char *fpr,
 
 
 static int
-blob_cmp_name (KEYBOXBLOB blob, int idx,
+blob_cmp_name (const unsigned char *buffer, size_t length, int idx,
                const char *name, size_t namelen, int substr)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off, len;
   size_t nkeys, keyinfolen;
   size_t nuids, uidinfolen;
   size_t nserial;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* blob too short */
 
@@ -384,10 +374,9 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 /* compare all email addresses of the subject.  With SUBSTR given as
    True a substring search is done in the mail address */
 static int
-blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr)
+blob_cmp_mail (const unsigned char *buffer, size_t length,
+               const char *name, size_t namelen, int substr)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off, len;
   size_t nkeys, keyinfolen;
   size_t nuids, uidinfolen;
@@ -395,7 +384,6 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr)
   int idx;
 
   /* fixme: this code is common to blob_cmp_mail */
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* blob too short */
 
@@ -456,36 +444,33 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr)
 
 
 #ifdef KEYBOX_WITH_X509
-/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
-   We don't have the keygrips as meta data, thus we need to parse the
-   certificate. Fixme: We might want to return proper error codes
-   instead of failing a search for invalid certificates etc.  */
-static int
-blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
+/* Compute the keygrip of the certificate in the X.509 blob
+   BUFFER,LENGTH and store it at GRIP which must provide space for 20
+   bytes.  We don't have the keygrips as meta data, thus we need to
+   parse the certificate.  Returns 0 on success.  */
+gpg_err_code_t
+_keybox_x509_keygrip (const unsigned char *buffer, size_t length,
+                      unsigned char *grip)
 {
   int rc;
-  const unsigned char *buffer;
-  size_t length;
   size_t cert_off, cert_len;
   ksba_reader_t reader = NULL;
   ksba_cert_t cert = NULL;
   ksba_sexp_t p = NULL;
   gcry_sexp_t s_pkey;
-  unsigned char array[20];
   unsigned char *rcp;
   size_t n;
   
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
-    return 0; /* Too short. */
+    return GPG_ERR_TOO_SHORT;
   cert_off = get32 (buffer+8);
   cert_len = get32 (buffer+12);
   if (cert_off+cert_len > length)
-    return 0; /* Too short.  */
+    return GPG_ERR_TOO_SHORT;
 
   rc = ksba_reader_new (&reader);
   if (rc)
-    return 0; /* Problem with ksba. */
+    return GPG_ERR_GENERAL; /* Problem with ksba. */
   rc = ksba_reader_set_mem (reader, buffer+cert_off, cert_len);
   if (rc)
     goto failed;
@@ -507,7 +492,7 @@ blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
       gcry_sexp_release (s_pkey);
       goto failed;
     }
-  rcp = gcry_pk_get_keygrip (s_pkey, array);
+  rcp = gcry_pk_get_keygrip (s_pkey, grip);
   gcry_sexp_release (s_pkey);
   if (!rcp)
     goto failed; /* Can't calculate keygrip. */
@@ -515,12 +500,27 @@ blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
   xfree (p);
   ksba_cert_release (cert);
   ksba_reader_release (reader);
-  return !memcmp (array, grip, 20);
+  return 0;
  failed:
   xfree (p);
   ksba_cert_release (cert);
   ksba_reader_release (reader);
-  return 0;
+  return GPG_ERR_INV_CERT_OBJ;
+}
+
+
+/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
+   Fixme: We might want to return proper error codes instead of
+   failing a search for invalid certificates etc.  */
+static int
+blob_x509_has_grip (const unsigned char *buffer, size_t length,
+                    const unsigned char *grip)
+{
+  unsigned char array[20];
+
+  if (_keybox_x509_keygrip (buffer, length, array))
+    return 0;
+  return !memcmp (array, grip, 20);
 }
 #endif /*KEYBOX_WITH_X509*/
 
@@ -530,50 +530,54 @@ blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
   The has_foo functions are used as helpers for search 
 */
 static inline int
-has_short_kid (KEYBOXBLOB blob, const unsigned char *kid)
+has_short_kid (const unsigned char *buffer, size_t length,
+               const unsigned char *kid)
 {
-  return blob_cmp_fpr_part (blob, kid+4, 16, 4);
+  return blob_cmp_fpr_part (buffer, length, kid+4, 16, 4);
 }
 
 static inline int
-has_long_kid (KEYBOXBLOB blob, const unsigned char *kid)
+has_long_kid (const unsigned char *buffer, size_t length,
+              const unsigned char *kid)
 {
-  return blob_cmp_fpr_part (blob, kid, 12, 8);
+  return blob_cmp_fpr_part (buffer, length, kid, 12, 8);
 }
 
 static inline int
-has_fingerprint (KEYBOXBLOB blob, const unsigned char *fpr)
+has_fingerprint (const unsigned char *buffer, size_t length,
+                 const unsigned char *fpr)
 {
-  return blob_cmp_fpr (blob, fpr);
+  return blob_cmp_fpr (buffer, length, fpr);
 }
 
 static inline int
-has_keygrip (KEYBOXBLOB blob, const unsigned char *grip)
+has_keygrip (const unsigned char *buffer, size_t length,
+             const unsigned char *grip)
 {
 #ifdef KEYBOX_WITH_X509
-  if (blob_get_type (blob) == BLOBTYPE_X509)
-    return blob_x509_has_grip (blob, grip);
+  if (blob_get_type (buffer, length) == BLOBTYPE_X509)
+    return blob_x509_has_grip (buffer, length, grip);
 #endif
   return 0;
 }
 
 
 static inline int
-has_issuer (KEYBOXBLOB blob, const char *name)
+has_issuer (const unsigned char *buffer, size_t length, const char *name)
 {
   size_t namelen;
 
   return_val_if_fail (name, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
 
   namelen = strlen (name);
-  return blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0);
+  return blob_cmp_name (buffer, length, 0 /* issuer */, name, namelen, 0);
 }
 
 static inline int
-has_issuer_sn (KEYBOXBLOB blob, const char *name,
+has_issuer_sn (const unsigned char *buffer, size_t length, const char *name,
                const unsigned char *sn, int snlen)
 {
   size_t namelen;
@@ -581,69 +585,87 @@ has_issuer_sn (KEYBOXBLOB blob, const char *name,
   return_val_if_fail (name, 0);
   return_val_if_fail (sn, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
 
   namelen = strlen (name);
   
-  return (blob_cmp_sn (blob, sn, snlen)
-          && blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0));
+  return (blob_cmp_sn (buffer, length, sn, snlen)
+          && blob_cmp_name (buffer, length, 0 /* issuer */, name, namelen, 0));
 }
 
 static inline int
-has_sn (KEYBOXBLOB blob, const unsigned char *sn, int snlen)
+has_sn (const unsigned char *buffer, size_t length,
+        const unsigned char *sn, int snlen)
 {
   return_val_if_fail (sn, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
-  return blob_cmp_sn (blob, sn, snlen);
+  return blob_cmp_sn (buffer, length, sn, snlen);
 }
 
 static inline int
-has_subject (KEYBOXBLOB blob, const char *name)
+has_subject (const unsigned char *buffer, size_t length, const char *name)
 {
   size_t namelen;
 
   return_val_if_fail (name, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
 
   namelen = strlen (name);
-  return blob_cmp_name (blob, 1 /* subject */, name, namelen, 0);
+  return blob_cmp_name (buffer, length, 1 /* subject */, name, namelen, 0);
 }
 
 static inline int
-has_subject_or_alt (KEYBOXBLOB blob, const char *name, int substr)
+has_subject_or_alt (const unsigned char *buffer, size_t length,
+                    const char *name, int substr)
 {
   size_t namelen;
 
   return_val_if_fail (name, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
 
   namelen = strlen (name);
-  return blob_cmp_name (blob, -1 /* all subject names*/, name,
+  return blob_cmp_name (buffer, length, -1 /* all subject names*/, name,
                         namelen, substr);
 }
 
 
 static inline int
-has_mail (KEYBOXBLOB blob, const char *name, int substr)
+has_mail (const unsigned char *buffer, size_t length,
+          const char *name, int substr)
 {
   size_t namelen;
 
   return_val_if_fail (name, 0);
 
-  if (blob_get_type (blob) != BLOBTYPE_X509)
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return 0;
 
   namelen = strlen (name);
   if (namelen && name[namelen-1] == '>')
     namelen--;
-  return blob_cmp_mail (blob, name, namelen, substr);
+  return blob_cmp_mail (buffer, length, name, namelen, substr);
+}
+
+
+/* Store the stat information of the keybox file currently searched
+   by HD at ST.  Returns 0 on success.  */
+static int
+get_search_file_stat (KEYBOX_HANDLE hd, struct stat *st)
+{
+  if (hd->fp)
+    return fstat (fileno (hd->fp), st);
+  if (stat (hd->kb->fname, st))
+    return -1;
+  if (hd->map && (off_t)hd->maplen != st->st_size)
+    return -1; /* The file has been changed since it was mapped.  */
+  return 0;
 }
 
 
@@ -681,6 +703,7 @@ keybox_search_reset (KEYBOX_HANDLE hd)
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_unmap_file (hd);
   hd->error = 0;
   hd->eof = 0;
   return 0;   
@@ -688,7 +711,11 @@ keybox_search_reset (KEYBOX_HANDLE hd)
 
 
 /* Note: When in ephemeral mode the search function does visit all
-   blobs but in standard mode, blobs flagged as ephemeral are ignored.  */
+   blobs but in standard mode, blobs flagged as ephemeral are ignored.
+   If possible the keybox is mapped into memory and the blobs are
+   compared in place; only a matching blob is copied.  Exact searches
+   for a fingerprint, keygrip or issuer/serial number use the hash
+   index to skip to the candidate blobs.  */
 int 
 keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
 {
@@ -696,7 +723,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
   size_t n;
   int need_words, any_skip;
   KEYBOXBLOB blob = NULL;
+  const unsigned char *buffer = NULL;
+  size_t length = 0;
+  off_t blob_off = 0;
   struct sn_array_s *sn_array = NULL;
+  off_t *cand = NULL;
+  size_t ncand = 0, candidx = 0;
+  int use_hidx = 0;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -741,7 +774,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
 
   (void)need_words;  /* Not yet implemented.  */
 
-  if (!hd->fp)
+  if (!hd->fp && !hd->map && _keybox_map_file (hd))
     {
       hd->fp = fopen (hd->kb->fname, "rb");
       if (!hd->fp)
@@ -813,20 +846,61 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
     }
 
 
+  if (ndesc == 1)
+    {
+      unsigned char hidxkey[8];
+      struct stat st;
+
+      if (!_keybox_hidx_desc_key (desc,
+                                  sn_array? sn_array[0].sn : desc[0].sn,
+                                  sn_array? sn_array[0].snlen : desc[0].snlen,
+                                  hidxkey)
+          && !get_search_file_stat (hd, &st)
+          && !_keybox_hidx_lookup (hd, &st, hidxkey, &cand, &ncand))
+        use_hidx = 1;
+    }
+
   for (;;)
     {
       unsigned int blobflags;
 
       _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp);
+      if (use_hidx)
+        {
+          /* Skip to the next candidate after the current position.  */
+          off_t cur = hd->map? (off_t)hd->mappos : ftello (hd->fp);
+
+          while (candidx < ncand && cand[candidx] < cur)
+            candidx++;
+          if (candidx == ncand)
+            {
+              rc = -1;
+              break;
+            }
+          if (hd->map)
+            hd->mappos = (size_t)cand[candidx];
+          else if (fseeko (hd->fp, cand[candidx], SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      if (hd->map)
+        rc = _keybox_map_next_blob (hd, &buffer, &length, &blob_off);
+      else
+        {
+          rc = _keybox_read_blob (&blob, hd->fp);
+          if (!rc)
+            buffer = _keybox_get_blob_image (blob, &length);
+        }
       if (rc)
         break;
 
-      if (blob_get_type (blob) == BLOBTYPE_HEADER)
+      if (blob_get_type (buffer, length) == BLOBTYPE_HEADER)
         continue;
 
 
-      blobflags = blob_get_blob_flags (blob);
+      blobflags = blob_get_blob_flags (buffer, length);
       if (!hd->ephemeral && (blobflags & 2))
         continue; /* Not in ephemeral mode but blob is flagged ephemeral.  */
 
@@ -838,19 +912,19 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
               never_reached ();
               break;
             case KEYDB_SEARCH_MODE_EXACT: 
-              if (has_subject_or_alt (blob, desc[n].u.name, 0))
+              if (has_subject_or_alt (buffer, length, desc[n].u.name, 0))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAIL:
-              if (has_mail (blob, desc[n].u.name, 0))
+              if (has_mail (buffer, length, desc[n].u.name, 0))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAILSUB:
-              if (has_mail (blob, desc[n].u.name, 1))
+              if (has_mail (buffer, length, desc[n].u.name, 1))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SUBSTR:
-              if (has_subject_or_alt (blob, desc[n].u.name, 1))
+              if (has_subject_or_alt (buffer, length, desc[n].u.name, 1))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAILEND:
@@ -858,39 +932,40 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
               never_reached (); /* not yet implemented */
               break;
             case KEYDB_SEARCH_MODE_ISSUER:
-              if (has_issuer (blob, desc[n].u.name))
+              if (has_issuer (buffer, length, desc[n].u.name))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_ISSUER_SN:
-              if (has_issuer_sn (blob, desc[n].u.name,
+              if (has_issuer_sn (buffer, length, desc[n].u.name,
                                  sn_array? sn_array[n].sn : desc[n].sn,
                                  sn_array? sn_array[n].snlen : desc[n].snlen))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SN:
-              if (has_sn (blob, sn_array? sn_array[n].sn : desc[n].sn,
-                                sn_array? sn_array[n].snlen : desc[n].snlen))
+              if (has_sn (buffer, length,
+                          sn_array? sn_array[n].sn : desc[n].sn,
+                          sn_array? sn_array[n].snlen : desc[n].snlen))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SUBJECT:
-              if (has_subject (blob, desc[n].u.name))
+              if (has_subject (buffer, length, desc[n].u.name))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SHORT_KID: 
-              if (has_short_kid (blob, desc[n].u.kid))
+              if (has_short_kid (buffer, length, desc[n].u.kid))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_LONG_KID:
-              if (has_long_kid (blob, desc[n].u.kid))
+              if (has_long_kid (buffer, length, desc[n].u.kid))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_FPR:
             case KEYDB_SEARCH_MODE_FPR20:
-              if (has_fingerprint (blob, desc[n].u.fpr))
+              if (has_fingerprint (buffer, length, desc[n].u.fpr))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_KEYGRIP:
-              if (has_keygrip (blob, desc[n].u.grip))
+              if (has_keygrip (buffer, length, desc[n].u.grip))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_FIRST: 
@@ -915,6 +990,22 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
       if (n == ndesc)
         break; /* got it */
     }
+
+  if (!rc && hd->map)
+    {
+      /* Copy the matching blob out of the mapping.  */
+      unsigned char *image = xtrymalloc (length);
+
+      if (!image)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          memcpy (image, buffer, length);
+          rc = _keybox_new_blob (&blob, image, length, blob_off);
+          if (rc)
+            xfree (image);
+        }
+    }
   
   if (!rc)
     {
@@ -933,6 +1024,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (cand);
 
   return rc;
 }
@@ -963,10 +1055,10 @@ keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *r_cert)
   if (!hd->found.blob)
     return gpg_error (GPG_ERR_NOTHING_FOUND);
 
-  if (blob_get_type (hd->found.blob) != BLOBTYPE_X509)
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (blob_get_type (buffer, length) != BLOBTYPE_X509)
     return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
 
-  buffer = _keybox_get_blob_image (hd->found.blob, &length);
   if (length < 40)
     return gpg_error (GPG_ERR_TOO_SHORT);
   cert_off = get32 (buffer+8);
@@ -378,6 +378,8 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   int rc;
   const char *fname;
   KEYBOXBLOB blob;
+  struct stat oldst;
+  int have_oldst;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE); 
@@ -392,10 +394,20 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
      the write operation.  */
   _keybox_close_file (hd);
 
+  have_oldst = !stat (fname, &oldst);
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
       rc = blob_filecopy (1, fname, blob, hd->secret, 0);
+      if (!rc)
+        {
+          const unsigned char *image;
+          size_t imagelen;
+
+          image = _keybox_get_blob_image (blob, &imagelen);
+          _keybox_hidx_insert (fname, have_oldst? &oldst : NULL,
+                               image, imagelen);
+        }
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -431,6 +443,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  struct stat oldst;
+  int have_oldst;
 
   (void)idx;  /* Not yet used.  */
 
@@ -458,6 +472,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  have_oldst = !stat (fname, &oldst);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -494,6 +509,10 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code_from_syserror ();
     }
 
+  /* The blob offsets did not change; thus keep the hash index.  */
+  if (have_oldst)
+    _keybox_hidx_touch (fname, &oldst);
+
   return gpg_error (ec);
 }
 
@@ -506,6 +525,8 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   FILE *fp;
   int rc;
+  struct stat oldst;
+  int have_oldst;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -523,6 +544,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   off += 4;
 
   _keybox_close_file (hd);
+  have_oldst = !stat (fname, &oldst);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -540,6 +562,11 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  /* The blob is only marked as deleted and its offset is still valid
+     in the hash index; a search will skip it.  */
+  if (have_oldst)
+    _keybox_hidx_touch (fname, &oldst);
+
   return rc;
 }
 
@@ -711,7 +738,12 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (rc || !any_changes)
     remove (tmpfname);
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      /* All offsets have changed; the index will be rebuilt on the
+         next search.  */
+      _keybox_hidx_remove (fname);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
@@ -0,0 +1,259 @@
+/* t-keybox-hidx.c - Module test for keybox-hidx.c
+ *	Copyright (C) 2014 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "keybox-defs.h"
+#include "keybox-search-desc.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+#define KBXFNAME "t-keybox-hidx.kbx"
+#define NBLOBS   3
+
+static int verbose;
+static int errcount;
+
+
+static void
+put16 (unsigned char *p, unsigned int a)
+{
+  p[0] = a >> 8;
+  p[1] = a;
+}
+
+static void
+put32 (unsigned char *p, unsigned long a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >> 8;
+  p[3] = a;
+}
+
+
+/* Store a minimal X.509 blob with the fingerprint FPR, the serial
+   number SERIAL and the issuer ISSUER at BUFFER and return its
+   length.  The certificate itself is not stored; the index only
+   needs the key and user ID tables.  */
+static size_t
+make_blob (unsigned char *buffer, const unsigned char *fpr,
+           unsigned int serial, const char *issuer)
+{
+  unsigned char *p = buffer;
+  size_t uidpos, len;
+
+  memset (buffer, 0, 512);
+  p[4] = BLOBTYPE_X509;
+  p[5] = 1;
+  p += 16;
+  put16 (p, 1);             /* Number of keys.  */
+  put16 (p+2, 28);          /* Size of a key info.  */
+  p += 4;
+  memcpy (p, fpr, 20);
+  p += 28;
+  put16 (p, 4);             /* Length of the serial number.  */
+  put32 (p+2, serial);
+  p += 6;
+  put16 (p, 1);             /* Number of user IDs.  */
+  put16 (p+2, 12);          /* Size of a user ID info.  */
+  p += 4;
+  uidpos = p - buffer;
+  p += 12;
+  put16 (p, 0);             /* Number of signatures.  */
+  put16 (p+2, 4);           /* Size of a signature info.  */
+  p += 4;
+  p += 20;                  /* Ownertrust, validity and timestamps.  */
+  p += 2;                   /* Size of the reserved space.  */
+  len = strlen (issuer);
+  put32 (buffer + uidpos, p - buffer);
+  put32 (buffer + uidpos + 4, len);
+  memcpy (p, issuer, len);
+  p += len;
+  p += 20;                  /* Checksum.  */
+  put32 (buffer, p - buffer);
+  return p - buffer;
+}
+
+
+static void
+make_fpr (unsigned char *fpr, int idx)
+{
+  int i;
+
+  for (i=0; i < 20; i++)
+    fpr[i] = (idx + 1) * 17 + i;
+}
+
+
+/* Write a keybox without a header blob so that the first certificate
+   is stored at offset 0.  Return the offsets of the blobs at
+   OFFSETS.  */
+static void
+write_keybox (off_t *offsets)
+{
+  unsigned char buffer[512];
+  unsigned char fpr[20];
+  char issuer[40];
+  FILE *fp;
+  size_t n;
+  off_t off = 0;
+  int idx;
+
+  remove (KBXFNAME);
+  remove (KBXFNAME ".idx");
+  fp = fopen (KBXFNAME, "wb");
+  if (!fp)
+    {
+      fprintf (stderr, "can't create `%s': %s\n", KBXFNAME, strerror (errno));
+      exit (1);
+    }
+  for (idx=0; idx < NBLOBS; idx++)
+    {
+      make_fpr (fpr, idx);
+      snprintf (issuer, sizeof issuer, "CN=Test Issuer %d", idx);
+      n = make_blob (buffer, fpr, idx + 1, issuer);
+      if (fwrite (buffer, n, 1, fp) != 1)
+        {
+          fprintf (stderr, "error writing `%s': %s\n",
+                   KBXFNAME, strerror (errno));
+          exit (1);
+        }
+      offsets[idx] = off;
+      off += n;
+    }
+  if (fclose (fp))
+    {
+      fprintf (stderr, "error writing `%s': %s\n", KBXFNAME, strerror (errno));
+      exit (1);
+    }
+}
+
+
+static void
+test_headerless_keybox (void)
+{
+  off_t offsets[NBLOBS];
+  void *token;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  unsigned char fpr[20];
+  unsigned char sn[4];
+  char issuer[40];
+  int idx, rc;
+
+  write_keybox (offsets);
+
+  token = keybox_register_file (KBXFNAME, 0);
+  if (!token)
+    {
+      fprintf (stderr, "can't register `%s'\n", KBXFNAME);
+      exit (1);
+    }
+  hd = keybox_new (token, 0);
+  if (!hd)
+    {
+      fprintf (stderr, "can't open `%s'\n", KBXFNAME);
+      exit (1);
+    }
+
+  /* The first search builds the index.  */
+  for (idx=0; idx < NBLOBS; idx++)
+    {
+      make_fpr (fpr, idx);
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_FPR;
+      memcpy (desc.u.fpr, fpr, 20);
+      keybox_search_reset (hd);
+      rc = keybox_search (hd, &desc, 1);
+      if (rc)
+        {
+          fail (idx);
+          if (verbose)
+            fprintf (stderr, "fingerprint %d: search failed: rc=%d\n",
+                     idx, rc);
+        }
+      else if (_keybox_get_blob_fileoffset (hd->found.blob) != offsets[idx])
+        {
+          fail (idx);
+          if (verbose)
+            fprintf (stderr, "fingerprint %d: found at %ld, expected %ld\n",
+                     idx, (long)_keybox_get_blob_fileoffset (hd->found.blob),
+                     (long)offsets[idx]);
+        }
+      else
+        pass ();
+    }
+
+  if (access (KBXFNAME ".idx", F_OK))
+    {
+      fail (NBLOBS);
+      if (verbose)
+        fprintf (stderr, "no index has been created\n");
+    }
+
+  for (idx=0; idx < NBLOBS; idx++)
+    {
+      snprintf (issuer, sizeof issuer, "CN=Test Issuer %d", idx);
+      put32 (sn, idx + 1);
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_ISSUER_SN;
+      desc.u.name = issuer;
+      desc.sn = sn;
+      desc.snlen = 4;
+      keybox_search_reset (hd);
+      rc = keybox_search (hd, &desc, 1);
+      if (rc)
+        {
+          fail (idx);
+          if (verbose)
+            fprintf (stderr, "issuer/serial %d: search failed: rc=%d\n",
+                     idx, rc);
+        }
+      else if (_keybox_get_blob_fileoffset (hd->found.blob) != offsets[idx])
+        fail (idx);
+      else
+        pass ();
+    }
+
+  keybox_release (hd);
+  remove (KBXFNAME);
+  remove (KBXFNAME ".idx");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_headerless_keybox ();
+
+  return !!errcount;
+}
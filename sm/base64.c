@@ -310,6 +310,22 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 
           while (n < count && parm->readpos < parm->linelen )
             {
+              if (!idx && count - n >= 3
+                  && parm->linelen - parm->readpos >= 4)
+                {
+                  /* Fast path: decode complete groups in one go.  */
+                  size_t avail = parm->linelen - parm->readpos;
+                  size_t used;
+
+                  if (avail / 4 > (count - n) / 3)
+                    avail = (count - n) / 3 * 4;
+                  n += radix64_decode_block (buffer + n,
+                                             parm->line + parm->readpos,
+                                             avail, &used);
+                  parm->readpos += used;
+                  if (used)
+                    continue;
+                }
               c = parm->line[parm->readpos++];
               if (c == '\n' || c == ' ' || c == '\r' || c == '\t')
                 continue;
@@ -428,7 +444,7 @@ base64_writer_cb (void *cb_value, const void *buffer, size_t count)
 {
   struct writer_cb_parm_s *parm = cb_value;
   unsigned char radbuf[4];
-  int i, c, idx, quad_count;
+  int i, idx, quad_count;
   const unsigned char *p;
   FILE *fp = parm->fp;
   estream_t stream = parm->stream;
@@ -454,25 +470,40 @@ base64_writer_cb (void *cb_value, const void *buffer, size_t count)
   for (i=0; i < idx; i++)
     radbuf[i] = parm->base64.radbuf[i];
 
-  for (p=buffer; count; p++, count--)
+  p = buffer;
+  while (count)
     {
-      radbuf[idx++] = *p;
-      if (idx > 2)
+      char line[64+1];
+      size_t ngroups;
+
+      if (idx || count < 3)
         {
+          /* Collect the bytes of an incomplete group.  */
+          radbuf[idx++] = *p++;
+          count--;
+          if (idx < 3)
+            continue;
+          radix64_encode_block (line, radbuf, 1);
+          ngroups = 1;
           idx = 0;
-          c = bintoasc[(*radbuf >> 2) & 077];
-          do_putc (c, fp, stream);
-          c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-          do_putc (c, fp, stream);
-          c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-          do_putc (c, fp, stream);
-          c = bintoasc[radbuf[2]&077];
-          do_putc (c, fp, stream);
-          if (++quad_count >= (64/4)) 
-            {
-              do_fputs (LF, fp, stream);
-              quad_count = 0;
-            }
+        }
+      else
+        {
+          /* Encode as much as fits on the current line.  */
+          ngroups = (64/4) - quad_count;
+          if (ngroups > count / 3)
+            ngroups = count / 3;
+          radix64_encode_block (line, p, ngroups);
+          p += 3 * ngroups;
+          count -= 3 * ngroups;
+        }
+      line[4 * ngroups] = 0;
+      do_fputs (line, fp, stream);
+      quad_count += ngroups;
+      if (quad_count >= (64/4)) 
+        {
+          do_fputs (LF, fp, stream);
+          quad_count = 0;
         }
     }
   for (i=0; i < idx; i++)
@@ -38,6 +38,10 @@
 #include "keydb.h" /* fixme: Move this to import.c */
 #include "membuf.h"
 
+/* The maximum size of the signing list the agent accepts for PKSIGN
+   --multi (see agent/command.c).  */
+#define MAXLEN_SIGNLIST 16384
+
 
 static assuan_context_t agent_ctx = NULL;
 
@@ -50,6 +54,14 @@ struct cipher_parm_s
   size_t ciphertextlen;
 };
 
+struct signlist_parm_s
+{
+  ctrl_t ctrl;
+  assuan_context_t ctx;
+  const void *list;
+  size_t listlen;
+};
+
 struct genkey_parm_s
 {
   ctrl_t ctrl;
@@ -216,6 +228,220 @@ gpgsm_agent_pksign (ctrl_t ctrl, const char *keygrip, const char *desc,
 }
 
 
+/* Inquire callback for gpgsm_agent_pksign_multi.  */
+static gpg_error_t
+inq_signlist_cb (void *opaque, const char *line)
+{
+  struct signlist_parm_s *parm = opaque;
+  int rc;
+
+  if (!strncmp (line, "SIGNLIST", 8) && (line[8]==' '||!line[8]))
+    rc = assuan_send_data (parm->ctx, parm->list, parm->listlen);
+  else
+    rc = default_inq_cb (parm->ctrl, line);
+
+  return rc;
+}
+
+
+/* Return true if the agent supports PKSIGN --multi.  */
+static int
+agent_has_pksign_multi (void)
+{
+  static int supported = -1;
+
+  if (supported == -1)
+    supported = !assuan_transact (agent_ctx,
+                                  "GETINFO cmd_has_option PKSIGN multi",
+                                  NULL, NULL, NULL, NULL, NULL, NULL);
+  return supported;
+}
+
+
+/* Send one PKSIGN --multi request for the NITEMS entries of ITEMS.
+   LIST is the part of the signing list describing these entries.  */
+static int
+pksign_multi_request (ctrl_t ctrl, struct agent_pksign_item_s *items,
+                      int nitems, const void *list, size_t listlen)
+{
+  int rc, i;
+  membuf_t data;
+  struct signlist_parm_s signlist_parm;
+  unsigned char *buf, *p;
+  size_t len, n;
+
+  rc = assuan_transact (agent_ctx, "RESET", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (rc)
+    return rc;
+
+  signlist_parm.ctrl = ctrl;
+  signlist_parm.ctx = agent_ctx;
+  signlist_parm.list = list;
+  signlist_parm.listlen = listlen;
+  init_membuf (&data, 1024);
+  rc = assuan_transact (agent_ctx, "PKSIGN --multi",
+                        membuf_data_cb, &data,
+                        inq_signlist_cb, &signlist_parm, NULL, NULL);
+  buf = get_membuf (&data, &len);
+  if (rc)
+    {
+      xfree (buf);
+      return rc;
+    }
+  if (!buf)
+    return out_of_core ();
+
+  /* The result is the concatenation of the signatures.  */
+  for (p=buf, i=0; i < nitems && !rc; i++)
+    {
+      n = gcry_sexp_canon_len (p, len, NULL, NULL);
+      if (!n)
+        rc = gpg_error (GPG_ERR_INV_VALUE);
+      else if (!(items[i].sigval = xtrymalloc (n)))
+        rc = out_of_core ();
+      else
+        {
+          memcpy (items[i].sigval, p, n);
+          items[i].sigvallen = n;
+          p += n;
+          len -= n;
+        }
+    }
+  if (!rc && len)
+    rc = gpg_error (GPG_ERR_INV_VALUE);
+  xfree (buf);
+  return rc;
+}
+
+
+/* Call the agent to create the signatures for all NITEMS entries of
+   ITEMS.  If the agent supports it, this is done by PKSIGN --multi
+   requests, each with as many items as fit into the size limit of
+   the agent; otherwise gpgsm_agent_pksign is called for each item.
+   On success the signatures are stored in the SIGVAL fields; on
+   error all of them are NULL and the index of the item which could
+   not be signed is stored at R_FAILED.  For a failed PKSIGN --multi
+   request this is the first item of that request; if the error is
+   not related to an item -1 is stored.  */
+int
+gpgsm_agent_pksign_multi (ctrl_t ctrl,
+                          struct agent_pksign_item_s *items, int nitems,
+                          int *r_failed)
+{
+  int rc, i, k;
+  membuf_t list;
+  char hexdigest[2*64+1];
+  char numbuf[25];
+  char *listbuf = NULL;
+  size_t *lineoff = NULL;
+  size_t len;
+
+  *r_failed = -1;
+  for (i=0; i < nitems; i++)
+    items[i].sigval = NULL;
+
+  rc = start_agent (ctrl);
+  if (rc)
+    return rc;
+
+  if (nitems < 2 || !agent_has_pksign_multi ())
+    {
+      for (i=0; i < nitems; i++)
+        {
+          rc = gpgsm_agent_pksign (ctrl, items[i].keygrip, items[i].desc,
+                                   items[i].digest, items[i].digestlen,
+                                   items[i].digestalgo,
+                                   &items[i].sigval, &items[i].sigvallen);
+          if (rc)
+            {
+              *r_failed = i;
+              break;
+            }
+        }
+      goto leave;
+    }
+
+  /* Build the lines of the signing list and remember where each of
+     them starts, so that the list can be sent in parts.  */
+  lineoff = xtrycalloc (nitems + 1, sizeof *lineoff);
+  if (!lineoff)
+    return out_of_core ();
+  init_membuf (&list, 1024);
+  for (i=0; i < nitems; i++)
+    {
+      if (items[i].digestlen*2 + 1 > sizeof hexdigest)
+        {
+          xfree (get_membuf (&list, &len));
+          xfree (lineoff);
+          return gpg_error (GPG_ERR_GENERAL);
+        }
+      snprintf (numbuf, sizeof numbuf, " %d ", items[i].digestalgo);
+      put_membuf_str (&list, items[i].keygrip);
+      put_membuf_str (&list, numbuf);
+      put_membuf_str (&list, bin2hex (items[i].digest, items[i].digestlen,
+                                      hexdigest));
+      if (items[i].desc)
+        {
+          put_membuf (&list, " ", 1);
+          put_membuf_str (&list, items[i].desc);
+        }
+      put_membuf (&list, "\n", 1);
+      lineoff[i+1] = get_membuf_len (&list);
+    }
+  listbuf = get_membuf (&list, &len);
+  if (!listbuf)
+    {
+      xfree (lineoff);
+      return out_of_core ();
+    }
+
+  for (i=0; i < nitems && !rc; i = k)
+    {
+      for (k=i+1;
+           k < nitems && lineoff[k+1] - lineoff[i] <= MAXLEN_SIGNLIST; k++)
+        ;
+      if (k - i > 1)
+        {
+          rc = pksign_multi_request (ctrl, items + i, k - i,
+                                     listbuf + lineoff[i],
+                                     lineoff[k] - lineoff[i]);
+          /* An agent with a lower limit rejects the list; sign the
+             items one by one then.  */
+          if (gpg_err_code (rc) != GPG_ERR_ASS_TOO_MUCH_DATA)
+            {
+              if (rc)
+                *r_failed = i;
+              continue;
+            }
+          rc = 0;
+        }
+      for (; i < k; i++)
+        {
+          rc = gpgsm_agent_pksign (ctrl, items[i].keygrip, items[i].desc,
+                                   items[i].digest, items[i].digestlen,
+                                   items[i].digestalgo,
+                                   &items[i].sigval, &items[i].sigvallen);
+          if (rc)
+            {
+              *r_failed = i;
+              break;
+            }
+        }
+    }
+
+ leave:
+  xfree (listbuf);
+  xfree (lineoff);
+  if (rc)
+    for (i=0; i < nitems; i++)
+      {
+        xfree (items[i].sigval);
+        items[i].sigval = NULL;
+      }
+  return rc;
+}
+
+
 /* Call the scdaemon to do a sign operation using the key identified by
    the hex string KEYID. */
 int
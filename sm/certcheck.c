@@ -436,4 +436,63 @@ gpgsm_create_cms_signature (ctrl_t ctrl, ksba_cert_t cert,
 }
 
 
+/* Create the signatures for all certificates in SIGNERLIST.  MDS is
+   an array with the hash contexts for each signer in the order of
+   SIGNERLIST; the hash algorithm used is the one of the signer.  On
+   success the signatures are stored in the array R_SIGVALS which
+   must have as many elements as there are signers.  All signatures
+   are requested from the agent at once.  On error the index of the
+   signer which failed is stored at R_FAILED, or -1 if the error is
+   not related to a signer.  */
+int
+gpgsm_create_cms_signatures (ctrl_t ctrl, certlist_t signerlist,
+                             gcry_md_hd_t *mds, unsigned char **r_sigvals,
+                             int *r_failed)
+{
+  int rc = 0;
+  int i, nitems;
+  certlist_t cl;
+  struct agent_pksign_item_s *items;
+
+  *r_failed = -1;
+  for (nitems=0, cl=signerlist; cl; cl = cl->next)
+    nitems++;
+  if (!nitems)
+    return 0;
+
+  items = xtrycalloc (nitems, sizeof *items);
+  if (!items)
+    return gpg_error_from_syserror ();
+
+  for (i=0, cl=signerlist; cl; cl = cl->next, i++)
+    {
+      items[i].keygrip = gpgsm_get_keygrip_hexstring (cl->cert);
+      if (!items[i].keygrip)
+        {
+          rc = gpg_error (GPG_ERR_BAD_CERT);
+          *r_failed = i;
+          goto leave;
+        }
+      items[i].desc = gpgsm_format_keydesc (cl->cert);
+      items[i].digest = gcry_md_read (mds[i], cl->hash_algo);
+      items[i].digestlen = gcry_md_get_algo_dlen (cl->hash_algo);
+      items[i].digestalgo = cl->hash_algo;
+    }
+
+  rc = gpgsm_agent_pksign_multi (ctrl, items, nitems, r_failed);
+  if (!rc)
+    for (i=0; i < nitems; i++)
+      r_sigvals[i] = items[i].sigval;
+
+ leave:
+  for (i=0; i < nitems; i++)
+    {
+      xfree (items[i].keygrip);
+      xfree (items[i].desc);
+    }
+  xfree (items);
+  return rc;
+}
+
+
 
@@ -300,6 +300,9 @@ int gpgsm_check_cms_signature (ksba_cert_t cert, ksba_const_sexp_t sigval,
 int gpgsm_create_cms_signature (ctrl_t ctrl,
                                 ksba_cert_t cert, gcry_md_hd_t md, int mdalgo,
                                 unsigned char **r_sigval);
+int gpgsm_create_cms_signatures (ctrl_t ctrl, certlist_t signerlist,
+                                 gcry_md_hd_t *mds, unsigned char **r_sigvals,
+                                 int *r_failed);
 
 
 /*-- certchain.c --*/
@@ -378,11 +381,26 @@ gpg_error_t gpgsm_qualified_consent (ctrl_t ctrl, ksba_cert_t cert);
 gpg_error_t gpgsm_not_qualified_warning (ctrl_t ctrl, ksba_cert_t cert);
 
 /*-- call-agent.c --*/
+/* An item of the list passed to gpgsm_agent_pksign_multi.  */
+struct agent_pksign_item_s
+{
+  char *keygrip;          /* Hex encoded keygrip.  */
+  char *desc;             /* Description for the pinentry or NULL.  */
+  unsigned char *digest;
+  size_t digestlen;
+  int digestalgo;
+  unsigned char *sigval;  /* Returns the signature.  */
+  size_t sigvallen;
+};
+
 int gpgsm_agent_pksign (ctrl_t ctrl, const char *keygrip, const char *desc,
                         unsigned char *digest,
                         size_t digestlen,
                         int digestalgo,
                         unsigned char **r_buf, size_t *r_buflen);
+int gpgsm_agent_pksign_multi (ctrl_t ctrl,
+                              struct agent_pksign_item_s *items, int nitems,
+                              int *r_failed);
 int gpgsm_scd_pksign (ctrl_t ctrl, const char *keyid, const char *desc,
                       unsigned char *digest, size_t digestlen, int digestalgo,
                       unsigned char **r_buf, size_t *r_buflen);
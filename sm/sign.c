@@ -238,6 +238,18 @@ get_default_signer (ctrl_t ctrl)
   return cert;
 }
 
+/* Start the audit log section for signer number SIGNER of
+   SIGNERLIST.  */
+static void
+audit_log_signer (ctrl_t ctrl, certlist_t signerlist, int signer)
+{
+  certlist_t cl;
+
+  audit_log_i (ctrl->audit, AUDIT_NEW_SIG, signer);
+  for (cl=signerlist; cl; cl = cl->next)
+    audit_log_i (ctrl->audit, AUDIT_ATTR_HASH_ALGO, cl->hash_algo);
+}
+
 /* Depending on the options in CTRL add the certificate CERT as well as
    other certificate up in the chain to the Root-CA to the CMS
    object. */
@@ -326,6 +338,10 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
   ksba_isotime_t signed_at;
   certlist_t cl;
   int release_signerlist = 0;
+  int nsigners = 0;
+  gcry_md_hd_t *sig_mds = NULL;
+  unsigned char **sigvals = NULL;
+  int failed;
 
   audit_set_type (ctrl->audit, AUDIT_TYPE_SIGN);
 
@@ -659,9 +675,21 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
         }
       else if (stopreason == KSBA_SR_NEED_SIG)
         {
-          /* Compute the signature for all signers.  */
+          /* Compute the signature for all signers.  The hashes of
+             the signed attributes are computed first so that the
+             agent can be asked for all signatures at once.  */
           gcry_md_hd_t md;
 
+          for (nsigners=0, cl=signerlist; cl; cl = cl->next)
+            nsigners++;
+          sig_mds = xtrycalloc (nsigners, sizeof *sig_mds);
+          sigvals = xtrycalloc (nsigners, sizeof *sigvals);
+          if (!sig_mds || !sigvals)
+            {
+              rc = gpg_error_from_syserror ();
+              goto leave;
+            }
+
           rc = gcry_md_open (&md, 0, 0);
           if (rc)
             {
@@ -673,21 +701,13 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
           ksba_cms_set_hash_function (cms, HASH_FNC, md);
           for (cl=signerlist,signer=0; cl; cl = cl->next, signer++)
             {
-              unsigned char *sigval = NULL;
-              char *buf, *fpr;
-
-              audit_log_i (ctrl->audit, AUDIT_NEW_SIG, signer);
               if (signer)
                 gcry_md_reset (md);
               {
                 certlist_t cl_tmp;
 
                 for (cl_tmp=signerlist; cl_tmp; cl_tmp = cl_tmp->next)
-                  {
-                    gcry_md_enable (md, cl_tmp->hash_algo);
-                    audit_log_i (ctrl->audit, AUDIT_ATTR_HASH_ALGO,
-                                 cl_tmp->hash_algo);
-                  }
+                  gcry_md_enable (md, cl_tmp->hash_algo);
               }
 
               rc = ksba_cms_hash_signed_attrs (cms, signer);
@@ -699,24 +719,48 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
                   goto leave;
                 }
 
-              rc = gpgsm_create_cms_signature (ctrl, cl->cert,
-                                               md, cl->hash_algo, &sigval);
+              rc = gcry_md_copy (&sig_mds[signer], md);
               if (rc)
                 {
-                  audit_log_cert (ctrl->audit, AUDIT_SIGNED_BY, cl->cert, rc);
+                  log_error ("md_copy failed: %s\n", gpg_strerror (rc));
                   gcry_md_close (md);
                   goto leave;
                 }
+            }
+          gcry_md_close (md);
+
+          rc = gpgsm_create_cms_signatures (ctrl, signerlist,
+                                            sig_mds, sigvals, &failed);
+          if (rc)
+            {
+              /* Record the error only for the signer which failed;
+                 no signature has been stored for the signers before
+                 it.  */
+              for (cl=signerlist,signer=0; cl; cl = cl->next, signer++)
+                {
+                  audit_log_signer (ctrl, signerlist, signer);
+                  if (signer == failed)
+                    {
+                      audit_log_cert (ctrl->audit, AUDIT_SIGNED_BY,
+                                      cl->cert, rc);
+                      break;
+                    }
+                }
+              goto leave;
+            }
 
-              err = ksba_cms_set_sig_val (cms, signer, sigval);
-              xfree (sigval);
+          for (cl=signerlist,signer=0; cl; cl = cl->next, signer++)
+            {
+              char *buf, *fpr;
+
+              audit_log_signer (ctrl, signerlist, signer);
+              err = ksba_cms_set_sig_val (cms, signer, sigvals[signer]);
               if (err)
                 {
                   audit_log_cert (ctrl->audit, AUDIT_SIGNED_BY, cl->cert, err);
                   log_error ("failed to store the signature: %s\n",
                              gpg_strerror (err));
                   rc = err;
-                  gcry_md_close (md);
                   goto leave;
                 }
 
@@ -725,7 +769,6 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
               if (!fpr)
                 {
                   rc = gpg_error (GPG_ERR_ENOMEM);
-                  gcry_md_close (md);
                   goto leave;
                 }
               rc = 0;
@@ -742,15 +785,11 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
               }
               xfree (fpr);
               if (rc)
-                {
-                  gcry_md_close (md);
-                  goto leave;
-                }
+                goto leave;
               gpgsm_status (ctrl, STATUS_SIG_CREATED, buf);
               xfree (buf);
               audit_log_cert (ctrl->audit, AUDIT_SIGNED_BY, cl->cert, 0);
             }
-          gcry_md_close (md);
         }
     }
   while (stopreason != KSBA_SR_READY);
@@ -776,5 +815,14 @@ gpgsm_sign (ctrl_t ctrl, certlist_t signerlist,
   gpgsm_destroy_writer (b64writer);
   keydb_release (kh);
   gcry_md_close (data_md);
+  for (i=0; i < nsigners; i++)
+    {
+      if (sig_mds)
+        gcry_md_close (sig_mds[i]);
+      if (sigvals)
+        xfree (sigvals[i]);
+    }
+  xfree (sig_mds);
+  xfree (sigvals);
   return rc;
 }